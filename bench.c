@@ -0,0 +1,595 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/stat.h>
+
+#include"./include/6502c.h"
+#include"./include/bus.h"
+#include"./include/ram.h"
+#include"./include/ppu.h"
+#include"./include/apu.h"
+#include"./include/scheduler.h"
+#include"./include/hash.h"
+#include"./include/snapshot.h"
+#include"./include/env.h"
+#include"./include/lockstep.h"
+#include"./include/input.h"
+#include"./include/idle.h"
+#include"./include/fusion.h"
+#include"./include/aot.h"
+#include"./include/exec_tree.h"
+#include"./include/cfg.h"
+#include"./include/cfg_cache.h"
+
+// Generated from the copy loop by ./recompile
+int aot_copy_loop(addr16 pc);
+
+
+double elapsed_sec(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// Every tile is noise, every nametable cell uses a different tile and 64 sprites are on screen
+void load_pattern_scene() {
+    init_PPU(MIRROR_VERTICAL);
+    srand(1);
+
+    for(addr16 addr=0x0000; addr<CHR_SIZE; addr++) { ppu_write(addr, rand()); }
+    for(addr16 addr=0x2000; addr<0x2800; addr++) { ppu_write(addr, addr & 0xff); }
+    for(int i=0; i<32; i++) { ppu_write(0x3f00 + i, (i * 7) & 0x3f); }
+
+    for(int i=0; i<64; i++) {
+        mainPPU.oam[i*4] = (i * 29) % 232;
+        mainPPU.oam[i*4 + 1] = i;
+        mainPPU.oam[i*4 + 2] = i & 0xe3;
+        mainPPU.oam[i*4 + 3] = (i * 37) & 0xff;
+    }
+
+    writeCPU(0x2000, 0x10); // Background from $1000, sprites from $0000
+    writeCPU(0x2001, 0x1e); // Show everything
+}
+
+
+void bench_ppu(int frames) {
+    struct timespec start, end;
+
+    load_pattern_scene();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<frames; i++) {
+        ppu_render_frame();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("ppu: %d frames in %.3f s (%.1f fps)\n", frames, secs, frames / secs);
+
+    // Same scene, but one tile is rewritten through $2006/$2007 every frame
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<frames; i++) {
+        writeCPU(0x2006, 0x10);
+        writeCPU(0x2006, (i & 0x0f) << 4);
+        for(int j=0; j<16; j++) { writeCPU(0x2007, i + j); }
+        writeCPU(0x2000, 0x10);
+        writeCPU(0x2005, 0x00);
+        writeCPU(0x2005, 0x00);
+        ppu_render_frame();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = elapsed_sec(&start, &end);
+    printf("ppu + CHR-RAM writes: %d frames in %.3f s (%.1f fps)\n", frames, secs, frames / secs);
+}
+
+
+unsigned long frame_checksum(unsigned int *rgba) {
+    unsigned long sum = 0;
+    for(int i=0; i<SCREEN_WIDTH * SCREEN_HEIGHT; i++) { sum = sum * 31 + rgba[i]; }
+    return sum;
+}
+
+
+// Scalar vs SIMD compositing and palette conversion, per frame
+void bench_compose(int frames) {
+    static unsigned int rgba[SCREEN_WIDTH * SCREEN_HEIGHT];
+    byte bg[SCREEN_WIDTH], spr[SCREEN_WIDTH], behind[SCREEN_WIDTH], zero[SCREEN_WIDTH], out[SCREEN_WIDTH];
+    struct timespec start, end;
+
+    srand(2);
+    for(int x=0; x<SCREEN_WIDTH; x++) {
+        bg[x] = rand() & 0x0f;
+        spr[x] = (rand() & 1) ? 0x10 | (rand() & 0x0f) : 0;
+        behind[x] = rand() & 0x20;
+        zero[x] = x > 200;
+    }
+
+    for(int level=KERNEL_SCALAR; level<=KERNEL_AVX2; level++) {
+        load_pattern_scene();
+        if(ppu_select_kernels(level) != level) {
+            printf("%s: not supported by this CPU\n", ppu_kernel_name(level));
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i=0; i<frames * SCREEN_HEIGHT; i++) { ppu_compose_line(bg, spr, behind, zero, out); }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double compose_us = elapsed_sec(&start, &end) * 1e6 / frames;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i=0; i<frames; i++) { ppu_render_frame(); }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double render_us = elapsed_sec(&start, &end) * 1e6 / frames;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i=0; i<frames; i++) { ppu_frame_to_rgba(rgba); }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double rgba_us = elapsed_sec(&start, &end) * 1e6 / frames;
+
+        printf("%s: compose %.1f us/frame, render %.1f us/frame, rgba %.1f us/frame, checksum %016lx\n",
+                ppu_kernel_name(level), compose_us, render_us, rgba_us, frame_checksum(rgba));
+    }
+}
+
+
+// OAM DMA through $4014 against the same copy done byte by byte through $2004
+void bench_dma(int count) {
+    struct timespec start, end;
+
+    load_pattern_scene();
+    for(int i=0; i<256; i++) { mem_write(0x0200 + i, i); }
+
+    // The clock is held still so the stolen cycles do not render scanlines
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) {
+        mainCPU.cycles = 0;
+        writeCPU(OAM_DMA, 0x02);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double dma_ns = elapsed_sec(&start, &end) * 1e9 / count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) {
+        writeCPU(0x2003, 0x00);
+        for(int j=0; j<256; j++) { writeCPU(0x2004, readCPU(0x0200 + j)); }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double bytes_ns = elapsed_sec(&start, &end) * 1e9 / count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<100; i++) { ppu_render_frame(); }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double frame_ns = elapsed_sec(&start, &end) * 1e9 / 100;
+
+    printf("dma: %.0f ns per $4014 write, %.0f ns byte by byte, %.3f%% of a rendered frame\n",
+            dma_ns, bytes_ns, dma_ns * 100 / frame_ns);
+}
+
+
+// Two pulses, the triangle and the noise channel playing for the whole run
+void bench_apu(int frames) {
+    struct timespec start, end;
+    short samples[2048];
+    unsigned long cycles = 0;
+    long sample_count = 0;
+
+    clear_events();
+    init_APU(0);
+    apu_enable_output(APU_SAMPLE_RATE);
+
+    byte regs[][2] = {
+        {0x15, 0x0f},
+        {0x00, 0xbf}, {0x02, 0xfd}, {0x03, 0x00},
+        {0x04, 0x7f}, {0x06, 0x7e}, {0x07, 0x01},
+        {0x08, 0xff}, {0x0a, 0x40}, {0x0b, 0x01},
+        {0x0c, 0x3f}, {0x0e, 0x05}, {0x0f, 0x00}
+    };
+    for(int i=0; i<sizeof(regs) / sizeof(regs[0]); i++) {
+        apu_write_register(APU_REG_BEGIN + regs[i][0], regs[i][1]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<frames; i++) {
+        cycles += 29781; // CPU cycles per NTSC frame
+        run_events(cycles);
+        int count = apu_read_samples(cycles, samples, 2048);
+        sample_count += count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("apu: %ld samples in %.3f s, %.1f us per frame, %.0fx real time\n",
+            sample_count, secs, secs * 1e6 / frames, (double)sample_count / APU_SAMPLE_RATE / secs);
+}
+
+
+// Framebuffer and CPU + RAM hashes of the pattern scene
+void bench_hash(int count) {
+    struct timespec start, end;
+    hash64 sum = 0;
+
+    load_pattern_scene();
+    ppu_render_frame();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) { sum += hash_frame(); }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double frame_secs = elapsed_sec(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) { sum += hash_state(); }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double state_secs = elapsed_sec(&start, &end);
+
+    printf("hash: frame %.1f us (%.2f GB/s), CPU + RAM %.1f us (%.2f GB/s), checksum %016llx\n",
+            frame_secs * 1e6 / count, sizeof(mainPPU.frame) * (double)count / frame_secs / 1e9,
+            state_secs * 1e6 / count, sizeof(RAM) * (double)count / state_secs / 1e9, sum);
+}
+
+
+// Run-ahead of 1 to RUN_AHEAD_MAX frames on a ROM
+void bench_runahead(int frames, char *rom) {
+    static byte display[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    start_bus_ines(rom);
+
+    Snapshot *snap = create_snapshot();
+
+    for(int ahead=0; ahead<=RUN_AHEAD_MAX; ahead = ahead ? ahead * 2 : 1) {
+        RunAheadStats stats = {0};
+
+        for(int i=0; i<frames; i++) {
+            run_frame_ahead(snap, ahead, &display[0][0], &stats);
+        }
+
+        printf("ahead %d: ", ahead);
+        print_run_ahead_stats(&stats);
+    }
+
+    free_snapshot(snap);
+}
+
+
+// Batches of 64 instances stepping 4 frames at a time, on one thread and on every core
+void bench_env(int steps, char *rom) {
+    const int instances = 64;
+    const int frames = 4;
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    byte actions[64];
+    byte *observations = (byte *)malloc((long)instances * ENV_OBS_SIZE);
+    struct timespec start, end;
+
+    int thread_counts[2] = {1, cores};
+
+    for(int t=0; t<(cores > 1 ? 2 : 1); t++) {
+        int threads = thread_counts[t];
+        EnvBatch *batch = env_create(rom, instances, threads);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int step=0; step<steps; step++) {
+            for(int i=0; i<instances; i++) { actions[i] = (step * 31 + i * 17) & 0xff; }
+            env_step(batch, actions, frames, observations);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double secs = elapsed_sec(&start, &end);
+        double total = (double)instances * frames * steps / secs;
+        printf("env: %d instances on %d threads, %.0f frames/s, %.0f frames/s per thread\n",
+                instances, threads, total, total / threads);
+
+        env_destroy(batch);
+    }
+
+    free(observations);
+}
+
+
+// Lanes of the lockstep core against running every lane on its own with the interpreter.
+// Every lane adds two tables of its own random bytes, the branch on the sign of each sum
+// makes the lanes diverge and join again.
+void bench_lockstep(int instructions) {
+    static byte program[] = {
+        0xa2, 0x40,       // $0600 LDX #$40
+        0xbd, 0xff, 0x01, // $0602 LDA $01ff,X
+        0x18,             // $0605 CLC
+        0x7d, 0xff, 0x02, // $0606 ADC $02ff,X
+        0x9d, 0xff, 0x03, // $0609 STA $03ff,X
+        0x30, 0x02,       // $060c BMI $0610
+        0xe6, 0x10,       // $060e INC $10
+        0xca,             // $0610 DEX
+        0xd0, 0xef,       // $0611 BNE $0602
+        0xe6, 0x11,       // $0613 INC $11
+        0x4c, 0x00, 0x06, // $0615 JMP $0600
+    };
+    struct timespec start, end;
+
+    for(int lanes=8; lanes<=LOCKSTEP_MAX_LANES; lanes+=8) {
+        Lockstep *alone = lockstep_create(lanes, KERNEL_SCALAR);
+        Lockstep *together = lockstep_create(lanes, KERNEL_BEST);
+
+        lockstep_load(alone, 0x0600, program, sizeof(program));
+        lockstep_load(together, 0x0600, program, sizeof(program));
+        for(int lane=0; lane<lanes; lane++) {
+            srand(lane + 1);
+            for(addr16 addr=0x0200; addr<0x0340; addr++) {
+                lockstep_memory(alone, lane)[addr] = lockstep_memory(together, lane)[addr] = rand();
+            }
+        }
+        lockstep_reset(alone, 0x0600);
+        lockstep_reset(together, 0x0600);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int lane=0; lane<lanes; lane++) { lockstep_run_lane(alone, lane, instructions); }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double alone_secs = elapsed_sec(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lockstep_run(together, instructions);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double together_secs = elapsed_sec(&start, &end);
+
+        int same = memcmp(alone->memory, together->memory, (long)lanes * LOCKSTEP_MEM_SIZE) == 0;
+        same = same && memcmp(alone->A, together->A, sizeof(alone->A)) == 0;
+        same = same && memcmp(alone->X, together->X, sizeof(alone->X)) == 0;
+        same = same && memcmp(alone->Y, together->Y, sizeof(alone->Y)) == 0;
+        same = same && memcmp(alone->PC, together->PC, sizeof(alone->PC)) == 0;
+        same = same && memcmp(alone->status, together->status, sizeof(alone->status)) == 0;
+        same = same && memcmp(alone->cycles, together->cycles, sizeof(alone->cycles)) == 0;
+
+        double total = (double)lanes * instructions;
+        printf("lockstep: %d lanes, independent %.1f M instructions/s, lockstep %.1f M instructions/s (%.2fx), results %s\n",
+                lanes, total / alone_secs / 1e6, total / together_secs / 1e6, alone_secs / together_secs,
+                same ? "match" : "DIFFER");
+        printf("    ");
+        print_lockstep_stats(together);
+
+        lockstep_free(alone);
+        lockstep_free(together);
+    }
+}
+
+
+// Copy loop of tests/copy_loop.asm, LDA / STA with DEX / BNE, the sequences the fusions are made for
+#define COPY_LOOP "./tests/copy_loop.bin"
+
+
+// Starts the ROM, or the copy loop at $0600 without one
+void start_machine(char *rom) {
+    if(rom != NULL) {
+        start_bus_ines(rom);
+        return;
+    }
+
+    initCPU(readCPU, writeCPU);
+    clear_events();
+    init_PPU(MIRROR_HORIZONTAL);
+    init_APU(mainCPU.cycles);
+    init_input();
+    init_idle();
+    init_fusion();
+    memset(RAM, 0, sizeof(RAM));
+    load_prg(COPY_LOOP);
+    mainCPU.PC = 0x0600;
+}
+
+
+// Ranks the instruction sequences of a run by the dispatches fusing them would save
+void bench_mine(int frames, char *rom) {
+    start_machine(rom);
+    idle_enable(0);
+    fusion_enable(0);
+
+    FusionMiner *miner = fusion_mine_start();
+    for(int i=0; i<frames; i++) { run_frame(); }
+    fusion_mine_stop();
+
+    print_fusion_ranking(miner, 20);
+    free(miner);
+    idle_enable(1);
+    fusion_enable(1);
+}
+
+
+// Frames with every instruction dispatched on its own and with fusion, idle loops are not skipped
+void bench_fusion(int frames, char *rom) {
+    struct timespec start, end;
+    unsigned long dispatches[2], instructions = 0;
+    double secs[2];
+    hash64 state[2], frame[2];
+
+    for(int fused=0; fused<2; fused++) {
+        start_machine(rom);
+        idle_enable(0);
+        fusion_enable(fused);
+        if(!fused) { fusion_mine_start(); }
+        dispatches[fused] = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i=0; i<frames; i++) {
+            unsigned long count = mainPPU.frame_count;
+            while(mainPPU.frame_count == count) {
+                tick();
+                dispatches[fused] += 1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs[fused] = elapsed_sec(&start, &end);
+
+        if(!fused) {
+            instructions = fusion_miner->total;
+            free(fusion_miner);
+            fusion_mine_stop();
+        }
+        state[fused] = hash_state();
+        frame[fused] = hash_frame();
+    }
+
+    printf("fusion: %lu instructions, %lu dispatches unfused, %lu fused (%.1f%% fewer)\n",
+            instructions, dispatches[0], dispatches[1], 100.0 - dispatches[1] * 100.0 / dispatches[0]);
+    printf("fusion: %.1f M instructions/s unfused, %.1f M fused (%.2fx), state %s\n",
+            instructions / secs[0] / 1e6, instructions / secs[1] / 1e6, secs[0] / secs[1],
+            state[0] == state[1] && frame[0] == frame[1] ? "identical" : "DIFFERS");
+    print_fusion_stats();
+
+    idle_enable(1);
+}
+
+
+
+// The copy loop interpreted, interpreted with fusion and recompiled, idle loops are not skipped
+void bench_aot(int frames) {
+    static char *names[3] = {"interpreted", "fused", "recompiled"};
+    struct timespec start, end;
+    unsigned long instructions = 0;
+    double secs[3];
+    hash64 state[3], frame[3];
+
+    for(int run=0; run<3; run++) {
+        start_machine(NULL);
+        init_aot();
+        idle_enable(0);
+        fusion_enable(run == 1);
+        if(run == 0) { fusion_mine_start(); }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i=0; i<frames; i++) {
+            if(run == 2) { aot_run_frame(aot_copy_loop); }
+            else { run_frame(); }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs[run] = elapsed_sec(&start, &end);
+
+        if(run == 0) {
+            instructions = fusion_miner->total;
+            free(fusion_miner);
+            fusion_mine_stop();
+        }
+        state[run] = hash_state();
+        frame[run] = hash_frame();
+    }
+
+    for(int run=0; run<3; run++) {
+        printf("aot: %-11s %.1f M instructions/s (%.2fx), state %s\n", names[run],
+                instructions / secs[run] / 1e6, secs[0] / secs[run],
+                state[run] == state[0] && frame[run] == frame[0] ? "identical" : "DIFFERS");
+    }
+    print_aot_stats();
+
+    idle_enable(1);
+    fusion_enable(1);
+}
+
+
+// Builds the exec tree of the whole PRG ROM, written as a flat program, count times
+void bench_tree(int count, char *rom) {
+    struct timespec start, end;
+    char path[] = "/tmp/bench_prgXXXXXX";
+    int fd = mkstemp(path);
+
+    start_bus_ines(rom);
+    if(fd < 0 || write(fd, RAM + 0x8000, 0x8000) != 0x8000) {
+        printf("Error: cannot write %s\n", path);
+        exit(1);
+    }
+    close(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) {
+        ExecMap *map = build_exec_map(path);
+        link_tree(map);
+        if(i + 1 == count) { print_exec_map_memory(map); }
+        free_exec_map(map);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    unlink(path);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("tree: %d bytes, %.2f ms per build (%d builds)\n", 0x8000, secs * 1e3 / count, count);
+
+    // The graph only decodes what is reachable from the vectors
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) {
+        Cfg *cfg = build_cfg();
+        if(i + 1 == count) { print_cfg(cfg, 0); }
+        free_cfg(cfg);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double build_secs = elapsed_sec(&start, &end);
+
+    char dir[] = "/tmp/bench_cfgXXXXXX", cache[4096];
+    int hit;
+    if(mkdtemp(dir) == NULL) {
+        printf("Error: cannot create a cache directory\n");
+        exit(1);
+    }
+    free_cfg(cached_cfg(dir, &hit));
+    cfg_cache_path(cache, sizeof(cache), dir);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<count; i++) {
+        free_cfg(cached_cfg(dir, &hit));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct stat info;
+    stat(cache, &info);
+    unlink(cache);
+    rmdir(dir);
+
+    printf("cfg: %.2f ms per build, %.2f ms per load from a %ld byte cache (%s)\n", build_secs * 1e3 / count,
+            elapsed_sec(&start, &end) * 1e3 / count, (long)info.st_size, hit ? "hit" : "MISSED");
+}
+
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        printf("Usage: %s ppu|compose|dma|apu|hash|lockstep [count]\n       %s mine|fusion [frames] [rom.nes]\n       %s aot [frames]\n       %s runahead|env|tree count rom.nes\n", argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    int count = argc > 2 ? atoi(argv[2]) : 0;
+
+    if(strcmp(argv[1], "ppu") == 0) {
+        bench_ppu(count ? count : 1000);
+    }
+    else if(strcmp(argv[1], "compose") == 0) {
+        bench_compose(count ? count : 1000);
+    }
+    else if(strcmp(argv[1], "dma") == 0) {
+        bench_dma(count ? count : 100000);
+    }
+    else if(strcmp(argv[1], "apu") == 0) {
+        bench_apu(count ? count : 3600);
+    }
+    else if(strcmp(argv[1], "hash") == 0) {
+        bench_hash(count ? count : 10000);
+    }
+    else if(strcmp(argv[1], "lockstep") == 0) {
+        bench_lockstep(count ? count : 1000000);
+    }
+    else if(strcmp(argv[1], "mine") == 0) {
+        bench_mine(count ? count : 60, argc > 3 ? argv[3] : NULL);
+    }
+    else if(strcmp(argv[1], "fusion") == 0) {
+        bench_fusion(count ? count : 60, argc > 3 ? argv[3] : NULL);
+    }
+    else if(strcmp(argv[1], "aot") == 0) {
+        bench_aot(count ? count : 60);
+    }
+    else if(strcmp(argv[1], "tree") == 0 && argc > 3) {
+        bench_tree(count ? count : 10, argv[3]);
+    }
+    else if(strcmp(argv[1], "runahead") == 0 && argc > 3) {
+        bench_runahead(count ? count : 300, argv[3]);
+    }
+    else if(strcmp(argv[1], "env") == 0 && argc > 3) {
+        bench_env(count ? count : 20, argv[3]);
+    }
+    else {
+        printf("Unknown benchmark %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+#include"./include/6502c.h"
+#include"./include/bus.h"
+#include"./include/ppu.h"
+#include"./include/apu.h"
+#include"./include/wav.h"
+#include"./include/capture.h"
+#include"./include/golden.h"
+#include"./include/input.h"
+#include"./include/movie.h"
+#include"./include/snapshot.h"
+#include"./include/idle.h"
+#include"./include/fusion.h"
+#include"./include/cfg.h"
+#include"./include/cfg_cache.h"
+
+#define WAV_SAMPLE_RATE 48000
+
+
+double elapsed_sec(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        printf("Usage: %s <rom.nes> [frames] [options]\n", argv[0]);
+        printf("    --wav out.wav            write the audio\n");
+        printf("    --y4m out.y4m            capture the frames to a Y4M stream\n");
+        printf("    --ppm frame%%06lu.ppm     capture the frames to numbered PPM files\n");
+        printf("    --skip                   drop captured frames when the writer falls behind\n");
+        printf("    --golden rom.golden      check the hashes in a golden file, exit status 1 on a mismatch\n");
+        printf("    --record-golden out      write the hashes every %d frames\n", GOLDEN_RECORD_INTERVAL);
+        printf("    --play movie.nmv         replay the input movie, runs the whole movie if no frame count is given\n");
+        printf("    --record movie.nmv       record the input to a movie\n");
+        printf("    --random-input seed      press random buttons on controller 1\n");
+        printf("    --run-ahead N            show the frame N frames ahead, at most %d\n", RUN_AHEAD_MAX);
+        printf("    --no-idle-skip           run every pass of idle loops\n");
+        printf("    --no-fusion              dispatch every instruction on its own\n");
+        printf("    --cfg                    print the control-flow graph of the ROM, before and after the run refines it\n");
+        printf("    --cfg-full               print the routines, call graph and blocks too\n");
+        printf("    --cfg-cache dir          load the graph from the cache in dir, or build and cache it\n");
+        return 1;
+    }
+
+    int frames = 0;
+    char *wav_file = NULL;
+    char *capture_path = NULL;
+    int capture_format = CAPTURE_Y4M;
+    int capture_skip = 0;
+    char *golden_file = NULL;
+    char *record_file = NULL;
+    char *play_movie = NULL;
+    char *record_movie = NULL;
+    int random_input = 0;
+    unsigned int random_seed = 0;
+    int run_ahead = 0;
+    int idle_skip = 1;
+    int fusion = 1;
+    int cfg = 0;
+    char *cfg_cache = NULL;
+    struct timespec start, end;
+
+    for(int i=2; i<argc; i++) {
+        if(strcmp(argv[i], "--wav") == 0 && i + 1 < argc) { wav_file = argv[++i]; }
+        else if(strcmp(argv[i], "--y4m") == 0 && i + 1 < argc) { capture_path = argv[++i]; capture_format = CAPTURE_Y4M; }
+        else if(strcmp(argv[i], "--ppm") == 0 && i + 1 < argc) { capture_path = argv[++i]; capture_format = CAPTURE_PPM; }
+        else if(strcmp(argv[i], "--skip") == 0) { capture_skip = 1; }
+        else if(strcmp(argv[i], "--golden") == 0 && i + 1 < argc) { golden_file = argv[++i]; }
+        else if(strcmp(argv[i], "--record-golden") == 0 && i + 1 < argc) { record_file = argv[++i]; }
+        else if(strcmp(argv[i], "--play") == 0 && i + 1 < argc) { play_movie = argv[++i]; }
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) { record_movie = argv[++i]; }
+        else if(strcmp(argv[i], "--random-input") == 0 && i + 1 < argc) { random_input = 1; random_seed = atoi(argv[++i]); }
+        else if(strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) { run_ahead = atoi(argv[++i]); }
+        else if(strcmp(argv[i], "--no-idle-skip") == 0) { idle_skip = 0; }
+        else if(strcmp(argv[i], "--no-fusion") == 0) { fusion = 0; }
+        else if(strcmp(argv[i], "--cfg") == 0) { cfg = 1; }
+        else if(strcmp(argv[i], "--cfg-full") == 0) { cfg = 2; }
+        else if(strcmp(argv[i], "--cfg-cache") == 0 && i + 1 < argc) { cfg_cache = argv[++i]; if(!cfg) { cfg = 1; } }
+        else { frames = atoi(argv[i]); }
+    }
+
+    start_bus_ines(argv[1]);
+    idle_enable(idle_skip);
+    fusion_enable(fusion);
+
+    // The graph is refined with the code the run reaches
+    Cfg *graph = NULL;
+    int cache_hit = 0;
+    if(cfg) {
+        graph = cfg_cache != NULL ? cached_cfg(cfg_cache, &cache_hit) : build_cfg();
+        if(cfg_cache != NULL) { printf("cfg: %s\n", cache_hit ? "loaded from the cache" : "built and cached"); }
+        print_cfg(graph, 0);
+        cfg_refine_start(graph);
+    }
+
+    static short samples[4096];
+    WavWriter *wav = NULL;
+    Capture *capture = NULL;
+    static Golden golden;
+    FILE *record = NULL;
+    Movie *movie = NULL;
+    Movie *recording = NULL;
+    Snapshot *snapshot = NULL;
+    static RunAheadStats run_ahead_stats;
+    static byte display[SCREEN_HEIGHT][SCREEN_WIDTH];
+    byte *shown = &mainPPU.frame[0][0];
+
+    if(run_ahead > RUN_AHEAD_MAX) { run_ahead = RUN_AHEAD_MAX; }
+    if(run_ahead > 0) {
+        snapshot = create_snapshot();
+        shown = &display[0][0];
+    }
+
+    if(play_movie != NULL) {
+        movie = movie_play(play_movie);
+        if(!frames) { frames = movie->frames; }
+    }
+
+    if(record_movie != NULL) { recording = movie_record(record_movie); }
+    if(!frames) { frames = 600; }
+
+    // A golden run stops after the last check
+    if(golden_file != NULL) {
+        load_golden(golden_file, &golden);
+        frames = golden_last_frame(&golden);
+    }
+
+    if(record_file != NULL) {
+        record = fopen(record_file, "w");
+        if(record == NULL) {
+            printf("Error: cannot open %s for writing\n", record_file);
+            return 1;
+        }
+        fprintf(record, "# %s\n", argv[1]);
+    }
+
+    if(wav_file != NULL) {
+        apu_enable_output(WAV_SAMPLE_RATE);
+        wav = wav_open(wav_file, WAV_SAMPLE_RATE);
+    }
+
+    if(capture_path != NULL) {
+        capture = capture_open(capture_path, capture_format, capture_skip);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i<frames; i++) {
+        // A new controller state every 8 frames, a button would never be seen as pressed otherwise
+        if(random_input && i % 8 == 0) { input_push(0, rand_r(&random_seed)); }
+
+        input_begin_frame();
+        if(movie != NULL && !movie_play_frame(movie)) {
+            frames = i;
+            break;
+        }
+        if(recording != NULL) { movie_record_frame(recording); }
+
+        if(snapshot != NULL) { run_frame_ahead(snapshot, run_ahead, shown, &run_ahead_stats); }
+        else { run_frame(); }
+
+        if(wav != NULL) {
+            int count = apu_read_samples(mainCPU.cycles, samples, 4096);
+            wav_write(wav, samples, count);
+        }
+
+        if(capture != NULL) {
+            capture_frame(capture, mainPPU.frame_count, shown);
+        }
+
+        if(record != NULL && ((i + 1) % GOLDEN_RECORD_INTERVAL == 0 || i + 1 == frames)) {
+            golden_record(record, i + 1);
+        }
+
+        if(golden_file != NULL && golden_check(&golden, i + 1)) {
+            frames = i + 1;
+            break;
+        }
+    }
+    if(record != NULL) { fclose(record); }
+    if(movie != NULL) { movie_close(movie); }
+    if(recording != NULL) { movie_close(recording); }
+    if(wav != NULL) { wav_close(wav); }
+    if(capture != NULL) { capture_close(capture); }
+    if(snapshot != NULL) {
+        print_run_ahead_stats(&run_ahead_stats);
+        free_snapshot(snapshot);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = elapsed_sec(&start, &end);
+    printf("%d frames in %.3f s (%.1f fps)\n", frames, secs, frames / secs);
+    print_idle_stats();
+    print_fusion_stats();
+
+    if(graph != NULL) {
+        cfg_refine_stop();
+        print_cfg(graph, cfg == 2);
+
+        // The next run starts with what this one found
+        if(cfg_cache != NULL && (graph->refined_instructions || graph->target_count)) {
+            char path[4096];
+            cfg_cache_path(path, sizeof(path), cfg_cache);
+            save_cfg_cache(graph, path);
+        }
+        free_cfg(graph);
+    }
+
+    if(wav != NULL) {
+        printf("audio written to %s at %.1fx real time\n", wav_file, frames / 60.0988 / secs);
+    }
+
+    if(golden_file != NULL) {
+        printf("%s: %s, %d of %d checks run\n", argv[1], golden.failures ? "FAIL" : "PASS", golden.next, golden.count);
+        return golden.failures ? 1 : 0;
+    }
+
+    return 0;
+}
@@ -38,6 +38,9 @@ struct _6502c {
 
     byte status; // | 0 | C | Z | I | D | B | V | N |
 
+    unsigned long cycles;
+    byte opcode; // instruction being run, devices timed from its last cycle read it
+
     byte (*pullstack)();
     byte (*pushstack)(byte val);
 
@@ -45,7 +48,7 @@ struct _6502c {
     void (*writebus)(addr16, byte);
 };
 
-CPU mainCPU;
+extern _Thread_local CPU mainCPU;
 
 // General utils
 void initCPU(byte (*readbus)(addr16), void (*writebus)(addr16, byte));
@@ -58,11 +61,13 @@ byte stack_push(byte val);
 byte stack_pull();
 void push_PC();
 void pull_PC();
+void interrupt_NMI();
 
 //Opcode utils
 byte (*get_opcode_addressing(byte opcode))(byte*, addr16*);
 char *get_opcode_name(byte opcode);
 int instruction_len(byte opcode);
+int instruction_cycles(byte opcode);
 void (*get_opcode_func(byte opcode))(byte opcode, byte args[2]);
 int is_opcode_jump(byte opcode);
 
@@ -141,6 +146,14 @@ byte ROL_util(byte val);
 byte ROR_util(byte val);
 
 // Addressing modes
+addr16 zero_page_addr(byte args[2]);
+addr16 zero_page_x_addr(byte args[2]);
+addr16 zero_page_y_addr(byte args[2]);
+addr16 absolute_addr(byte args[2]);
+addr16 abs_x_addr(byte args[2]);
+addr16 abs_y_addr(byte args[2]);
+addr16 indirect_x_addr(byte args[2]);
+addr16 indirect_y_addr(byte args[2]);
 byte immediate(byte args[2], addr16 *val_addr);
 byte zero_page(byte args[2], addr16 *val_addr);
 byte zero_page_x(byte args[2], addr16 *val_addr);
@@ -0,0 +1,29 @@
+// Runtime of programs recompiled ahead of time by ./recompile. The generated C file has
+// one function per basic block that calls the opcode handlers with the opcodes and
+// arguments known at compile time, so nothing is fetched or decoded, and a dispatch
+// function that runs the block starting at a PC.
+// A block leaves as soon as an event ran, the frame ended or an NMI is pending, so the
+// machine stops between the same instructions as tick(). The interpreter runs the NMI,
+// every PC that starts no block (indirect jumps into the middle of a block, data) and
+// blocks whose code was overwritten since it was recompiled.
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _aot Aot;
+typedef int (*AotDispatch)(addr16 pc); // runs the block at pc, 0 if there is none
+
+struct _aot {
+    unsigned long frame; // frame being run
+    unsigned long blocks;
+    unsigned long interpreted;
+    unsigned long code_changed;
+};
+
+extern _Thread_local Aot mainAot;
+
+void init_aot();
+void aot_events(addr16 next);
+int aot_stopped(addr16 next);
+int aot_code_matches(addr16 addr, const byte *code, int len);
+void aot_run_frame(AotDispatch dispatch);
+void print_aot_stats();
@@ -0,0 +1,134 @@
+// The APU is not stepped every cycle. Channel timers only run when the APU catches up
+// with the CPU (register access, frame counter event or a sample request), every change
+// of the mixed output is logged with its CPU cycle and the log is turned into samples
+// through a band-limited step buffer only when a block of samples is requested.
+
+#include"blip.h"
+
+#define APU_REG_BEGIN 0x4000
+#define APU_REG_END 0x4017
+#define APU_STATUS 0x4015
+#define APU_FRAME_COUNTER 0x4017
+
+#define CPU_CLOCK_RATE 1789773
+#define APU_SAMPLE_RATE 48000 // default output rate, the band-limited buffer synthesizes any rate directly
+#define APU_CHANGE_LOG_SIZE 8192
+#define APU_AMPLITUDE 16384
+
+typedef unsigned char byte;
+typedef signed char sbyte;
+typedef unsigned short addr16;
+typedef struct _envelope Envelope;
+typedef struct _pulse Pulse;
+typedef struct _triangle Triangle;
+typedef struct _noise Noise;
+typedef struct _dmc DMC;
+typedef struct _apu_change APUChange;
+typedef struct _apu APU;
+
+struct _envelope {
+    byte loop; // also halts the length counter
+    byte constant;
+    byte volume;
+    byte start;
+    byte divider;
+    byte decay;
+};
+
+struct _pulse {
+    Envelope env;
+    byte duty;
+    byte step;
+    byte length;
+    int period;
+
+    byte sweep_enabled;
+    byte sweep_period;
+    byte sweep_negate;
+    byte sweep_shift;
+    byte sweep_reload;
+    byte sweep_divider;
+    byte ones_complement; // pulse 1 negates with an extra -1
+
+    unsigned long next_clock; // CPU cycle of the next sequencer step, NO_EVENT when silent
+};
+
+struct _triangle {
+    byte control;
+    byte linear_reload_value;
+    byte linear_reload;
+    byte linear;
+    byte length;
+    byte step;
+    int period;
+
+    unsigned long next_clock;
+};
+
+struct _noise {
+    Envelope env;
+    byte mode;
+    byte length;
+    int period;
+    addr16 lfsr;
+
+    unsigned long next_clock;
+};
+
+struct _dmc {
+    byte irq_enable;
+    byte loop;
+    byte output;
+    int period;
+
+    addr16 sample_addr;
+    int sample_len;
+    addr16 current_addr;
+    int bytes_remaining;
+
+    byte shift;
+    byte bits_remaining;
+    byte buffer;
+    byte buffer_empty;
+    byte silence;
+
+    unsigned long next_clock;
+};
+
+struct _apu_change {
+    unsigned long cycle;
+    int amplitude;
+};
+
+struct _apu {
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+
+    byte enabled; // $4015 channel enable bits
+    byte frame_mode;
+    byte frame_irq_inhibit;
+    byte frame_irq;
+    byte dmc_irq;
+    int frame_step;
+    unsigned long frame_start;
+
+    unsigned long time; // CPU cycle the channels are caught up to
+    int sample_rate; // 0 when nobody reads samples, the timers are then skipped
+    int amplitude; // last logged mixer output
+    int synth_amplitude; // mixer output already added to the step buffer
+
+    APUChange changes[APU_CHANGE_LOG_SIZE];
+    int change_count;
+    Blip blip;
+};
+
+extern _Thread_local APU mainAPU;
+
+void init_APU(unsigned long cpu_cycles);
+void apu_enable_output(int sample_rate);
+byte apu_read_register(addr16 addr);
+void apu_write_register(addr16 addr, byte data);
+void apu_catch_up(unsigned long cpu_cycles);
+int apu_read_samples(unsigned long cpu_cycles, short *out, int count);
@@ -0,0 +1,27 @@
+// Band-limited step buffer.
+// Amplitude changes are added as band-limited impulses at their exact (sub-sample) time
+// and integrated back into steps when samples are read, so the cost depends on the
+// number of changes and samples, not on the number of clocks between them.
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_WIDTH 16
+#define BLIP_KERNEL_BITS 15
+#define BLIP_BASS_SHIFT 9
+#define BLIP_BUFFER_SIZE 16384
+
+typedef struct _blip Blip;
+
+struct _blip {
+    unsigned long long factor; // output samples per clock, 32.32 fixed point
+    unsigned long long offset; // position of the frame start in the buffer, 32.32 fixed point
+    unsigned long frame_start; // clock at which the current frame started
+    long integrator;
+    int buf[BLIP_BUFFER_SIZE + BLIP_WIDTH];
+};
+
+void init_blip(Blip *blip, long clock_rate, long sample_rate, unsigned long start);
+void blip_add_delta(Blip *blip, unsigned long clock, int delta);
+void blip_end_frame(Blip *blip, unsigned long clock);
+int blip_samples_avail(Blip *blip);
+int blip_read_samples(Blip *blip, short *out, int count);
@@ -4,13 +4,24 @@
 #define RAM_STACK_BEGIN 0x0100
 #define RAM_STACK_END 0x01ff
 
+#define OAM_DMA 0x4014
+#define OAM_DMA_CYCLES 513
+
 typedef unsigned char byte;
 typedef signed char sbyte;
 typedef unsigned short addr16;
 
+// One bit per 256 byte page of RAM the CPU wrote since the bit was taken, for viewers
+extern _Thread_local byte bus_dirty[0x100 / 8];
+
 byte readCPU(addr16 addr);
 void writeCPU(addr16 addr, byte data);
+void oam_dma(byte page);
+int bus_take_dirty(byte page);
 void tick();
+void run_frame();
 char *get_cpu_state();
 void load_prg(char *filename);
+void load_ines(char *filename);
 void start_bus(char *filename);
+void start_bus_ines(char *filename);
@@ -0,0 +1,63 @@
+// Frame capture to a Y4M stream or numbered PPM files.
+// The emulation copies every finished frame into a recycled buffer and hands it to a
+// writer thread through a lock-free single producer / single consumer queue. Empty
+// buffers come back through a second queue, so no frame is ever allocated while running.
+// When all buffers are in flight the producer waits, or drops the frame if skipping is on.
+// Each queue has a semaphore that counts its frames, so neither side polls.
+
+#include<stdio.h>
+#include<pthread.h>
+#include<semaphore.h>
+#include<stdatomic.h>
+
+#define CAPTURE_BUFFERS 8 // power of two
+#define CAPTURE_WIDTH 256
+#define CAPTURE_HEIGHT 240
+
+#define CAPTURE_Y4M 0
+#define CAPTURE_PPM 1
+
+typedef unsigned char byte;
+typedef struct _capture_frame CaptureFrame;
+typedef struct _frame_queue FrameQueue;
+typedef struct _capture Capture;
+
+struct _capture_frame {
+    unsigned long number;
+    byte pixels[CAPTURE_HEIGHT * CAPTURE_WIDTH]; // NES color numbers
+};
+
+struct _frame_queue {
+    CaptureFrame *slots[CAPTURE_BUFFERS];
+    atomic_ulong head; // written by the producer only
+    atomic_ulong tail; // written by the consumer only
+};
+
+struct _capture {
+    int format;
+    int skip; // drop frames instead of waiting for the writer
+    char *path; // Y4M file or printf pattern of the PPM files, with one %lu for the frame number
+    FILE *file;
+
+    CaptureFrame *frames;
+    FrameQueue full; // emulation -> writer
+    FrameQueue empty; // writer -> emulation
+    sem_t filled; // frames in full, plus one when closing
+    sem_t freed; // frames in empty
+
+    byte yuv[3][64]; // Y, U, V of every NES color
+    byte rgb[64][3];
+    byte scratch[CAPTURE_HEIGHT * CAPTURE_WIDTH * 3]; // a Y4M plane or a PPM file, used by the writer thread
+
+    unsigned long captured;
+    unsigned long dropped;
+    unsigned long written;
+    unsigned long max_queued;
+
+    pthread_t thread;
+};
+
+Capture *capture_open(char *path, int format, int skip);
+void capture_frame(Capture *cap, unsigned long number, byte *pixels);
+void capture_close(Capture *cap);
+void capture_print_stats(Capture *cap);
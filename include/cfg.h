@@ -0,0 +1,115 @@
+// Control-flow graph of the code in emulated memory. Decoding starts at the reset, NMI and
+// IRQ vectors and follows branches, JMP absolute and JSR, so the bytes after a JMP, RTS or
+// RTI are only decoded when some path reaches them. A JSR target starts a routine and the
+// instruction after the JSR is where it returns to. JMP (indirect) ends its path and is
+// recorded, its targets are only known at run time.
+// The instructions are ExecNodes of an ExecMap and live in its arena with the blocks.
+// While refining, tick() reports every instruction it runs: code the static pass missed
+// is decoded and linked in, and indirect jumps record their targets.
+
+#define CFG_MAX_ROUTINES 2048
+#define CFG_MAX_CALLS 8192
+#define CFG_MAX_INDIRECT 256
+#define CFG_MAX_TARGETS 1024 // of indirect jumps
+#define CFG_MAX_SCAN 0x400 // bytes searched back for the block containing an address
+
+// How a block ends
+#define CFG_FALL 0 // the next block starts after it
+#define CFG_BRANCH 1
+#define CFG_JUMP 2
+#define CFG_CALL 3
+#define CFG_RETURN 4 // RTS or RTI
+#define CFG_INDIRECT 5
+#define CFG_STOP 6 // BRK or an unknown opcode
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _exec_node ExecNode;
+typedef struct _exec_map ExecMap;
+typedef struct _cfg_block CfgBlock;
+typedef struct _cfg_routine CfgRoutine;
+typedef struct _cfg_call CfgCall;
+typedef struct _cfg_target CfgTarget;
+typedef struct _cfg Cfg;
+
+struct _cfg_block {
+    addr16 start;
+    addr16 end; // address after the last instruction
+    addr16 last; // address of the last instruction
+    int instructions;
+    int exit; // CFG_*
+    CfgBlock *taken; // branch, jump or call target
+    CfgBlock *next; // fall through, branch not taken or return from the call
+    int routine; // first routine the block was reached from, -1 if none
+    int mark; // last routine walk that visited the block
+
+    // Filled by cfg_find_loops
+    int order; // reverse postorder from the entries, -1 if unreachable
+    CfgBlock *idom; // immediate dominator, NULL for entries and unreachable blocks
+    int depth; // loops the block is in, the static estimate of how hot it is
+    int header; // the block heads a loop
+};
+
+struct _cfg_routine {
+    addr16 entry;
+    int blocks;
+    int calls; // call sites in the routine
+};
+
+struct _cfg_call {
+    addr16 site; // address of the JSR
+    int caller;
+    int callee;
+};
+
+struct _cfg_target {
+    addr16 site; // address of the JMP (indirect)
+    addr16 target;
+};
+
+struct _cfg {
+    ExecMap *map; // the decoded instructions
+    CfgBlock *block_at[0x10000]; // block starting at an address
+    int block_count;
+    byte leader[0x10000];
+
+    addr16 vectors[3]; // NMI, reset and IRQ entries
+    CfgRoutine routines[CFG_MAX_ROUTINES];
+    int routine_count;
+    CfgCall calls[CFG_MAX_CALLS];
+    int call_count;
+    addr16 indirect[CFG_MAX_INDIRECT]; // addresses of the JMP (indirect)
+    int indirect_count;
+
+    CfgTarget targets[CFG_MAX_TARGETS];
+    int target_count;
+
+    addr16 queue[0x10000]; // every leader in the order it was found
+    int queued;
+
+    // Refinement at run time
+    addr16 last_pc;
+    byte last_opcode;
+    int refined_instructions;
+    int found_blocks;
+    int split_blocks;
+
+    int loop_count;
+    int max_depth;
+};
+
+extern _Thread_local Cfg *cfg_runtime;
+
+Cfg *create_cfg();
+Cfg *build_cfg();
+void free_cfg(Cfg *cfg);
+CfgBlock *cfg_block_at(Cfg *cfg, addr16 addr);
+int cfg_routine_at(Cfg *cfg, addr16 entry);
+void cfg_refine_start(Cfg *cfg);
+void cfg_refine_stop();
+void cfg_execute(addr16 pc);
+void print_cfg(Cfg *cfg, int verbose);
+
+void cfg_find_loops(Cfg *cfg);
+int cfg_dominates(CfgBlock *a, CfgBlock *b);
+int cfg_hot_blocks(Cfg *cfg, CfgBlock **blocks, int max);
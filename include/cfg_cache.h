@@ -0,0 +1,72 @@
+// On-disk cache of control-flow graphs, so a ROM is only analysed once. The file of a ROM
+// is named after the hash of its PRG data ($8000 - $ffff as mapped), so a changed ROM
+// never loads the graph of the old one. A cache is written to a temporary file and renamed,
+// many instances can share a directory.
+// Only the code at the PRG addresses is cached. Code below them runs from RAM, the hash does
+// not cover it, so it is decoded again when refinement sees it run. Edges into it are cut.
+// File layout, native byte order (the version word rejects caches from other machines),
+// every section starts on 8 bytes:
+//     header      CfgCacheHeader
+//     instructions  address, opcode, length and operands of every decoded instruction
+//     blocks      start, end, last instruction, exit, routine and the taken / next starts
+//     routines, calls, indirect jump targets, indirect jump sites
+// Loading maps the file read only and rebuilds the graph from the records, nothing is decoded.
+
+#define CFG_CACHE_MAGIC "NESC"
+#define CFG_CACHE_VERSION 0x01020002 // byte order check and version 2
+#define CFG_CACHE_PRG_START 0x8000
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef unsigned long long hash64;
+typedef struct _cfg Cfg;
+typedef struct _cfg_cache_header CfgCacheHeader;
+typedef struct _cfg_cache_instruction CfgCacheInstruction;
+typedef struct _cfg_cache_block CfgCacheBlock;
+typedef struct _cfg_cache_routine CfgCacheRoutine;
+typedef struct _cfg_cache_call CfgCacheCall;
+
+struct _cfg_cache_header {
+    char magic[4];
+    unsigned int version;
+    hash64 prg_hash;
+    unsigned int instructions, blocks, routines, calls, targets, indirect;
+    addr16 vectors[3];
+    addr16 reserved;
+};
+
+struct _cfg_cache_instruction {
+    addr16 index;
+    byte opcode;
+    byte len;
+    byte args[2];
+};
+
+struct _cfg_cache_block {
+    addr16 start, end, last;
+    byte exit;
+    byte reserved;
+    int instructions;
+    int routine;
+    int taken, next; // start of the linked block, -1 for none
+};
+
+struct _cfg_cache_routine {
+    addr16 entry;
+    addr16 reserved;
+    int blocks;
+    int calls;
+};
+
+struct _cfg_cache_call {
+    addr16 site;
+    addr16 reserved;
+    int caller;
+    int callee;
+};
+
+hash64 prg_hash();
+void cfg_cache_path(char *buff, int size, char *dir);
+int save_cfg_cache(Cfg *cfg, char *filename);
+Cfg *load_cfg_cache(char *filename);
+Cfg *cached_cfg(char *dir, int *hit);
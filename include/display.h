@@ -2,7 +2,9 @@
 
 #define MAX_MEM_COLS 15
 #define MAX_PAGES 257 
-#define PAGE_SIZE 255
+#define PAGE_SIZE 255 
+#define RAM_REFRESH_HZ 15 // while running
+#define RAM_HIGHLIGHT_REFRESHES 8 // a written cell stays highlighted this long
 
 #define NEXT_PAGE 0
 #define PREV_PAGE 1
@@ -11,6 +13,11 @@
 #define TREE_NON_COND 0
 #define TREE_COND 1
 
+#define UI_RATE_HZ 30 // passes of the UI thread a second
+#define UI_MAX_KEYS 64 // waiting for the emulator
+#define UI_LOG_LINES 256 // messages waiting for the UI thread
+#define UI_LOG_LEN 128
+
 typedef unsigned char byte;
 typedef signed char sbyte;
 typedef unsigned short addr16;
@@ -21,15 +28,19 @@ WINDOW *CPU_WIN;
 WINDOW *STAT_WIN;
 WINDOW *TREE_WIN;
 
+extern int trace_opcodes; // print every executed opcode to the stdout window
+
 void displ_print(char *msg);
 void displ_print_opcode(char *msg, byte fmt);
+void displ_flush();
 WINDOW *create_win_stdout(int max_rows, int max_cols);
 
-void show_RAM_util(int index, byte val, int **rowptr, int **colptr);
 void show_RAM(byte move_opt);
+void refresh_RAM();
 WINDOW *create_win_RAM(int max_rows, int max_cols);
 
 void show_key_press(char key);
+void show_run_stat(char *stat);
 WINDOW *create_win_stat(int max_rows, int max_cols);
 
 void show_CPU_stat(char *cpu_state);
@@ -37,4 +48,12 @@ WINDOW *create_win_CPU(int max_rows, int max_cols);
 
 void display_tree();
 void tree_next(int pos_next);
-WINDOW *create_win_tree(int max_rows, int max_cols, char *filename);
+void tree_follow_pc();
+WINDOW *create_win_tree(int max_rows, int max_cols);
+
+void ui_publish();
+void ui_run_stat(char *stat);
+int ui_key(int wait);
+unsigned long ui_draws();
+void ui_start();
+void ui_stop();
@@ -0,0 +1,47 @@
+// Batched environment API for running many machines at once, e.g. from a training loop.
+// The machine state is thread local, instance i always runs on worker i % threads. A worker
+// keeps the machine of its last instance resident and only swaps snapshots when it owns more
+// than one, so with as many threads as instances a step copies no state at all. The PPU
+// renders straight into the observation buffer owned by the caller.
+// Every thread that touches the emulator pays for its own machine (about 370 KB of thread
+// local storage: RAM 64 KB, PPU 103 KB, APU 192 KB).
+
+#include<pthread.h>
+
+#define ENV_OBS_SIZE (256 * 240) // NES color numbers, one byte per pixel
+#define ENV_MAX_THREADS 64
+
+typedef unsigned char byte;
+typedef struct _snapshot Snapshot;
+typedef struct _env_batch EnvBatch;
+
+struct _env_batch {
+    int instances;
+    int threads;
+    Snapshot **states; // one per instance, stale while the instance is resident on its worker
+    Snapshot *reset_state;
+
+    // Current job, set by env_step
+    byte *actions;
+    byte *observations;
+    int frames;
+    int sync; // the job only saves the resident machines into their snapshots
+
+    unsigned long generation; // incremented for every job
+    int next_worker; // index the next started worker takes
+    int done_workers;
+    int stop;
+
+    int resident[ENV_MAX_THREADS]; // instance loaded on each worker, -1 for none
+
+    pthread_t workers[ENV_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+};
+
+EnvBatch *env_create(char *rom, int instances, int threads);
+void env_destroy(EnvBatch *batch);
+void env_step(EnvBatch *batch, byte *actions, int frames, byte *observations);
+void env_reset(EnvBatch *batch, int instance);
+void env_save_reset_state(EnvBatch *batch, int instance);
@@ -1,47 +1,85 @@
 #include<stdio.h>
 
-#define foreach_list(head, temp) for(temp=head->next; temp!=NULL; temp=temp->next)
+#define EXEC_MAP_SIZE 0x10000 // one slot per address
+#define EXEC_PRG_START 0x0600 // where build_exec_map loads a flat program
+#define EXEC_ARENA_CHUNK 0x10000 // bytes
 
 typedef struct _exec_node ExecNode;
-typedef struct _exec_node_list ExecNodeList;
+typedef struct _exec_map ExecMap;
+typedef struct _exec_arena ExecArena;
+typedef struct _exec_arena_chunk ExecArenaChunk;
 
 typedef unsigned char byte;
 typedef unsigned short addr16;
 
 
+// The names are derived from the opcode, see exec_node_name. A placeholder for the target
+// of a jump or return the tree cannot follow has cmd_len 0 and the opcode that left.
 struct _exec_node { 
     addr16 index;
     byte opcode;
-    char *name;
-    byte *args;
+    byte args[2];
     int cmd_len;
-    char *addressing_mode_name;
     byte (*addressing_mode)(byte*, addr16*);
     ExecNode *yes;
     ExecNode *no;
 };
 
 
-struct _exec_node_list {
-    ExecNode *val;
-    ExecNodeList *next;
+struct _exec_arena_chunk {
+    ExecArenaChunk *next;
+    size_t used;
+    size_t size;
+    unsigned char data[];
 };
 
 
-byte *get_opcode_args(FILE *fp, int opc_len);
+// Everything an analysis allocates comes from its arena and is released in one call
+struct _exec_arena {
+    ExecArenaChunk *chunk; // current chunk, the older ones follow
+    int chunks;
+    unsigned long allocations;
+    unsigned long used; // bytes
+    unsigned long reserved;
+};
+
+
+// The instruction starting at each address, walking at[] gives them in address order
+struct _exec_map {
+    ExecArena arena;
+    ExecNode *at[EXEC_MAP_SIZE];
+    int count;
+};
+
+
+void get_opcode_args(FILE *fp, byte args[2], int args_len);
 
 ExecNode *build_tree(char *filename);
-ExecNode *get_jmp_node(ExecNode *jmp_cmd);
-ExecNode *build_tree_util(ExecNodeList *list_root, ExecNodeList *curr_cmd, ExecNode *tree_root);
-ExecNode *get_exec_node(FILE *fp, byte opcode);
-ExecNode *find_by_index(ExecNodeList *list_root, addr16 index);
+ExecMap *build_exec_map(char *filename);
+ExecNode *link_tree(ExecMap *map);
+ExecNode *allocate_exec_node(ExecMap *map);
+ExecNode *get_jmp_node(ExecMap *map, ExecNode *jmp_cmd);
+ExecNode *build_tree_util(ExecMap *map, ExecNode *curr_cmd, ExecNode *tree_root);
+ExecNode *get_exec_node(ExecMap *map, FILE *fp, byte opcode, addr16 index);
+ExecNode *decode_exec_node(ExecMap *map, addr16 addr);
+ExecNode *lazy_exec_node(ExecMap *map, addr16 addr);
+void lazy_link_node(ExecMap *map, ExecNode *node);
+
+void *arena_alloc(ExecArena *arena, size_t size);
+void arena_free(ExecArena *arena);
 
-ExecNodeList *create_list(ExecNode *val);
-ExecNodeList *list_push(ExecNodeList *root, ExecNode *val);
+ExecMap *create_exec_map();
+void free_exec_map(ExecMap *map);
+void print_exec_map_memory(ExecMap *map);
+void exec_map_push(ExecMap *map, ExecNode *val);
+ExecNode *exec_map_find(ExecMap *map, addr16 index);
+ExecNode *exec_map_next(ExecMap *map, ExecNode *node);
 
-void print_exec_list(ExecNodeList *root);
+void print_exec_map(ExecMap *map);
 void print_tree(ExecNode *tree_root);
 void print_node(ExecNode *node);
 
 char *get_node_data(ExecNode *node);
+char *exec_node_name(ExecNode *node);
+char *exec_node_mode_name(ExecNode *node);
 char *get_addressing_name(byte (*addressing)(byte*, addr16*));
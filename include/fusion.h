@@ -0,0 +1,40 @@
+// Superinstructions. Common instruction sequences such as DEX; BNE or LDA; STA are
+// recognised by tick() from their opcodes and run by one fused handler, which calls the
+// opcode handlers directly instead of dispatching every instruction on its own.
+// A sequence stops early when an event or an NMI is due after one of its instructions,
+// so the machine is in the same state as after running the instructions one by one.
+// The miner counts the opcode pairs and triples of a run to rank candidate fusions.
+
+#define FUSION_MAX_LEN 3
+#define FUSION_MINE_TRIPLES 65536 // slots of the triple hash table, a power of two
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _fusion Fusion;
+typedef struct _fusion_miner FusionMiner;
+
+struct _fusion {
+    char *name;
+    int count;
+    void (*funcs[FUSION_MAX_LEN])(byte opcode, byte args[2]);
+};
+
+struct _fusion_miner {
+    unsigned long total;
+    byte last[2]; // the two previous opcodes
+    unsigned long pairs[256][256];
+    unsigned int triple_keys[FUSION_MINE_TRIPLES]; // 0x01000000 | the three opcodes, 0 when free
+    unsigned long triple_counts[FUSION_MINE_TRIPLES];
+};
+
+extern _Thread_local int fusion_enabled;
+extern _Thread_local FusionMiner *fusion_miner;
+
+void init_fusion();
+void fusion_enable(int enabled);
+int run_fusion(addr16 *last);
+void fusion_mine(byte opcode);
+FusionMiner *fusion_mine_start();
+void fusion_mine_stop();
+void print_fusion_stats();
+void print_fusion_ranking(FusionMiner *miner, int top);
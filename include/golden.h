@@ -0,0 +1,34 @@
+// Golden files list the hashes a ROM is expected to produce, one check per line:
+//     <frame> <frame hash> <state hash>
+// Frames are counted from 1, hashes are 16 hex digits or "-" to skip that hash.
+// Empty lines and lines starting with # are ignored, checks must be in frame order.
+
+#include<stdio.h>
+
+#include"hash.h"
+
+#define GOLDEN_MAX_CHECKS 4096
+#define GOLDEN_RECORD_INTERVAL 60
+
+typedef struct _golden_check GoldenCheck;
+typedef struct _golden Golden;
+
+struct _golden_check {
+    unsigned long frame;
+    hash64 frame_hash;
+    hash64 state_hash;
+    byte has_frame;
+    byte has_state;
+};
+
+struct _golden {
+    GoldenCheck checks[GOLDEN_MAX_CHECKS];
+    int count;
+    int next; // first check that did not run yet
+    int failures;
+};
+
+void load_golden(char *filename, Golden *golden);
+unsigned long golden_last_frame(Golden *golden);
+int golden_check(Golden *golden, unsigned long frame);
+void golden_record(FILE *file, unsigned long frame);
@@ -0,0 +1,10 @@
+// 64 bit xxHash (XXH64) of the framebuffer and of the CPU and RAM state.
+// The input is consumed as four independent 64 bit lanes, 32 bytes per round,
+// which keeps the multipliers of the lanes in flight together.
+
+typedef unsigned char byte;
+typedef unsigned long long hash64;
+
+hash64 xxhash64(const void *data, unsigned long len, hash64 seed);
+hash64 hash_frame();
+hash64 hash_state();
@@ -0,0 +1,36 @@
+// Idle loop skipping. Programs wait for vblank or an interrupt in short loops like
+// `loop: BIT $2002; BPL loop` or `JMP *`. When the body of such a loop only reads RAM, ROM
+// or PPUSTATUS, never writes, and a pass ends with the registers as it started, every
+// later pass is the same until a scheduled event changes something. The passes up to the
+// next event are then skipped by adding their cycles at once.
+// Skipping is exact, it can be turned off to compare against plain interpretation.
+// Loading a state forgets the loop, its last pass belongs to another machine.
+
+#define IDLE_MAX_BODY 16 // bytes from the loop head to the end of the jump back
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _idle Idle;
+
+struct _idle {
+    int enabled;
+
+    // Loop being watched and the state at its last jump back
+    addr16 head;
+    addr16 jump;
+    int safe; // -1 until the loop is checked
+    byte A, X, Y, SP, status;
+    unsigned long cycle;
+    unsigned long next_event;
+
+    unsigned long skipped_cycles;
+    unsigned long skips;
+};
+
+extern _Thread_local Idle mainIdle;
+
+void init_idle();
+void idle_enable(int enabled);
+void idle_forget();
+void idle_jump_back(addr16 from);
+void print_idle_stats();
@@ -0,0 +1,46 @@
+// Standard controllers on $4016 / $4017.
+// Frontends queue button changes at any time, they are applied at the next frame
+// boundary so the game sees the same input on the same frame every run.
+
+#define INPUT_PORT_1 0x4016
+#define INPUT_PORT_2 0x4017
+#define INPUT_PORTS 2
+#define INPUT_QUEUE_SIZE 64 // power of two
+
+// Bit order of the shift register, A is read first
+#define BUTTON_A 0
+#define BUTTON_B 1
+#define BUTTON_SELECT 2
+#define BUTTON_START 3
+#define BUTTON_UP 4
+#define BUTTON_DOWN 5
+#define BUTTON_LEFT 6
+#define BUTTON_RIGHT 7
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _input_event InputEvent;
+typedef struct _input Input;
+
+struct _input_event {
+    byte port;
+    byte buttons;
+};
+
+struct _input {
+    byte buttons[INPUT_PORTS]; // state the game sees this frame
+    byte shift[INPUT_PORTS];
+    byte strobe;
+
+    InputEvent queue[INPUT_QUEUE_SIZE];
+    unsigned int head;
+    unsigned int tail;
+};
+
+extern _Thread_local Input mainInput;
+
+void init_input();
+void input_push(int port, byte buttons);
+void input_begin_frame();
+byte input_read(addr16 addr);
+void input_write(byte data);
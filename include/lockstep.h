@@ -0,0 +1,43 @@
+// Lockstep core for running many CPUs on the same program with different data, e.g. a search
+// over inputs. The registers are kept as a structure of arrays and the lanes that are at the
+// same PC run the instruction together, 8 lanes per AVX2 register. Lanes that diverged, and
+// instructions without a vector handler, run one lane at a time on the interpreter.
+// Only the CPU is emulated, every lane has its own flat 64 kB memory.
+
+#define LOCKSTEP_MAX_LANES 16
+#define LOCKSTEP_MEM_SIZE 0x10000
+
+typedef unsigned char byte;
+typedef unsigned short addr16;
+typedef struct _lockstep Lockstep;
+
+struct _lockstep {
+    int lanes;
+    int kernel; // KERNEL_SCALAR or KERNEL_AVX2
+
+    // One int per lane so that 8 lanes fill an AVX2 register
+    int A[LOCKSTEP_MAX_LANES];
+    int X[LOCKSTEP_MAX_LANES];
+    int Y[LOCKSTEP_MAX_LANES];
+    int SP[LOCKSTEP_MAX_LANES];
+    int PC[LOCKSTEP_MAX_LANES];
+    int status[LOCKSTEP_MAX_LANES];
+    int retired[LOCKSTEP_MAX_LANES]; // instructions run
+    unsigned long cycles[LOCKSTEP_MAX_LANES];
+
+    byte *memory; // lane i at i * LOCKSTEP_MEM_SIZE
+
+    unsigned long vector_steps; // instructions run for a group of lanes at once
+    unsigned long vector_lanes; // lane instructions done by them
+    unsigned long scalar_steps; // lane instructions done by the interpreter
+};
+
+Lockstep *lockstep_create(int lanes, int kernel);
+void lockstep_free(Lockstep *ls);
+byte *lockstep_memory(Lockstep *ls, int lane);
+void lockstep_load(Lockstep *ls, addr16 addr, byte *data, int len);
+void lockstep_reset(Lockstep *ls, addr16 pc);
+void lockstep_run_lane(Lockstep *ls, int lane, int instructions);
+void lockstep_run(Lockstep *ls, int instructions);
+int lockstep_vectorized(byte opcode);
+void print_lockstep_stats(Lockstep *ls);
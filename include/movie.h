@@ -0,0 +1,36 @@
+// Input movies store the controller state of every frame so a run can be replayed exactly.
+// File layout, all numbers little endian:
+//     0  "NESM"
+//     4  version (1), number of ports, 2 reserved bytes
+//     8  number of frames (4 bytes), 4 reserved bytes
+//     16 one byte per port for every frame
+// A movie is recorded through a buffered file and replayed straight from a read only
+// mapping of the file, so even long movies cost one memcpy per frame.
+
+#include<stdio.h>
+
+#define MOVIE_HEADER_SIZE 16
+#define MOVIE_VERSION 1
+
+#define MOVIE_RECORD 0
+#define MOVIE_PLAY 1
+
+typedef unsigned char byte;
+typedef struct _movie Movie;
+
+struct _movie {
+    int mode;
+    int ports;
+    unsigned long frame; // next frame to record or play
+    unsigned long frames;
+
+    FILE *file; // recording
+    byte *data; // mapped file when playing
+    unsigned long size;
+};
+
+Movie *movie_record(char *filename);
+Movie *movie_play(char *filename);
+void movie_record_frame(Movie *movie);
+int movie_play_frame(Movie *movie);
+void movie_close(Movie *movie);
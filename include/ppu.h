@@ -0,0 +1,113 @@
+// The PPU renders whole scanlines instead of single dots.
+// CHR tiles are decoded into palette indices once and cached, every CHR write
+// through the bus invalidates the tile it touches.
+// The output is an indexed 256x240 framebuffer of NES color numbers (0x00 - 0x3f).
+// Vertical blank, sprite 0 hit and sprite overflow are scheduled events, the hit and
+// overflow cycles are predicted from OAM and scroll so $2002 polling never steps dots.
+
+#define PPU_REG_BEGIN 0x2000
+#define PPU_REG_END 0x3fff
+
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 240
+
+#define DOTS_PER_LINE 341
+#define LINES_PER_FRAME 262
+#define VBLANK_LINE 241
+#define PRERENDER_LINE 261
+
+#define CHR_SIZE 0x2000
+#define CHR_TILES 512
+#define VRAM_SIZE 0x0800
+
+#define MIRROR_HORIZONTAL 0
+#define MIRROR_VERTICAL 1
+
+// PPUCTRL bits
+#define CTRL_INCREMENT 2
+#define CTRL_SPRITE_TABLE 3
+#define CTRL_BG_TABLE 4
+#define CTRL_SPRITE_SIZE 5
+#define CTRL_NMI 7
+
+// PPUMASK bits
+#define MASK_BG_LEFT 1
+#define MASK_SPRITE_LEFT 2
+#define MASK_BG 3
+#define MASK_SPRITE 4
+
+// PPUSTATUS bits
+#define STATUS_OVERFLOW 5
+#define STATUS_SPRITE0 6
+#define STATUS_VBLANK 7
+
+// Compositing kernels, picked at runtime with CPUID by every thread on its own
+#define KERNEL_SCALAR 0
+#define KERNEL_SSE2 1
+#define KERNEL_AVX2 2
+#define KERNEL_BEST 3
+
+#define get_ppu_bit(val, pos) (!!((val) & (1 << (pos))))
+
+typedef unsigned char byte;
+typedef signed char sbyte;
+typedef unsigned short addr16;
+typedef struct _ppu PPU;
+
+struct _ppu {
+    byte ctrl;
+    byte mask;
+    byte status;
+    byte oam_addr;
+    byte data_buffer;
+
+    addr16 v; // current VRAM address
+    addr16 t; // temporary VRAM address
+    byte x; // fine X scroll
+    byte w; // first/second write toggle
+
+    byte mirroring;
+    byte chr_is_ram;
+
+    byte chr[CHR_SIZE];
+    byte vram[VRAM_SIZE];
+    byte palette[32];
+    byte oam[256];
+
+    byte tile_cache[CHR_TILES][8][8]; // decoded 2bpp tiles
+    byte tile_valid[CHR_TILES];
+
+    byte frame[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    int scanline;
+    unsigned long line_dot; // dot at which the current scanline started
+    unsigned long frame_dot; // dot at which line 0 of the current frame started
+    unsigned long frame_count;
+    byte nmi_pending;
+    byte predict_dirty; // registers changed since the last sprite 0/overflow prediction
+};
+
+extern _Thread_local PPU mainPPU;
+extern _Thread_local byte *ppu_target; // when set the lines are rendered there instead of into mainPPU.frame
+
+void init_PPU(byte mirroring);
+void ppu_load_chr(byte *data, int len);
+
+byte ppu_read_register(addr16 addr);
+void ppu_write_register(addr16 addr, byte data);
+byte ppu_read(addr16 addr);
+void ppu_write(addr16 addr, byte data);
+void ppu_oam_dma(byte *page);
+
+byte *ppu_get_tile_row(int tile, int row);
+void ppu_render_scanline(int line);
+void ppu_render_frame();
+void ppu_catch_up(unsigned long cpu_cycles);
+void ppu_predict(unsigned long cpu_cycles);
+void ppu_sync_status(unsigned long cpu_cycles);
+
+int ppu_select_kernels(int level);
+char *ppu_kernel_name(int level);
+int ppu_compose_line(byte *bg, byte *spr, byte *behind, byte *zero, byte *out);
+void ppu_frame_to_rgba(unsigned int *rgba);
+unsigned int ppu_color_rgba(byte color);
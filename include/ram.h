@@ -1,29 +1,16 @@
-// Ram will be emulated using a double linked sorted list with an iterator.
-// The iterator is pointing at the last accessed memory register. 
-// The value of a register not present in the list will be treated as zero.
+// Ram is emulated as a flat 64 kB array so every page can be handed out as a pointer.
+// The value of a register that was never written is zero.
 
 #define MAX_ADDR 0xffff
-#define foreach(t, r) for(t=r; t != NULL; t=t->after)
-
-typedef struct _register Register;
-typedef struct _register *Iterator;
+#define RAM_PAGE_SIZE 0x0100
 
 typedef unsigned char byte;
 typedef signed char sbyte;
 typedef unsigned short addr16;
 
-Register *RAM_iter;
-
-struct _register {
-    addr16 address; 
-    byte val;
-    Register *after;
-    Register *before;
-};
-
+extern _Thread_local byte RAM[MAX_ADDR + 1];
 
-Register *create_register(addr16 address, byte val);
-Iterator create_iterator();
-Iterator mem_write(Iterator iter, addr16 address, byte val);
-Iterator mem_read(Iterator iter, addr16 address, byte *valptr);
-void print_memory(Register *first);
+void mem_write(addr16 address, byte val);
+byte mem_read(addr16 address);
+byte *mem_page(byte page);
+void print_memory();
@@ -0,0 +1,31 @@
+// Devices schedule events at an absolute CPU cycle instead of being stepped every cycle.
+// Every event type owns one slot, scheduling a pending event again moves it.
+
+#define EVENT_VBLANK 0
+#define EVENT_PRERENDER 1
+#define EVENT_SPRITE0 2
+#define EVENT_OVERFLOW 3
+#define EVENT_APU_FRAME 4
+#define MAX_EVENTS 8
+
+#define NO_EVENT (~0UL)
+
+typedef struct _event Event;
+typedef struct _scheduler Scheduler;
+
+struct _event {
+    unsigned long cycle;
+    void (*handler)(unsigned long cycle);
+};
+
+struct _scheduler {
+    Event events[MAX_EVENTS];
+    unsigned long next; // cycle of the earliest pending event
+};
+
+extern _Thread_local Scheduler mainScheduler;
+
+void clear_events();
+void schedule_event(int type, unsigned long cycle, void (*handler)(unsigned long));
+void cancel_event(int type);
+void run_events(unsigned long cycle);
@@ -0,0 +1,29 @@
+// In-memory savestates of the whole machine and run-ahead.
+// A snapshot is allocated once with create_snapshot, saving and loading only copy memory
+// into and out of it so nothing is allocated while running. The audio log and the
+// band-limited buffer of the APU are output, not state, and are not part of a snapshot.
+// Run-ahead emulates a few frames past the current one with audio muted, keeps the last
+// of those frames for display and loads the snapshot again, so the game reacts to input
+// as if it had less lag.
+
+#define RUN_AHEAD_MAX 8
+
+typedef unsigned char byte;
+typedef struct _snapshot Snapshot;
+typedef struct _run_ahead_stats RunAheadStats;
+
+struct _run_ahead_stats {
+    unsigned long frames;
+    double save_sec;
+    double load_sec;
+    double ahead_sec; // emulating the frames that are thrown away
+    double frame_sec; // emulating the real frames
+};
+
+Snapshot *create_snapshot();
+void free_snapshot(Snapshot *snap);
+unsigned long snapshot_size();
+void save_state(Snapshot *snap);
+void load_state(Snapshot *snap);
+void run_frame_ahead(Snapshot *snap, int ahead, byte *display, RunAheadStats *stats);
+void print_run_ahead_stats(RunAheadStats *stats);
@@ -0,0 +1,30 @@
+// Streaming WAV writer, 16 bit mono.
+// Samples are copied into a ring buffer and written to the file by a separate thread,
+// wav_write only blocks when the writer thread falls a whole ring behind.
+
+#include<stdio.h>
+#include<pthread.h>
+
+#define WAV_RING_SIZE (1 << 16)
+
+typedef struct _wav_writer WavWriter;
+
+struct _wav_writer {
+    FILE *file;
+    int sample_rate;
+    long samples_written;
+
+    short ring[WAV_RING_SIZE];
+    long head; // total samples pushed
+    long tail; // total samples written to the file
+    int done;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+WavWriter *wav_open(char *filename, int sample_rate);
+void wav_write(WavWriter *wav, short *samples, int count);
+void wav_close(WavWriter *wav);
@@ -1,7 +1,7 @@
 #include"../include/6502c.h"
 
 
-CPU mainCPU = {
+_Thread_local CPU mainCPU = {
     .A=0x00,
     .X=0x00,
     .Y=0x00,
@@ -11,6 +11,8 @@ CPU mainCPU = {
 
     .status=0b00000000,
 
+    .cycles=0,
+
     .pullstack=stack_pull,
     .pushstack=stack_push,
 
@@ -29,6 +31,9 @@ void initCPU(byte (*readbus)(addr16), void (*writebus)(addr16, byte)) {
 
    mainCPU.status=0b00000000;
 
+   mainCPU.cycles=0;
+   mainCPU.opcode=0xea; // NOP
+
    mainCPU.pullstack=stack_pull;
    mainCPU.pushstack=stack_push;
 
@@ -7,50 +7,93 @@ byte immediate(byte args[2], addr16 *val_addr) {
 }
 
 
+// The *_addr functions only resolve the effective address.
+// Stores use them so that writing to a device register does not trigger its read side effects.
+
+addr16 zero_page_addr(byte args[2]) {
+    return args[0];
+}
+
+
+addr16 zero_page_x_addr(byte args[2]) {
+    return (byte)(mainCPU.X + args[0]);
+}
+
+
+addr16 zero_page_y_addr(byte args[2]) {
+    return (byte)(mainCPU.Y + args[0]);
+}
+
+
+addr16 absolute_addr(byte args[2]) {
+    return le_to_be(args[0], args[1]);
+}
+
+
+addr16 abs_x_addr(byte args[2]) {
+    return le_to_be(args[0], args[1]) + mainCPU.X;
+}
+
+
+addr16 abs_y_addr(byte args[2]) {
+    return le_to_be(args[0], args[1]) + mainCPU.Y;
+}
+
+
+addr16 indirect_x_addr(byte args[2]) {
+    byte addr_lsb = args[0] + mainCPU.X;
+    byte addr_msb = addr_lsb + 1;
+
+    return le_to_be(addr_lsb, addr_msb);
+}
+
+
+addr16 indirect_y_addr(byte args[2]) {
+    byte carry = 0;
+
+    byte addr1 = mainCPU.readbus(args[0]);
+    byte addr_lsb = addc(addr1, mainCPU.Y, &carry);
+    
+    byte addr2 = mainCPU.readbus(args[0] + 1);
+    byte addr_msb = addr2 + carry;
+
+    return le_to_be(addr_lsb, addr_msb);
+}
+
+
 byte zero_page(byte args[2], addr16 *val_addr) {
-    byte mem_val = mainCPU.readbus(args[0]);
-    *val_addr = args[0];
-    return mem_val;
+    *val_addr = zero_page_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte zero_page_x(byte args[2], addr16 *val_addr) {
-        byte mem_addr = mainCPU.X + args[0];
-        byte mem_val = mainCPU.readbus(mem_addr);
-        *val_addr = mem_addr;
-        return mem_val;
+    *val_addr = zero_page_x_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte zero_page_y(byte args[2], addr16 *val_addr) {
-        byte mem_addr = mainCPU.Y + args[0];
-        byte mem_val = mainCPU.readbus(mem_addr);
-        *val_addr = mem_addr;
-        return mem_val;
+    *val_addr = zero_page_y_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte absolute(byte args[2], addr16 *val_addr) {
-    addr16 mem_addr = le_to_be(args[0], args[1]);
-    byte mem_val = mainCPU.readbus(mem_addr);
-    *val_addr = mem_addr;
-    return mem_val;
+    *val_addr = absolute_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte abs_x(byte args[2], addr16 *val_addr) {
-    addr16 mem_addr =  le_to_be(args[0], args[1]) + mainCPU.X;
-    byte mem_val = mainCPU.readbus(mem_addr);
-    *val_addr = mem_addr;
-    return mem_val;
+    *val_addr = abs_x_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte abs_y(byte args[2], addr16 *val_addr) {
-    addr16 mem_addr = le_to_be(args[0], args[1]) + mainCPU.Y;
-    byte mem_val = mainCPU.readbus(mem_addr);
-    *val_addr = mem_addr;
-    return mem_val;
+    *val_addr = abs_y_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
@@ -67,33 +110,14 @@ byte indirect(byte args[2], addr16 *val_addr) {
 
 
 byte indirect_x(byte args[2], addr16 *val_addr) {
-    byte addr_lsb = args[0] + mainCPU.X;
-    byte addr_msb = addr_lsb + 1;
-
-    addr16 mem_addr = le_to_be(addr_lsb, addr_msb);
-    byte mem_val = mainCPU.readbus(mem_addr); 
-
-    *val_addr = mem_addr;
-
-    return mem_val;
+    *val_addr = indirect_x_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
 byte indirect_y(byte args[2], addr16 *val_addr) {
-    byte carry = 0;
-
-    byte addr1 = mainCPU.readbus(args[0]);
-    byte addr_lsb = addc(addr1, mainCPU.Y, &carry);
-    
-    byte addr2 = mainCPU.readbus(args[0] + 1);
-    byte addr_msb = addr2 + carry;
-
-    addr16 mem_addr = le_to_be(addr_lsb, addr_msb);
-    byte mem_val = mainCPU.readbus(mem_addr);
-
-    *val_addr = mem_addr;
-
-    return mem_val;
+    *val_addr = indirect_y_addr(args);
+    return mainCPU.readbus(*val_addr);
 }
 
 
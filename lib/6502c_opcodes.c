@@ -905,25 +905,25 @@ void STA(byte opcode, byte args[2]) { // Store accumulator
 
     switch(opcode) {
         case 0x85: // Zero Page
-            zero_page(args, &val_addr);
+            val_addr = zero_page_addr(args);
             break;
         case 0x95: // Zero Page, X
-            zero_page_x(args, &val_addr);
+            val_addr = zero_page_x_addr(args);
             break;
         case 0x8d: // Absolute
-            absolute(args, &val_addr);
+            val_addr = absolute_addr(args);
             break;
         case 0x9d: // Absolute, X
-            abs_x(args, &val_addr);
+            val_addr = abs_x_addr(args);
             break;
         case 0x99: // Absolute, Y
-            abs_y(args, &val_addr);
+            val_addr = abs_y_addr(args);
             break;
         case 0x81: // (Indirect, X)
-            indirect_x(args, &val_addr);
+            val_addr = indirect_x_addr(args);
             break;
         case 0x91: // (Indirect), Y
-            indirect_y(args, &val_addr);
+            val_addr = indirect_y_addr(args);
             break;
         default:
             displ_print_opcode("Unrecognized opcode for STA %02x\n", opcode);
@@ -939,12 +939,12 @@ void STX(byte opcode, byte args[2]) { // Store X register
 
     switch(opcode) {
         case 0x86: // Zero Page
-            zero_page(args, &val_addr);
+            val_addr = zero_page_addr(args);
             break;
         case 0x96: // Zero Page, Y
-            zero_page_y(args, &val_addr);
+            val_addr = zero_page_y_addr(args);
         case 0x8e: // Absolute
-            absolute(args, &val_addr);
+            val_addr = absolute_addr(args);
             break;
         default:
             displ_print_opcode("Unrecognized opcode for STX %02x\n", opcode);
@@ -960,12 +960,12 @@ void STY(byte opcode, byte args[2]) { // Store Y register
 
     switch(opcode) {
         case 0x84: // Zero Page
-            zero_page(args, &val_addr);
+            val_addr = zero_page_addr(args);
             break;
         case 0x94: // Zero Page, X
-            zero_page_x(args, &val_addr);
+            val_addr = zero_page_x_addr(args);
         case 0x8c: // Absolute
-            absolute(args, &val_addr);
+            val_addr = absolute_addr(args);
             break;
         default:
             displ_print_opcode("Unrecognized opcode for STY %02x\n", opcode);
@@ -649,6 +649,164 @@ int instruction_len(byte opcode) {
 }
 
 
+int instruction_cycles(byte opcode) { // Base cycle count, without page crossing penalties
+    switch(opcode) {
+        case 0x69: return 2;
+        case 0x65: return 3;
+        case 0x75: return 4;
+        case 0x6D: return 4;
+        case 0x7D: return 4;
+        case 0x79: return 4;
+        case 0x61: return 6;
+        case 0x71: return 5;
+        case 0x29: return 2;
+        case 0x25: return 3;
+        case 0x35: return 4;
+        case 0x2D: return 4;
+        case 0x3D: return 4;
+        case 0x39: return 4;
+        case 0x21: return 6;
+        case 0x31: return 5;
+        case 0x0A: return 2;
+        case 0x06: return 5;
+        case 0x16: return 6;
+        case 0x0E: return 6;
+        case 0x1E: return 7;
+        case 0x90: return 2;
+        case 0xB0: return 2;
+        case 0xF0: return 2;
+        case 0x24: return 3;
+        case 0x2C: return 4;
+        case 0x30: return 2;
+        case 0xD0: return 2;
+        case 0x10: return 2;
+        case 0x00: return 7;
+        case 0x50: return 2;
+        case 0x70: return 2;
+        case 0x18: return 2;
+        case 0xD8: return 2;
+        case 0x58: return 2;
+        case 0xB8: return 2;
+        case 0xC9: return 2;
+        case 0xC5: return 3;
+        case 0xD5: return 4;
+        case 0xCD: return 4;
+        case 0xDD: return 4;
+        case 0xD9: return 4;
+        case 0xC1: return 6;
+        case 0xD1: return 5;
+        case 0xE0: return 2;
+        case 0xE4: return 3;
+        case 0xEC: return 4;
+        case 0xC0: return 2;
+        case 0xC4: return 3;
+        case 0xCC: return 4;
+        case 0xC6: return 5;
+        case 0xD6: return 6;
+        case 0xCE: return 6;
+        case 0xDE: return 7;
+        case 0xCA: return 2;
+        case 0x88: return 2;
+        case 0x49: return 2;
+        case 0x45: return 3;
+        case 0x55: return 4;
+        case 0x4D: return 4;
+        case 0x5D: return 4;
+        case 0x59: return 4;
+        case 0x41: return 6;
+        case 0x51: return 5;
+        case 0xE6: return 5;
+        case 0xF6: return 6;
+        case 0xEE: return 6;
+        case 0xFE: return 7;
+        case 0xE8: return 2;
+        case 0xC8: return 2;
+        case 0x4C: return 3;
+        case 0x6C: return 5;
+        case 0x20: return 6;
+        case 0xA9: return 2;
+        case 0xA5: return 3;
+        case 0xB5: return 4;
+        case 0xAD: return 4;
+        case 0xBD: return 4;
+        case 0xB9: return 4;
+        case 0xA1: return 6;
+        case 0xB1: return 5;
+        case 0xA2: return 2;
+        case 0xA6: return 3;
+        case 0xB6: return 4;
+        case 0xAE: return 4;
+        case 0xBE: return 4;
+        case 0xA0: return 2;
+        case 0xA4: return 3;
+        case 0xB4: return 4;
+        case 0xAC: return 4;
+        case 0xBC: return 4;
+        case 0x4A: return 2;
+        case 0x46: return 5;
+        case 0x56: return 6;
+        case 0x4E: return 6;
+        case 0x5E: return 7;
+        case 0xEA: return 2;
+        case 0x09: return 2;
+        case 0x05: return 3;
+        case 0x15: return 4;
+        case 0x0D: return 4;
+        case 0x1D: return 4;
+        case 0x19: return 4;
+        case 0x01: return 6;
+        case 0x11: return 5;
+        case 0x48: return 3;
+        case 0x08: return 3;
+        case 0x68: return 4;
+        case 0x28: return 4;
+        case 0x2A: return 2;
+        case 0x26: return 5;
+        case 0x36: return 6;
+        case 0x2E: return 6;
+        case 0x3E: return 7;
+        case 0x6A: return 2;
+        case 0x66: return 5;
+        case 0x76: return 6;
+        case 0x6E: return 6;
+        case 0x7E: return 7;
+        case 0x40: return 6;
+        case 0x60: return 6;
+        case 0xE9: return 2;
+        case 0xE5: return 3;
+        case 0xF5: return 4;
+        case 0xED: return 4;
+        case 0xFD: return 4;
+        case 0xF9: return 4;
+        case 0xE1: return 6;
+        case 0xF1: return 5;
+        case 0x38: return 2;
+        case 0xF8: return 2;
+        case 0x78: return 2;
+        case 0x85: return 3;
+        case 0x95: return 4;
+        case 0x8D: return 4;
+        case 0x9D: return 5;
+        case 0x99: return 5;
+        case 0x81: return 6;
+        case 0x91: return 6;
+        case 0x86: return 3;
+        case 0x96: return 4;
+        case 0x8E: return 4;
+        case 0x84: return 3;
+        case 0x94: return 4;
+        case 0x8C: return 4;
+        case 0xAA: return 2;
+        case 0xA8: return 2;
+        case 0xBA: return 2;
+        case 0x8A: return 2;
+        case 0x9A: return 2;
+        case 0x98: return 2;
+        default: return 2;
+    }
+}
+
+
 /* Returns:
     0 if opcode is not a jump operation
     1 if opcode is a regular jump
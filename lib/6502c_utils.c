@@ -41,6 +41,19 @@ void pull_PC() {
 }
 
 
+void interrupt_NMI() {
+    push_PC();
+    mainCPU.pushstack(mainCPU.status);
+    set_status_flag(INTERRUPT_DISABLE, 1);
+
+    byte addr_lsb = mainCPU.readbus(0xfffa);
+    byte addr_msb = mainCPU.readbus(0xfffb);
+    mainCPU.PC = le_to_be(addr_lsb, addr_msb);
+
+    mainCPU.cycles += 7;
+}
+
+
 byte ADC_util(byte val, byte add_opt) {
     int temp;
     if(add_opt == ADD_POSITIVE) {
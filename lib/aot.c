@@ -0,0 +1,66 @@
+#include<stdio.h>
+#include<string.h>
+
+#include"../include/6502c.h"
+#include"../include/bus.h"
+#include"../include/ram.h"
+#include"../include/ppu.h"
+#include"../include/scheduler.h"
+#include"../include/aot.h"
+
+
+_Thread_local Aot mainAot;
+
+
+void init_aot() {
+    memset(&mainAot, 0, sizeof(mainAot));
+}
+
+
+// Runs the events that are due after the instruction before next, the block then returns
+void aot_events(addr16 next) {
+    mainCPU.PC = next;
+    run_events(mainCPU.cycles);
+}
+
+
+// Called after an instruction that accessed a device, which can run events on its own
+int aot_stopped(addr16 next) {
+    if(mainPPU.nmi_pending || mainPPU.frame_count != mainAot.frame) {
+        mainCPU.PC = next;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Self-modifying code: a block only runs while its bytes are still the recompiled ones
+int aot_code_matches(addr16 addr, const byte *code, int len) {
+    if(memcmp(RAM + addr, code, len) == 0) { return 1; }
+
+    mainAot.code_changed += 1;
+    return 0;
+}
+
+
+// Runs the CPU until the PPU enters vertical blank, like run_frame()
+void aot_run_frame(AotDispatch dispatch) {
+    mainAot.frame = mainPPU.frame_count;
+
+    while(mainPPU.frame_count == mainAot.frame) {
+        if(!mainPPU.nmi_pending && dispatch(mainCPU.PC)) {
+            mainAot.blocks += 1;
+        }
+        else {
+            tick();
+            mainAot.interpreted += 1;
+        }
+    }
+}
+
+
+void print_aot_stats() {
+    printf("aot: %lu blocks run, %lu instructions interpreted, %lu blocks overwritten\n",
+            mainAot.blocks, mainAot.interpreted, mainAot.code_changed);
+}
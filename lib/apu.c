@@ -0,0 +1,531 @@
+#include<string.h>
+
+#include"../include/apu.h"
+#include"../include/ram.h"
+#include"../include/scheduler.h"
+
+
+_Thread_local APU mainAPU;
+
+static const byte length_table[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const byte duty_table[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1}
+};
+
+static const byte triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// Periods in CPU cycles (NTSC)
+static const int noise_table[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const int dmc_table[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// Frame counter steps in CPU cycles from the start of the sequence
+static const unsigned long frame_steps[2][4] = {
+    {7457, 14913, 22371, 29829},
+    {7457, 14913, 22371, 37281}
+};
+
+// Non-linear mixer output for every sum of channel levels, scaled by APU_AMPLITUDE
+static int pulse_table[31];
+static int tnd_table[203];
+static int mixer_ready = 0;
+
+
+static void init_mixer() {
+    pulse_table[0] = 0;
+    for(int i=1; i<31; i++) {
+        pulse_table[i] = 95.52 / (8128.0 / i + 100) * APU_AMPLITUDE;
+    }
+
+    tnd_table[0] = 0;
+    for(int i=1; i<203; i++) {
+        tnd_table[i] = 163.67 / (24329.0 / i + 100) * APU_AMPLITUDE;
+    }
+
+    mixer_ready = 1;
+}
+
+
+static void frame_event(unsigned long cycle);
+static void rearm_timers(unsigned long cycle);
+
+
+void init_APU(unsigned long cpu_cycles) {
+    if(!mixer_ready) { init_mixer(); }
+
+    memset(&mainAPU, 0, sizeof(APU));
+
+    mainAPU.pulse[0].ones_complement = 1;
+    mainAPU.noise.lfsr = 1;
+    mainAPU.noise.period = noise_table[0];
+    mainAPU.dmc.period = dmc_table[0];
+    mainAPU.dmc.buffer_empty = 1;
+    mainAPU.dmc.silence = 1;
+    mainAPU.dmc.bits_remaining = 8;
+
+    mainAPU.pulse[0].next_clock = NO_EVENT;
+    mainAPU.pulse[1].next_clock = NO_EVENT;
+    mainAPU.triangle.next_clock = NO_EVENT;
+    mainAPU.noise.next_clock = NO_EVENT;
+    mainAPU.dmc.next_clock = NO_EVENT;
+
+    mainAPU.time = cpu_cycles;
+    mainAPU.frame_start = cpu_cycles;
+    schedule_event(EVENT_APU_FRAME, cpu_cycles + frame_steps[0][0], frame_event);
+}
+
+
+// Samples are only produced after this is called, until then the channel timers are skipped
+void apu_enable_output(int sample_rate) {
+    mainAPU.sample_rate = sample_rate;
+    mainAPU.change_count = 0;
+
+    // Timers went stale while the output was off
+    mainAPU.pulse[0].next_clock = NO_EVENT;
+    mainAPU.pulse[1].next_clock = NO_EVENT;
+    mainAPU.triangle.next_clock = NO_EVENT;
+    mainAPU.noise.next_clock = NO_EVENT;
+    rearm_timers(mainAPU.time);
+    mainAPU.synth_amplitude = mainAPU.amplitude;
+    init_blip(&mainAPU.blip, CPU_CLOCK_RATE, sample_rate, mainAPU.time);
+}
+
+
+static byte envelope_volume(Envelope *env) {
+    return env->constant ? env->volume : env->decay;
+}
+
+
+static int pulse_target(Pulse *pulse) {
+    int change = pulse->period >> pulse->sweep_shift;
+
+    if(pulse->sweep_negate) { return pulse->period - change - pulse->ones_complement; }
+    return pulse->period + change;
+}
+
+
+static int pulse_muted(Pulse *pulse) {
+    return pulse->period < 8 || pulse_target(pulse) > 0x7ff;
+}
+
+
+static byte pulse_output(Pulse *pulse) {
+    if(!pulse->length || pulse_muted(pulse) || !duty_table[pulse->duty][pulse->step]) { return 0; }
+    return envelope_volume(&pulse->env);
+}
+
+
+static byte noise_output() {
+    if(!mainAPU.noise.length || (mainAPU.noise.lfsr & 1)) { return 0; }
+    return envelope_volume(&mainAPU.noise.env);
+}
+
+
+static int mix() {
+    int pulse = pulse_output(&mainAPU.pulse[0]) + pulse_output(&mainAPU.pulse[1]);
+    int tnd = 3 * triangle_table[mainAPU.triangle.step] + 2 * noise_output() + mainAPU.dmc.output;
+
+    return pulse_table[pulse] + tnd_table[tnd];
+}
+
+
+static void synthesize() {
+    for(int i=0; i<mainAPU.change_count; i++) {
+        APUChange *change = mainAPU.changes + i;
+        blip_add_delta(&mainAPU.blip, change->cycle, change->amplitude - mainAPU.synth_amplitude);
+        mainAPU.synth_amplitude = change->amplitude;
+    }
+
+    mainAPU.change_count = 0;
+}
+
+
+// Logs the mixer output at the given cycle if it changed
+static void record_output(unsigned long cycle) {
+    int amplitude = mix();
+
+    if(amplitude == mainAPU.amplitude) { return; }
+    mainAPU.amplitude = amplitude;
+
+    if(!mainAPU.sample_rate) { return; }
+
+    if(mainAPU.change_count == APU_CHANGE_LOG_SIZE) {
+        synthesize();
+    }
+
+    mainAPU.changes[mainAPU.change_count].cycle = cycle;
+    mainAPU.changes[mainAPU.change_count].amplitude = amplitude;
+    mainAPU.change_count += 1;
+}
+
+
+// Channels whose output can not change have no timer, restart the ones that can
+static void rearm_timers(unsigned long cycle) {
+    for(int i=0; i<2; i++) {
+        Pulse *pulse = mainAPU.pulse + i;
+        int audible = pulse->length && !pulse_muted(pulse) && envelope_volume(&pulse->env);
+
+        if(!audible) { pulse->next_clock = NO_EVENT; }
+        else if(pulse->next_clock == NO_EVENT) { pulse->next_clock = cycle + (pulse->period + 1) * 2; }
+    }
+
+    Triangle *tri = &mainAPU.triangle;
+    if(!tri->length || !tri->linear || tri->period < 2) { tri->next_clock = NO_EVENT; }
+    else if(tri->next_clock == NO_EVENT) { tri->next_clock = cycle + tri->period + 1; }
+
+    Noise *noise = &mainAPU.noise;
+    if(!noise->length || !envelope_volume(&noise->env)) { noise->next_clock = NO_EVENT; }
+    else if(noise->next_clock == NO_EVENT) { noise->next_clock = cycle + noise->period; }
+
+    DMC *dmc = &mainAPU.dmc;
+    if(dmc->silence && dmc->buffer_empty && !dmc->bytes_remaining) { dmc->next_clock = NO_EVENT; }
+    else if(dmc->next_clock == NO_EVENT) { dmc->next_clock = cycle + dmc->period; }
+}
+
+
+static void dmc_restart() {
+    mainAPU.dmc.current_addr = mainAPU.dmc.sample_addr;
+    mainAPU.dmc.bytes_remaining = mainAPU.dmc.sample_len;
+}
+
+
+static void dmc_fill_buffer() {
+    DMC *dmc = &mainAPU.dmc;
+
+    if(!dmc->buffer_empty || !dmc->bytes_remaining) { return; }
+
+    dmc->buffer = mem_read(dmc->current_addr);
+    dmc->buffer_empty = 0;
+    dmc->current_addr = dmc->current_addr == 0xffff ? 0x8000 : dmc->current_addr + 1;
+    dmc->bytes_remaining -= 1;
+
+    if(!dmc->bytes_remaining) {
+        if(dmc->loop) { dmc_restart(); }
+        else if(dmc->irq_enable) { mainAPU.dmc_irq = 1; }
+    }
+}
+
+
+static void clock_dmc() {
+    DMC *dmc = &mainAPU.dmc;
+
+    if(!dmc->silence) {
+        if((dmc->shift & 1) && dmc->output <= 125) { dmc->output += 2; }
+        else if(!(dmc->shift & 1) && dmc->output >= 2) { dmc->output -= 2; }
+        dmc->shift >>= 1;
+    }
+
+    if(--dmc->bits_remaining == 0) {
+        dmc->bits_remaining = 8;
+        dmc->silence = dmc->buffer_empty;
+        if(!dmc->buffer_empty) {
+            dmc->shift = dmc->buffer;
+            dmc->buffer_empty = 1;
+        }
+    }
+
+    dmc_fill_buffer();
+}
+
+
+// Steps the channel timers that fire before the given cycle, in time order
+static void run_timers(unsigned long cycle) {
+    while(1) {
+        unsigned long *next = &mainAPU.pulse[0].next_clock;
+        int channel = 0;
+
+        if(mainAPU.pulse[1].next_clock < *next) { next = &mainAPU.pulse[1].next_clock; channel = 1; }
+        if(mainAPU.triangle.next_clock < *next) { next = &mainAPU.triangle.next_clock; channel = 2; }
+        if(mainAPU.noise.next_clock < *next) { next = &mainAPU.noise.next_clock; channel = 3; }
+        if(mainAPU.dmc.next_clock < *next) { next = &mainAPU.dmc.next_clock; channel = 4; }
+
+        if(*next > cycle) { break; }
+
+        unsigned long now = *next;
+
+        switch(channel) {
+            case 0:
+            case 1:
+                mainAPU.pulse[channel].step = (mainAPU.pulse[channel].step + 1) & 0x07;
+                *next += (mainAPU.pulse[channel].period + 1) * 2;
+                break;
+            case 2:
+                mainAPU.triangle.step = (mainAPU.triangle.step + 1) & 0x1f;
+                *next += mainAPU.triangle.period + 1;
+                break;
+            case 3: {
+                addr16 lfsr = mainAPU.noise.lfsr;
+                int feedback = (lfsr & 1) ^ ((lfsr >> (mainAPU.noise.mode ? 6 : 1)) & 1);
+                mainAPU.noise.lfsr = (lfsr >> 1) | (feedback << 14);
+                *next += mainAPU.noise.period;
+                break;
+            }
+            case 4:
+                clock_dmc();
+                *next += mainAPU.dmc.period;
+                break;
+        }
+
+        record_output(now);
+    }
+}
+
+
+void apu_catch_up(unsigned long cpu_cycles) {
+    if(cpu_cycles <= mainAPU.time) { return; }
+
+    if(mainAPU.sample_rate) {
+        run_timers(cpu_cycles);
+    }
+    else {
+        // Nobody listens, only the DMC is stepped because it is visible in $4015
+        while(mainAPU.dmc.next_clock <= cpu_cycles) {
+            clock_dmc();
+            mainAPU.dmc.next_clock += mainAPU.dmc.period;
+        }
+    }
+
+    mainAPU.time = cpu_cycles;
+}
+
+
+static void clock_envelope(Envelope *env) {
+    if(env->start) {
+        env->start = 0;
+        env->decay = 15;
+        env->divider = env->volume;
+    }
+    else if(env->divider == 0) {
+        env->divider = env->volume;
+        if(env->decay) { env->decay -= 1; }
+        else if(env->loop) { env->decay = 15; }
+    }
+    else {
+        env->divider -= 1;
+    }
+}
+
+
+static void clock_quarter_frame() {
+    clock_envelope(&mainAPU.pulse[0].env);
+    clock_envelope(&mainAPU.pulse[1].env);
+    clock_envelope(&mainAPU.noise.env);
+
+    Triangle *tri = &mainAPU.triangle;
+    if(tri->linear_reload) { tri->linear = tri->linear_reload_value; }
+    else if(tri->linear) { tri->linear -= 1; }
+    if(!tri->control) { tri->linear_reload = 0; }
+}
+
+
+static void clock_sweep(Pulse *pulse) {
+    if(pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift && !pulse_muted(pulse)) {
+        pulse->period = pulse_target(pulse);
+    }
+
+    if(pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = 0;
+    }
+    else {
+        pulse->sweep_divider -= 1;
+    }
+}
+
+
+static void clock_half_frame() {
+    for(int i=0; i<2; i++) {
+        if(!mainAPU.pulse[i].env.loop && mainAPU.pulse[i].length) { mainAPU.pulse[i].length -= 1; }
+        clock_sweep(mainAPU.pulse + i);
+    }
+
+    if(!mainAPU.triangle.control && mainAPU.triangle.length) { mainAPU.triangle.length -= 1; }
+    if(!mainAPU.noise.env.loop && mainAPU.noise.length) { mainAPU.noise.length -= 1; }
+}
+
+
+static void schedule_frame_step() {
+    schedule_event(EVENT_APU_FRAME, mainAPU.frame_start + frame_steps[mainAPU.frame_mode][mainAPU.frame_step], frame_event);
+}
+
+
+static void frame_event(unsigned long cycle) {
+    apu_catch_up(cycle);
+
+    int step = mainAPU.frame_step;
+
+    clock_quarter_frame();
+    if(step == 1 || step == 3) { clock_half_frame(); }
+
+    if(step == 3) {
+        if(mainAPU.frame_mode == 0 && !mainAPU.frame_irq_inhibit) { mainAPU.frame_irq = 1; }
+        mainAPU.frame_start += frame_steps[mainAPU.frame_mode][3] + 1;
+        mainAPU.frame_step = 0;
+    }
+    else {
+        mainAPU.frame_step += 1;
+    }
+
+    record_output(cycle);
+    rearm_timers(cycle);
+    schedule_frame_step();
+}
+
+
+byte apu_read_register(addr16 addr) {
+    if(addr != APU_STATUS) { return 0; }
+
+    byte val = (mainAPU.pulse[0].length > 0)
+        | ((mainAPU.pulse[1].length > 0) << 1)
+        | ((mainAPU.triangle.length > 0) << 2)
+        | ((mainAPU.noise.length > 0) << 3)
+        | ((mainAPU.dmc.bytes_remaining > 0) << 4)
+        | (mainAPU.frame_irq << 6)
+        | (mainAPU.dmc_irq << 7);
+
+    mainAPU.frame_irq = 0;
+
+    return val;
+}
+
+
+static void write_envelope(Envelope *env, byte data) {
+    env->loop = (data >> 5) & 1;
+    env->constant = (data >> 4) & 1;
+    env->volume = data & 0x0f;
+}
+
+
+static void write_pulse(Pulse *pulse, int reg, byte data, int enabled) {
+    switch(reg) {
+        case 0:
+            pulse->duty = data >> 6;
+            write_envelope(&pulse->env, data);
+            break;
+        case 1:
+            pulse->sweep_enabled = data >> 7;
+            pulse->sweep_period = (data >> 4) & 0x07;
+            pulse->sweep_negate = (data >> 3) & 1;
+            pulse->sweep_shift = data & 0x07;
+            pulse->sweep_reload = 1;
+            break;
+        case 2:
+            pulse->period = (pulse->period & 0x0700) | data;
+            break;
+        case 3:
+            pulse->period = (pulse->period & 0x00ff) | ((data & 0x07) << 8);
+            if(enabled) { pulse->length = length_table[data >> 3]; }
+            pulse->step = 0;
+            pulse->env.start = 1;
+            break;
+    }
+}
+
+
+void apu_write_register(addr16 addr, byte data) {
+    Triangle *tri = &mainAPU.triangle;
+    Noise *noise = &mainAPU.noise;
+    DMC *dmc = &mainAPU.dmc;
+
+    switch(addr) {
+        case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+            write_pulse(&mainAPU.pulse[0], addr & 0x03, data, mainAPU.enabled & 0x01);
+            break;
+        case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+            write_pulse(&mainAPU.pulse[1], addr & 0x03, data, mainAPU.enabled & 0x02);
+            break;
+        case 0x4008:
+            tri->control = data >> 7;
+            tri->linear_reload_value = data & 0x7f;
+            break;
+        case 0x400a:
+            tri->period = (tri->period & 0x0700) | data;
+            break;
+        case 0x400b:
+            tri->period = (tri->period & 0x00ff) | ((data & 0x07) << 8);
+            if(mainAPU.enabled & 0x04) { tri->length = length_table[data >> 3]; }
+            tri->linear_reload = 1;
+            break;
+        case 0x400c:
+            write_envelope(&noise->env, data);
+            break;
+        case 0x400e:
+            noise->mode = data >> 7;
+            noise->period = noise_table[data & 0x0f];
+            break;
+        case 0x400f:
+            if(mainAPU.enabled & 0x08) { noise->length = length_table[data >> 3]; }
+            noise->env.start = 1;
+            break;
+        case 0x4010:
+            dmc->irq_enable = data >> 7;
+            dmc->loop = (data >> 6) & 1;
+            dmc->period = dmc_table[data & 0x0f];
+            if(!dmc->irq_enable) { mainAPU.dmc_irq = 0; }
+            break;
+        case 0x4011:
+            dmc->output = data & 0x7f;
+            break;
+        case 0x4012:
+            dmc->sample_addr = 0xc000 + data * 64;
+            break;
+        case 0x4013:
+            dmc->sample_len = data * 16 + 1;
+            break;
+        case APU_STATUS:
+            mainAPU.enabled = data & 0x1f;
+            if(!(data & 0x01)) { mainAPU.pulse[0].length = 0; }
+            if(!(data & 0x02)) { mainAPU.pulse[1].length = 0; }
+            if(!(data & 0x04)) { tri->length = 0; }
+            if(!(data & 0x08)) { noise->length = 0; }
+            if(!(data & 0x10)) { dmc->bytes_remaining = 0; }
+            else if(!dmc->bytes_remaining) {
+                dmc_restart();
+                dmc_fill_buffer();
+            }
+            mainAPU.dmc_irq = 0;
+            break;
+        case APU_FRAME_COUNTER:
+            mainAPU.frame_mode = data >> 7;
+            mainAPU.frame_irq_inhibit = (data >> 6) & 1;
+            if(mainAPU.frame_irq_inhibit) { mainAPU.frame_irq = 0; }
+
+            mainAPU.frame_start = mainAPU.time;
+            mainAPU.frame_step = 0;
+            if(mainAPU.frame_mode) {
+                clock_quarter_frame();
+                clock_half_frame();
+            }
+            schedule_frame_step();
+            break;
+    }
+
+    record_output(mainAPU.time);
+    rearm_timers(mainAPU.time);
+}
+
+
+// Synthesizes everything logged up to the given cycle and reads at most count samples
+int apu_read_samples(unsigned long cpu_cycles, short *out, int count) {
+    if(!mainAPU.sample_rate) { return 0; }
+
+    apu_catch_up(cpu_cycles);
+    synthesize();
+    blip_end_frame(&mainAPU.blip, cpu_cycles);
+
+    return blip_read_samples(&mainAPU.blip, out, count);
+}
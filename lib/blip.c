@@ -0,0 +1,100 @@
+#include<string.h>
+#include<math.h>
+
+#include"../include/blip.h"
+
+
+// One windowed sinc impulse for every sub-sample phase, every phase sums to 1 << BLIP_KERNEL_BITS
+static int kernel[BLIP_PHASES][BLIP_WIDTH];
+static int kernel_ready = 0;
+
+
+static void init_kernel() {
+    const double cutoff = 0.9; // fraction of the Nyquist frequency
+
+    for(int phase=0; phase<BLIP_PHASES; phase++) {
+        double taps[BLIP_WIDTH];
+        double sum = 0;
+
+        for(int k=0; k<BLIP_WIDTH; k++) {
+            double x = (k - (BLIP_WIDTH / 2 - 1)) - (double)phase / BLIP_PHASES;
+            double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0.42 + 0.5 * cos(M_PI * x / (BLIP_WIDTH / 2)) + 0.08 * cos(2 * M_PI * x / (BLIP_WIDTH / 2));
+
+            taps[k] = fabs(x) >= BLIP_WIDTH / 2 ? 0 : sinc * window;
+            sum += taps[k];
+        }
+
+        for(int k=0; k<BLIP_WIDTH; k++) {
+            kernel[phase][k] = (int)lround(taps[k] / sum * (1 << BLIP_KERNEL_BITS));
+        }
+    }
+
+    kernel_ready = 1;
+}
+
+
+void init_blip(Blip *blip, long clock_rate, long sample_rate, unsigned long start) {
+    if(!kernel_ready) { init_kernel(); }
+
+    memset(blip, 0, sizeof(Blip));
+    blip->factor = ((unsigned long long)sample_rate << 32) / clock_rate;
+    blip->frame_start = start;
+}
+
+
+void blip_add_delta(Blip *blip, unsigned long clock, int delta) {
+    unsigned long long pos = blip->offset + (clock - blip->frame_start) * blip->factor;
+    int index = pos >> 32;
+    int phase = (pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    if(index >= BLIP_BUFFER_SIZE) { return; } // Nobody read the buffer, drop the change
+
+    int *out = blip->buf + index;
+    for(int k=0; k<BLIP_WIDTH; k++) {
+        out[k] += delta * kernel[phase][k];
+    }
+}
+
+
+void blip_end_frame(Blip *blip, unsigned long clock) {
+    blip->offset += (clock - blip->frame_start) * blip->factor;
+    blip->frame_start = clock;
+
+    // Keep at most a full buffer of pending samples
+    if((blip->offset >> 32) > BLIP_BUFFER_SIZE) {
+        blip->offset = (blip->offset & 0xffffffffULL) | ((unsigned long long)BLIP_BUFFER_SIZE << 32);
+    }
+}
+
+
+int blip_samples_avail(Blip *blip) {
+    return blip->offset >> 32;
+}
+
+
+int blip_read_samples(Blip *blip, short *out, int count) {
+    int avail = blip_samples_avail(blip);
+    if(count > avail) { count = avail; }
+
+    long sum = blip->integrator;
+    for(int i=0; i<count; i++) {
+        long s = sum >> BLIP_KERNEL_BITS;
+
+        sum += blip->buf[i];
+        if(s > 32767) { s = 32767; }
+        if(s < -32768) { s = -32768; }
+        out[i] = s;
+
+        sum -= s << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT); // high-pass, removes the DC offset
+    }
+    blip->integrator = sum;
+
+    // Shift the samples that are still being built to the start of the buffer
+    int remaining = avail - count + BLIP_WIDTH;
+    memmove(blip->buf, blip->buf + count, remaining * sizeof(int));
+    memset(blip->buf + remaining, 0, count * sizeof(int));
+    blip->offset -= (unsigned long long)count << 32;
+
+    return count;
+}
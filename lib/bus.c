@@ -1,40 +1,81 @@
 #include<string.h>
 #include<stdio.h>
+#include<stdlib.h>
 
 #include"../include/6502c.h"
 #include"../include/bus.h"
 #include"../include/ram.h"
+#include"../include/ppu.h"
+#include"../include/apu.h"
+#include"../include/input.h"
+#include"../include/scheduler.h"
+#include"../include/idle.h"
+#include"../include/fusion.h"
+#include"../include/cfg.h"
 #include"../include/display.h"
 
-extern Iterator RAM_iter;
-extern Iterator RAM_first;
-extern Iterator RAM_stack;
-extern Iterator RAM_instr;
 
-extern CPU mainCPU;
+_Thread_local byte bus_dirty[0x100 / 8];
 
 
 byte readCPU(addr16 addr) {
-    if(addr >= RAM_STACK_BEGIN && addr <= RAM_STACK_END) {
-        byte val;
-        RAM_stack = mem_read(RAM_stack, addr, &val);
-        return val;
+    if(addr >= PPU_REG_BEGIN && addr <= PPU_REG_END) {
+        ppu_sync_status(mainCPU.cycles);
+        return ppu_read_register(addr);
     }
-    else if(addr >= 0x0000 && addr <= 0xffff) {
-        byte val;
-        RAM_iter = mem_read(RAM_iter, addr, &val);
-        return val;
+    else if(addr == APU_STATUS) {
+        apu_catch_up(mainCPU.cycles);
+        return apu_read_register(addr);
     }
+    else if(addr == INPUT_PORT_1 || addr == INPUT_PORT_2) {
+        return input_read(addr);
+    }
+
+    return mem_read(addr);
 }
 
 
 void writeCPU(addr16 addr, byte data) {
-    if(addr >= RAM_STACK_BEGIN && addr <= RAM_STACK_END) {
-        RAM_stack = mem_write(RAM_stack, addr, data);
-    }       
-    else if(addr >= 0x0000 && addr <= 0xffff) {
-        RAM_iter = mem_write(RAM_iter, addr, data);
-    }       
+    if(addr >= PPU_REG_BEGIN && addr <= PPU_REG_END) {
+        ppu_catch_up(mainCPU.cycles);
+        ppu_write_register(addr, data);
+    }
+    else if(addr == OAM_DMA) {
+        oam_dma(data);
+    }
+    else if(addr == INPUT_PORT_1) {
+        input_write(data);
+    }
+    else if(addr >= APU_REG_BEGIN && addr <= APU_REG_END) {
+        apu_catch_up(mainCPU.cycles);
+        apu_write_register(addr, data);
+    }
+    else {
+        mem_write(addr, data);
+        bus_dirty[addr >> 11] |= 1 << ((addr >> 8) & 7);
+    }
+}
+
+
+// Returns whether the CPU wrote to the page since the last call
+int bus_take_dirty(byte page) {
+    int dirty = bus_dirty[page >> 3] >> (page & 7) & 1;
+
+    bus_dirty[page >> 3] &= ~(1 << (page & 7));
+    return dirty;
+}
+
+
+// Copies a whole page to OAM in one go and stalls the CPU for 513 cycles, 514 if it
+// starts on an odd cycle. The DMA starts after the last cycle of the store, which takes
+// 4 to 6 cycles with its addressing mode.
+void oam_dma(byte page) {
+    unsigned long start = mainCPU.cycles + instruction_cycles(mainCPU.opcode);
+
+    ppu_catch_up(mainCPU.cycles);
+    ppu_oam_dma(mem_page(page));
+
+    mainCPU.cycles += OAM_DMA_CYCLES + (start & 1);
 }
 
 
@@ -45,15 +86,86 @@ void load_prg(char *filename) {
     
     while(!feof(prg)) {
         fread(buff, sizeof(byte), 1, prg);
-        RAM_iter = mem_write(RAM_iter, addr_start, buff[0]);
+        mem_write(addr_start, buff[0]);
         addr_start ++;
     }
 }
 
 
+// Loads an iNES file, PRG ROM is mapped to $8000 - $ffff (mapper 0 only)
+void load_ines(char *filename) {
+    FILE *rom = fopen(filename, "rb");
+    byte header[16];
+
+    if(rom == NULL) {
+        printf("Error: cannot open ROM %s\n", filename);
+        exit(1);
+    }
+
+    if(fread(header, sizeof(byte), 16, rom) != 16 || memcmp(header, "NES\x1a", 4) != 0) {
+        printf("Error: %s is not an iNES file\n", filename);
+        exit(1);
+    }
+
+    int prg_size = header[4] * 0x4000;
+    int chr_size = header[5] * 0x2000;
+    int mapper = (header[6] >> 4) | (header[7] & 0xf0);
+
+    if(mapper != 0) {
+        printf("Warning: mapper %d is not supported, loading as NROM\n", mapper);
+    }
+
+    if(header[6] & 0x04) { fseek(rom, 512, SEEK_CUR); } // Skip the trainer
+
+    init_PPU(header[6] & 0x01 ? MIRROR_VERTICAL : MIRROR_HORIZONTAL);
+
+    byte *prg = (byte *)malloc(prg_size);
+    if(prg == NULL || fread(prg, sizeof(byte), prg_size, rom) != prg_size) {
+        printf("Error: failed to read PRG ROM from %s\n", filename);
+        exit(1);
+    }
+
+    // 16 kB images are mirrored into $c000 - $ffff
+    for(int addr=0x8000; addr<=0xffff; addr++) {
+        mem_write(addr, prg[(addr - 0x8000) % prg_size]);
+    }
+    free(prg);
+
+    if(chr_size > 0) {
+        byte chr[CHR_SIZE];
+        if(fread(chr, sizeof(byte), CHR_SIZE, rom) != CHR_SIZE) {
+            printf("Error: failed to read CHR ROM from %s\n", filename);
+            exit(1);
+        }
+        ppu_load_chr(chr, CHR_SIZE);
+    }
+
+    fclose(rom);
+}
+
+
+void start_bus_ines(char *filename) {
+    initCPU(readCPU, writeCPU);
+    clear_events();
+    init_APU(mainCPU.cycles);
+    init_input();
+    init_idle();
+    init_fusion();
+    load_ines(filename);
+    mainCPU.PC = le_to_be(readCPU(0xfffc), readCPU(0xfffd)); // Reset vector
+    displ_print("ROM loaded\n");
+}
+
+
 void start_bus(char *filename) {
     initCPU(readCPU, writeCPU);
     mainCPU.PC = 0x0600; // Starting address of program counter
+    clear_events();
+    init_PPU(MIRROR_HORIZONTAL);
+    init_APU(mainCPU.cycles);
+    init_input();
+    init_idle();
+    init_fusion();
     load_prg(filename);
     displ_print("Program loaded\n");
 }
@@ -65,20 +177,43 @@ void restart_bus() {
 
 
 void tick() {
+    if(mainPPU.nmi_pending) {
+        mainPPU.nmi_pending = 0;
+        interrupt_NMI();
+    }
+
+    addr16 pc = mainCPU.PC;
+    if(cfg_runtime != NULL) { cfg_execute(pc); }
+
+    // A fused sequence is one dispatch for all of its instructions
+    if(fusion_enabled && run_fusion(&pc)) {
+        if(mainCPU.PC <= pc && mainIdle.enabled) { idle_jump_back(pc); }
+        if(mainCPU.cycles >= mainScheduler.next) { run_events(mainCPU.cycles); }
+        return;
+    }
+
     byte opcode;
-    RAM_instr = mem_read(RAM_instr, mainCPU.PC, &opcode);
+    opcode = mem_read(mainCPU.PC);
+    mainCPU.opcode = opcode;
     mainCPU.PC += 1;
+    if(fusion_miner != NULL) { fusion_mine(opcode); }
 
     int len = instruction_len(opcode);
 
 
     byte args[2];
     for(int i=1; i<len; i++) {
-        RAM_instr = mem_read(RAM_instr, mainCPU.PC, args + (i-1));
+        args[i-1] = mem_read(mainCPU.PC);
         mainCPU.PC += 1;
     }
 
-    get_opcode_func(opcode)(opcode, args);
+    void (*opcode_func)(byte, byte*) = get_opcode_func(opcode);
+    if(opcode_func != NULL) { opcode_func(opcode, args); }
+
+    mainCPU.cycles += instruction_cycles(opcode);
+    if(mainCPU.PC <= pc && mainIdle.enabled) { idle_jump_back(pc); }
+    if(mainCPU.cycles >= mainScheduler.next) { run_events(mainCPU.cycles); }
+
     displ_print_opcode("EXECUTED: %02x\n", opcode);
     displ_print_opcode("ARGA LEN: %d\n", len);
     displ_print_opcode("ARG 0: %02x\n", args[0]);
@@ -86,6 +221,16 @@ void tick() {
     
 }
 
+// Runs the CPU until the PPU enters vertical blank
+void run_frame() {
+    unsigned long frame = mainPPU.frame_count;
+
+    while(mainPPU.frame_count == frame) {
+        tick();
+    }
+}
+
+
 char *get_cpu_state() {
     static char buff[200];
 
@@ -0,0 +1,230 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/ppu.h"
+#include"../include/capture.h"
+
+
+static void queue_init(FrameQueue *queue) {
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+
+static int queue_push(FrameQueue *queue, CaptureFrame *frame) {
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if(head - atomic_load_explicit(&queue->tail, memory_order_acquire) == CAPTURE_BUFFERS) { return 0; }
+
+    queue->slots[head & (CAPTURE_BUFFERS - 1)] = frame;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return 1;
+}
+
+
+static CaptureFrame *queue_pop(FrameQueue *queue) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if(tail == atomic_load_explicit(&queue->head, memory_order_acquire)) { return NULL; }
+
+    CaptureFrame *frame = queue->slots[tail & (CAPTURE_BUFFERS - 1)];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+    return frame;
+}
+
+
+static unsigned long queue_size(FrameQueue *queue) {
+    return atomic_load(&queue->head) - atomic_load(&queue->tail);
+}
+
+
+// BT.601 studio range
+static void init_color_tables(Capture *cap) {
+    for(int i=0; i<64; i++) {
+        unsigned int rgba = ppu_color_rgba(i);
+        int r = rgba & 0xff;
+        int g = (rgba >> 8) & 0xff;
+        int b = (rgba >> 16) & 0xff;
+
+        cap->rgb[i][0] = r;
+        cap->rgb[i][1] = g;
+        cap->rgb[i][2] = b;
+
+        cap->yuv[0][i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        cap->yuv[1][i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        cap->yuv[2][i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+
+static void write_y4m(Capture *cap, CaptureFrame *frame) {
+    byte *plane = cap->scratch;
+
+    fputs("FRAME\n", cap->file);
+    for(int p=0; p<3; p++) {
+        for(int i=0; i<CAPTURE_HEIGHT * CAPTURE_WIDTH; i++) {
+            plane[i] = cap->yuv[p][frame->pixels[i] & 0x3f];
+        }
+        fwrite(plane, 1, CAPTURE_HEIGHT * CAPTURE_WIDTH, cap->file);
+    }
+}
+
+
+static void write_ppm(Capture *cap, CaptureFrame *frame) {
+    byte *rgb = cap->scratch;
+    char filename[512];
+
+    snprintf(filename, sizeof(filename), cap->path, frame->number);
+    FILE *ppm = fopen(filename, "wb");
+
+    if(ppm == NULL) {
+        printf("Error: cannot open %s for writing\n", filename);
+        exit(1);
+    }
+
+    for(int i=0; i<CAPTURE_HEIGHT * CAPTURE_WIDTH; i++) {
+        memcpy(rgb + i * 3, cap->rgb[frame->pixels[i] & 0x3f], 3);
+    }
+
+    fprintf(ppm, "P6\n%d %d\n255\n", CAPTURE_WIDTH, CAPTURE_HEIGHT);
+    fwrite(rgb, 1, sizeof(cap->scratch), ppm);
+    fclose(ppm);
+}
+
+
+static void *writer_thread(void *arg) {
+    Capture *cap = (Capture *)arg;
+
+    // Every frame is posted once and closing posts once more, so the queue is only found
+    // empty after the last frame was written
+    while(1) {
+        sem_wait(&cap->filled);
+        CaptureFrame *frame = queue_pop(&cap->full);
+
+        if(frame == NULL) { break; }
+
+        if(cap->format == CAPTURE_Y4M) { write_y4m(cap, frame); }
+        else { write_ppm(cap, frame); }
+
+        cap->written += 1;
+        queue_push(&cap->empty, frame);
+        sem_post(&cap->freed);
+    }
+
+    return NULL;
+}
+
+
+// The PPM file names are printed with the frame number, the pattern must have exactly one
+// conversion and it must take an unsigned long (%lu, %06lu, %lx...). %% is allowed.
+static int is_frame_pattern(char *path) {
+    int conversions = 0;
+
+    for(char *c=path; *c; c++) {
+        if(*c != '%') { continue; }
+        if(c[1] == '%') { c++; continue; }
+
+        c++;
+        while(*c && strchr("-+ #0", *c)) { c++; }
+        while(*c >= '0' && *c <= '9') { c++; }
+        if(*c == '.') {
+            c++;
+            while(*c >= '0' && *c <= '9') { c++; }
+        }
+        if(*c != 'l' || c[1] == '\0' || !strchr("diouxX", c[1])) { return 0; }
+
+        c++;
+        conversions += 1;
+    }
+
+    return conversions == 1;
+}
+
+
+Capture *capture_open(char *path, int format, int skip) {
+    if(format == CAPTURE_PPM && !is_frame_pattern(path)) {
+        printf("Error: %s needs exactly one frame number conversion like %%06lu\n", path);
+        exit(1);
+    }
+
+    Capture *cap = (Capture *)calloc(1, sizeof(Capture));
+    CaptureFrame *frames = (CaptureFrame *)calloc(CAPTURE_BUFFERS, sizeof(CaptureFrame));
+
+    if(cap == NULL || frames == NULL) {
+        printf("Error: cannot allocate the capture buffers\n");
+        exit(1);
+    }
+
+    cap->frames = frames;
+    cap->format = format;
+    cap->skip = skip;
+    cap->path = path;
+    init_color_tables(cap);
+
+    if(format == CAPTURE_Y4M) {
+        cap->file = fopen(path, "wb");
+        if(cap->file == NULL) {
+            printf("Error: cannot open %s for writing\n", path);
+            exit(1);
+        }
+        // 4:4:4 so every NES pixel keeps its own color, the frame rate is 1789773 / 29780.5
+        fprintf(cap->file, "YUV4MPEG2 W%d H%d F3579546:59561 Ip A1:1 C444\n", CAPTURE_WIDTH, CAPTURE_HEIGHT);
+    }
+
+    queue_init(&cap->full);
+    queue_init(&cap->empty);
+    for(int i=0; i<CAPTURE_BUFFERS; i++) {
+        queue_push(&cap->empty, cap->frames + i);
+    }
+
+    sem_init(&cap->filled, 0, 0);
+    sem_init(&cap->freed, 0, CAPTURE_BUFFERS);
+    pthread_create(&cap->thread, NULL, writer_thread, cap);
+
+    return cap;
+}
+
+
+// Called by the emulation after every frame, copies the framebuffer into a free buffer
+void capture_frame(Capture *cap, unsigned long number, byte *pixels) {
+    if(cap->skip && sem_trywait(&cap->freed) != 0) {
+        cap->dropped += 1;
+        return;
+    }
+    if(!cap->skip) { sem_wait(&cap->freed); }
+
+    CaptureFrame *frame = queue_pop(&cap->empty);
+
+    frame->number = number;
+    memcpy(frame->pixels, pixels, sizeof(frame->pixels));
+    queue_push(&cap->full, frame);
+    sem_post(&cap->filled);
+
+    cap->captured += 1;
+    unsigned long queued = queue_size(&cap->full);
+    if(queued > cap->max_queued) { cap->max_queued = queued; }
+}
+
+
+// Waits for the writer thread to write every queued frame and prints the stats
+void capture_close(Capture *cap) {
+    sem_post(&cap->filled);
+    pthread_join(cap->thread, NULL);
+    capture_print_stats(cap);
+
+    sem_destroy(&cap->filled);
+    sem_destroy(&cap->freed);
+
+    if(cap->file != NULL) { fclose(cap->file); }
+    free(cap->frames);
+    free(cap);
+}
+
+
+void capture_print_stats(Capture *cap) {
+    printf("capture: %lu frames queued, %lu written, %lu dropped, at most %lu of %d buffers in the queue\n",
+            cap->captured, cap->written, cap->dropped, cap->max_queued, CAPTURE_BUFFERS);
+}
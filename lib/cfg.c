@@ -0,0 +1,419 @@
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/exec_tree.h"
+#include"../include/cfg.h"
+
+
+static char *exit_names[] = {"fall", "branch", "jump", "call", "return", "indirect", "stop"};
+
+
+static ExecNode *decode(Cfg *cfg, addr16 addr) {
+    return decode_exec_node(cfg->map, addr);
+}
+
+
+static void queue(Cfg *cfg, addr16 addr) {
+    if(cfg->leader[addr]) { return; }
+
+    cfg->leader[addr] = 1;
+    cfg->queue[cfg->queued++] = addr;
+}
+
+
+int cfg_routine_at(Cfg *cfg, addr16 entry) {
+    for(int i=0; i<cfg->routine_count; i++) {
+        if(cfg->routines[i].entry == entry) { return i; }
+    }
+
+    return -1;
+}
+
+
+static void add_routine(Cfg *cfg, addr16 entry) {
+    if(cfg_routine_at(cfg, entry) >= 0) { return; }
+
+    if(cfg->routine_count == CFG_MAX_ROUTINES) {
+        printf("Error: more than %d routines\n", CFG_MAX_ROUTINES);
+        exit(1);
+    }
+
+    cfg->routines[cfg->routine_count].entry = entry;
+    cfg->routine_count += 1;
+    queue(cfg, entry);
+}
+
+
+static int exit_of(ExecNode *node) {
+    if(get_opcode_func(node->opcode) == NULL || node->opcode == 0x00) { return CFG_STOP; }
+
+    switch(is_opcode_jump(node->opcode)) {
+        case BRANCH_OP: return CFG_BRANCH;
+        case JUMP_OP: return node->opcode == 0x6c ? CFG_INDIRECT : CFG_JUMP;
+        case SR_JUMP_OP: return CFG_CALL;
+        case RETURN_OP: return CFG_RETURN;
+    }
+
+    return CFG_FALL;
+}
+
+
+// Decodes from addr until the path ends or joins code decoded before. BRK goes through
+// the IRQ vector, which is a root already.
+static void decode_path(Cfg *cfg, addr16 addr) {
+    while(cfg->map->at[addr] == NULL) {
+        ExecNode *node = decode(cfg, addr);
+        addr16 next = addr + node->cmd_len;
+        addr16 target = le_to_be(node->args[0], node->args[1]);
+
+        switch(exit_of(node)) {
+            case CFG_BRANCH:
+                queue(cfg, next + (sbyte)node->args[0]);
+                queue(cfg, next);
+                return;
+            case CFG_JUMP:
+                queue(cfg, target);
+                return;
+            case CFG_CALL:
+                add_routine(cfg, target);
+                queue(cfg, next);
+                return;
+            case CFG_INDIRECT:
+                if(cfg->indirect_count < CFG_MAX_INDIRECT) { cfg->indirect[cfg->indirect_count++] = addr; }
+                return;
+            case CFG_RETURN:
+            case CFG_STOP:
+                return;
+        }
+
+        addr = next;
+    }
+
+    queue(cfg, addr); // joins code decoded before, which may have to be split there
+}
+
+
+static CfgBlock *add_block(Cfg *cfg, addr16 start, int routine) {
+    CfgBlock *block = (CfgBlock *)arena_alloc(&cfg->map->arena, sizeof(CfgBlock));
+    addr16 addr = start;
+
+    block->start = start;
+    block->instructions = 0;
+    block->taken = block->next = NULL;
+    block->routine = routine;
+    block->mark = -1;
+    block->order = -1;
+    block->idom = NULL;
+    block->depth = block->header = 0;
+
+    while(1) {
+        ExecNode *node = cfg->map->at[addr];
+        addr16 next = addr + node->cmd_len;
+
+        block->instructions += 1;
+        block->last = addr;
+        block->end = next;
+        block->exit = exit_of(node);
+
+        if(block->exit != CFG_FALL || cfg->leader[next] || cfg->map->at[next] == NULL) { break; }
+        addr = next;
+    }
+
+    cfg->block_at[start] = block;
+    cfg->block_count += 1;
+
+    return block;
+}
+
+
+static void link_block(Cfg *cfg, CfgBlock *block) {
+    ExecNode *last = cfg->map->at[block->last];
+    addr16 target = le_to_be(last->args[0], last->args[1]);
+
+    if(block->exit == CFG_BRANCH) { block->taken = cfg->block_at[(addr16)(block->end + (sbyte)last->args[0])]; }
+    if(block->exit == CFG_JUMP || block->exit == CFG_CALL) { block->taken = cfg->block_at[target]; }
+    if(block->exit == CFG_FALL || block->exit == CFG_BRANCH || block->exit == CFG_CALL) {
+        block->next = cfg->block_at[block->end];
+    }
+}
+
+
+// Block with an instruction starting at addr, NULL if addr starts no instruction of the
+// nearest block below it
+static CfgBlock *block_containing(Cfg *cfg, addr16 addr) {
+    for(int back=0; back<CFG_MAX_SCAN && back<=addr; back++) {
+        CfgBlock *block = cfg->block_at[(addr16)(addr - back)];
+        if(block == NULL) { continue; }
+        if(addr >= block->end) { return NULL; }
+
+        for(addr16 pc=block->start; pc<block->end; pc+=cfg->map->at[pc]->cmd_len) {
+            if(pc == addr) { return block; }
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
+
+// Cuts the block in two at addr, the first half falls through to the second
+static void split_block(Cfg *cfg, CfgBlock *block, addr16 addr) {
+    CfgBlock *second = (CfgBlock *)arena_alloc(&cfg->map->arena, sizeof(CfgBlock));
+    addr16 pc = block->start;
+    int instructions = 1;
+
+    *second = *block;
+    second->start = addr;
+    while(pc + cfg->map->at[pc]->cmd_len != addr) {
+        pc += cfg->map->at[pc]->cmd_len;
+        instructions += 1;
+    }
+
+    second->instructions = block->instructions - instructions;
+    block->instructions = instructions;
+    block->end = addr;
+    block->last = pc;
+    block->exit = CFG_FALL;
+    block->taken = NULL;
+    block->next = second;
+
+    cfg->block_at[addr] = second;
+    cfg->block_count += 1;
+}
+
+
+// Walks the blocks of every routine without entering the routines it calls. A block
+// reached from several routines belongs to the first, every one of them gets its calls.
+static void walk_routines(Cfg *cfg) {
+    CfgBlock **stack = (CfgBlock **)arena_alloc(&cfg->map->arena, (cfg->block_count + 1) * 2 * sizeof(CfgBlock *));
+
+    for(int r=0; r<cfg->routine_count; r++) {
+        CfgRoutine *routine = &cfg->routines[r];
+        int size = 0;
+
+        stack[size++] = cfg->block_at[routine->entry];
+        while(size > 0) {
+            CfgBlock *block = stack[--size];
+            if(block == NULL || block->mark == r) { continue; }
+
+            block->mark = r;
+            if(block->routine < 0) { block->routine = r; }
+            routine->blocks += 1;
+
+            if(block->exit == CFG_CALL && cfg->call_count < CFG_MAX_CALLS) {
+                ExecNode *jsr = cfg->map->at[block->last];
+                CfgCall *call = &cfg->calls[cfg->call_count++];
+
+                call->site = block->last;
+                call->caller = r;
+                call->callee = cfg_routine_at(cfg, le_to_be(jsr->args[0], jsr->args[1]));
+                routine->calls += 1;
+            }
+
+            if(block->exit != CFG_CALL) { stack[size++] = block->taken; }
+            stack[size++] = block->next;
+        }
+    }
+}
+
+
+Cfg *create_cfg() {
+    Cfg *cfg = (Cfg *)calloc(1, sizeof(Cfg));
+    if(cfg == NULL) {
+        printf("Error: cannot allocate the control-flow graph\n");
+        exit(1);
+    }
+
+    cfg->map = create_exec_map();
+
+    return cfg;
+}
+
+
+// Builds the graph of the program in memory, the ROM must be loaded
+Cfg *build_cfg() {
+    Cfg *cfg = create_cfg();
+
+    cfg->vectors[0] = le_to_be(mem_read(0xfffa), mem_read(0xfffb));
+    cfg->vectors[1] = le_to_be(mem_read(0xfffc), mem_read(0xfffd));
+    cfg->vectors[2] = le_to_be(mem_read(0xfffe), mem_read(0xffff));
+
+    for(int i=0; i<3; i++) { add_routine(cfg, cfg->vectors[i]); }
+
+    for(int i=0; i<cfg->queued; i++) {
+        decode_path(cfg, cfg->queue[i]);
+    }
+
+    // Every leader was queued, so no block has to be split yet
+    for(int i=0; i<cfg->queued; i++) {
+        add_block(cfg, cfg->queue[i], -1);
+    }
+    for(int i=0; i<cfg->queued; i++) {
+        link_block(cfg, cfg->block_at[cfg->queue[i]]);
+    }
+
+    walk_routines(cfg);
+    cfg_find_loops(cfg);
+
+    return cfg;
+}
+
+
+_Thread_local Cfg *cfg_runtime = NULL;
+
+
+// tick() reports every instruction it runs to the graph until cfg_refine_stop
+void cfg_refine_start(Cfg *cfg) {
+    cfg->last_opcode = 0xea; // NOP
+    cfg_runtime = cfg;
+}
+
+
+// The loops are found again with the blocks the run added
+void cfg_refine_stop() {
+    if(cfg_runtime != NULL) { cfg_find_loops(cfg_runtime); }
+    cfg_runtime = NULL;
+}
+
+
+static void add_target(Cfg *cfg, addr16 site, addr16 target) {
+    for(int i=0; i<cfg->target_count; i++) {
+        if(cfg->targets[i].site == site && cfg->targets[i].target == target) { return; }
+    }
+
+    if(cfg->target_count < CFG_MAX_TARGETS) {
+        cfg->targets[cfg->target_count].site = site;
+        cfg->targets[cfg->target_count].target = target;
+        cfg->target_count += 1;
+    }
+}
+
+
+// Decodes the code reached from pc that is not in the graph yet and makes its blocks.
+// Only the new leaders are visited, so the work is proportional to the new code.
+static void refine(Cfg *cfg, addr16 pc, addr16 from) {
+    int first = cfg->queued;
+    int decoded = cfg->map->count;
+    CfgBlock *origin = block_containing(cfg, from);
+    int routine = origin != NULL ? origin->routine : -1;
+
+    queue(cfg, pc);
+    for(int i=first; i<cfg->queued; i++) {
+        decode_path(cfg, cfg->queue[i]);
+    }
+
+    for(int i=first; i<cfg->queued; i++) {
+        addr16 addr = cfg->queue[i];
+        if(cfg->block_at[addr] != NULL) { continue; }
+
+        CfgBlock *block = block_containing(cfg, addr);
+        int entry = cfg_routine_at(cfg, addr);
+
+        if(block != NULL) {
+            split_block(cfg, block, addr);
+            cfg->split_blocks += 1;
+        }
+        else {
+            add_block(cfg, addr, entry >= 0 ? entry : routine);
+            cfg->found_blocks += 1;
+        }
+    }
+
+    for(int i=first; i<cfg->queued; i++) {
+        CfgBlock *block = cfg->block_at[cfg->queue[i]];
+
+        link_block(cfg, block);
+        if(block->exit == CFG_CALL && block->routine >= 0 && cfg->call_count < CFG_MAX_CALLS) {
+            ExecNode *jsr = cfg->map->at[block->last];
+            CfgCall *call = &cfg->calls[cfg->call_count++];
+
+            call->site = block->last;
+            call->caller = block->routine;
+            call->callee = cfg_routine_at(cfg, le_to_be(jsr->args[0], jsr->args[1]));
+            cfg->routines[block->routine].calls += 1;
+        }
+    }
+
+    cfg->refined_instructions += cfg->map->count - decoded;
+}
+
+
+/* Called by tick() with the PC of every instruction it dispatches. Code that is not in the
+   graph yet is decoded from there. JMP (indirect) and RTS can land anywhere: a landing in
+   the middle of a block splits it, and the targets of indirect jumps are recorded.
+   RTI is left out, it returns to whatever instruction the interrupt stopped.
+*/
+void cfg_execute(addr16 pc) {
+    Cfg *cfg = cfg_runtime;
+    byte last = cfg->last_opcode;
+    addr16 from = cfg->last_pc;
+    int landed = last == 0x6c || last == 0x60;
+
+    if(cfg->map->at[pc] == NULL || (landed && !cfg->leader[pc])) { refine(cfg, pc, from); }
+    if(last == 0x6c) { add_target(cfg, from, pc); }
+
+    cfg->last_pc = pc;
+    cfg->last_opcode = cfg->map->at[pc]->opcode;
+}
+
+
+void free_cfg(Cfg *cfg) {
+    free_exec_map(cfg->map);
+    free(cfg);
+}
+
+
+CfgBlock *cfg_block_at(Cfg *cfg, addr16 addr) {
+    return cfg->block_at[addr];
+}
+
+
+void print_cfg(Cfg *cfg, int verbose) {
+    int bytes = 0;
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        if(cfg->map->at[addr] != NULL) { bytes += cfg->map->at[addr]->cmd_len; }
+    }
+
+    printf("cfg: NMI $%04x, reset $%04x, IRQ $%04x\n", cfg->vectors[0], cfg->vectors[1], cfg->vectors[2]);
+    printf("cfg: %d instructions (%d bytes) in %d blocks, %d routines, %d calls, %d indirect jumps\n",
+            cfg->map->count, bytes, cfg->block_count, cfg->routine_count, cfg->call_count, cfg->indirect_count);
+
+    if(cfg->refined_instructions || cfg->target_count) {
+        printf("cfg: refined at run time, %d instructions decoded, %d blocks found, %d split, %d indirect targets\n",
+                cfg->refined_instructions, cfg->found_blocks, cfg->split_blocks, cfg->target_count);
+    }
+    printf("cfg: %d loops, nested up to %d deep\n", cfg->loop_count, cfg->max_depth);
+
+    if(!verbose) { return; }
+
+    for(int r=0; r<cfg->routine_count; r++) {
+        printf("routine $%04x: %d blocks, calls", cfg->routines[r].entry, cfg->routines[r].blocks);
+        for(int c=0; c<cfg->call_count; c++) {
+            if(cfg->calls[c].caller == r) { printf(" $%04x", cfg->routines[cfg->calls[c].callee].entry); }
+        }
+        printf("\n");
+    }
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        CfgBlock *block = cfg->block_at[addr];
+        if(block == NULL) { continue; }
+
+        printf("    $%04x - $%04x %3d instructions, %-8s", block->start, block->end - 1, block->instructions, exit_names[block->exit]);
+        printf(" depth %d%s", block->depth, block->header ? " loop" : "");
+        if(block->idom != NULL) { printf(" idom $%04x", block->idom->start); }
+        if(block->taken != NULL) { printf(" -> $%04x", block->taken->start); }
+        if(block->next != NULL) { printf(" next $%04x", block->next->start); }
+        printf("\n");
+    }
+
+    for(int i=0; i<cfg->indirect_count; i++) {
+        printf("    indirect jump at $%04x, targets", cfg->indirect[i]);
+        for(int t=0; t<cfg->target_count; t++) {
+            if(cfg->targets[t].site == cfg->indirect[i]) { printf(" $%04x", cfg->targets[t].target); }
+        }
+        printf("\n");
+    }
+}
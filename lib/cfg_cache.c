@@ -0,0 +1,291 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/hash.h"
+#include"../include/exec_tree.h"
+#include"../include/cfg.h"
+#include"../include/cfg_cache.h"
+
+
+static unsigned long align8(unsigned long size) {
+    return (size + 7) & ~7UL;
+}
+
+
+// Offsets of the sections after the header
+typedef struct {
+    unsigned long instructions, blocks, routines, calls, targets, indirect, size;
+} Layout;
+
+
+static Layout layout_of(CfgCacheHeader *header) {
+    Layout at;
+
+    at.instructions = align8(sizeof(CfgCacheHeader));
+    at.blocks = at.instructions + align8(header->instructions * sizeof(CfgCacheInstruction));
+    at.routines = at.blocks + align8(header->blocks * sizeof(CfgCacheBlock));
+    at.calls = at.routines + align8(header->routines * sizeof(CfgCacheRoutine));
+    at.targets = at.calls + align8(header->calls * sizeof(CfgCacheCall));
+    at.indirect = at.targets + align8(header->targets * sizeof(CfgTarget));
+    at.size = at.indirect + align8(header->indirect * sizeof(addr16));
+
+    return at;
+}
+
+
+hash64 prg_hash() {
+    return xxhash64(RAM + CFG_CACHE_PRG_START, 0x10000 - CFG_CACHE_PRG_START, 0);
+}
+
+
+void cfg_cache_path(char *buff, int size, char *dir) {
+    snprintf(buff, size, "%s/%016llx.cfg", dir, prg_hash());
+}
+
+
+// Code below the PRG data is in RAM, the hash does not cover it and another run can copy
+// other code there. It is left out and refinement decodes it again when it runs.
+static int cached_addr(unsigned int addr) {
+    return addr >= CFG_CACHE_PRG_START;
+}
+
+
+// Returns 0 when the cache cannot be written, the graph is only rebuilt next time then
+int save_cfg_cache(Cfg *cfg, char *filename) {
+    CfgCacheHeader header = { CFG_CACHE_MAGIC, CFG_CACHE_VERSION, prg_hash() };
+
+    for(unsigned int addr=CFG_CACHE_PRG_START; addr<0x10000; addr++) {
+        header.instructions += cfg->map->at[addr] != NULL;
+        header.blocks += cfg->block_at[addr] != NULL;
+    }
+    for(int i=0; i<cfg->call_count; i++) { header.calls += cached_addr(cfg->calls[i].site); }
+    for(int i=0; i<cfg->target_count; i++) { header.targets += cached_addr(cfg->targets[i].site); }
+    for(int i=0; i<cfg->indirect_count; i++) { header.indirect += cached_addr(cfg->indirect[i]); }
+    header.routines = cfg->routine_count;
+    memcpy(header.vectors, cfg->vectors, sizeof(header.vectors));
+
+    Layout at = layout_of(&header);
+    byte *data = (byte *)calloc(1, at.size);
+    if(data == NULL) {
+        printf("Error: cannot allocate the graph cache\n");
+        exit(1);
+    }
+
+    memcpy(data, &header, sizeof(header));
+
+    CfgCacheInstruction *instruction = (CfgCacheInstruction *)(data + at.instructions);
+    CfgCacheBlock *block = (CfgCacheBlock *)(data + at.blocks);
+    for(unsigned int addr=CFG_CACHE_PRG_START; addr<0x10000; addr++) {
+        ExecNode *node = cfg->map->at[addr];
+        CfgBlock *source = cfg->block_at[addr];
+
+        if(node != NULL) {
+            instruction->index = addr;
+            instruction->opcode = node->opcode;
+            instruction->len = node->cmd_len;
+            memcpy(instruction->args, node->args, 2);
+            instruction++;
+        }
+
+        if(source != NULL) {
+            block->start = source->start;
+            block->end = source->end;
+            block->last = source->last;
+            block->exit = source->exit;
+            block->instructions = source->instructions;
+            block->routine = source->routine;
+            block->taken = source->taken != NULL && cached_addr(source->taken->start) ? source->taken->start : -1;
+            block->next = source->next != NULL && cached_addr(source->next->start) ? source->next->start : -1;
+            block++;
+        }
+    }
+
+    CfgCacheRoutine *routine = (CfgCacheRoutine *)(data + at.routines);
+    for(int i=0; i<cfg->routine_count; i++) {
+        routine[i].entry = cfg->routines[i].entry;
+        routine[i].blocks = cfg->routines[i].blocks;
+        routine[i].calls = cfg->routines[i].calls;
+    }
+
+    CfgCacheCall *call = (CfgCacheCall *)(data + at.calls);
+    for(int i=0; i<cfg->call_count; i++) {
+        if(!cached_addr(cfg->calls[i].site)) { continue; }
+
+        call->site = cfg->calls[i].site;
+        call->caller = cfg->calls[i].caller;
+        call->callee = cfg->calls[i].callee;
+        call++;
+    }
+
+    CfgTarget *target = (CfgTarget *)(data + at.targets);
+    for(int i=0; i<cfg->target_count; i++) {
+        if(cached_addr(cfg->targets[i].site)) { *target++ = cfg->targets[i]; }
+    }
+
+    addr16 *indirect = (addr16 *)(data + at.indirect);
+    for(int i=0; i<cfg->indirect_count; i++) {
+        if(cached_addr(cfg->indirect[i])) { *indirect++ = cfg->indirect[i]; }
+    }
+
+    // Readers never see a partly written cache
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.%d", filename, (int)getpid());
+
+    FILE *file = fopen(temp, "wb");
+    int ok = file != NULL && fwrite(data, 1, at.size, file) == at.size;
+    if(file != NULL) { ok &= fclose(file) == 0; }
+    ok = ok && rename(temp, filename) == 0;
+    if(!ok) {
+        printf("Warning: cannot write the graph cache %s\n", filename);
+        unlink(temp);
+    }
+
+    free(data);
+    return ok;
+}
+
+
+static int valid_routine(Cfg *cfg, int routine) {
+    return routine >= -1 && routine < cfg->routine_count;
+}
+
+
+static Cfg *rebuild(byte *data) {
+    CfgCacheHeader *header = (CfgCacheHeader *)data;
+    Layout at = layout_of(header);
+    Cfg *cfg = create_cfg();
+    int ok = 1;
+
+    memcpy(cfg->vectors, header->vectors, sizeof(cfg->vectors));
+    cfg->routine_count = header->routines;
+    cfg->call_count = header->calls;
+    cfg->target_count = header->targets;
+    cfg->indirect_count = header->indirect;
+
+    CfgCacheInstruction *instruction = (CfgCacheInstruction *)(data + at.instructions);
+    for(unsigned int i=0; i<header->instructions; i++, instruction++) {
+        ExecNode *node = allocate_exec_node(cfg->map);
+
+        node->index = instruction->index;
+        node->opcode = instruction->opcode;
+        node->cmd_len = instruction->len;
+        memcpy(node->args, instruction->args, 2);
+        node->addressing_mode = get_opcode_addressing(instruction->opcode);
+
+        ok &= instruction->len >= 1 && instruction->len <= 3;
+        cfg->map->at[node->index] = node;
+        cfg->map->count += 1;
+    }
+
+    CfgCacheBlock *record = (CfgCacheBlock *)(data + at.blocks);
+    for(unsigned int i=0; i<header->blocks; i++) {
+        CfgBlock *block = (CfgBlock *)arena_alloc(&cfg->map->arena, sizeof(CfgBlock));
+
+        block->start = record[i].start;
+        block->end = record[i].end;
+        block->last = record[i].last;
+        block->exit = record[i].exit;
+        block->instructions = record[i].instructions;
+        block->routine = record[i].routine;
+        block->taken = block->next = NULL;
+        block->mark = -1;
+        block->order = -1;
+        block->idom = NULL;
+        block->depth = block->header = 0;
+
+        ok &= cfg->map->at[block->start] != NULL && cfg->map->at[block->last] != NULL;
+        ok &= block->exit <= CFG_STOP && valid_routine(cfg, block->routine);
+        cfg->block_at[block->start] = block;
+        cfg->leader[block->start] = 1;
+        cfg->queue[cfg->queued++] = block->start;
+        cfg->block_count += 1;
+    }
+
+    for(unsigned int i=0; i<header->blocks; i++) {
+        CfgBlock *block = cfg->block_at[record[i].start];
+
+        if(record[i].taken >= 0) { block->taken = cfg->block_at[record[i].taken & 0xffff]; }
+        if(record[i].next >= 0) { block->next = cfg->block_at[record[i].next & 0xffff]; }
+    }
+
+    CfgCacheRoutine *routine = (CfgCacheRoutine *)(data + at.routines);
+    for(int i=0; i<cfg->routine_count; i++) {
+        cfg->routines[i].entry = routine[i].entry;
+        cfg->routines[i].blocks = routine[i].blocks;
+        cfg->routines[i].calls = routine[i].calls;
+    }
+
+    CfgCacheCall *call = (CfgCacheCall *)(data + at.calls);
+    for(int i=0; i<cfg->call_count; i++) {
+        cfg->calls[i].site = call[i].site;
+        cfg->calls[i].caller = call[i].caller;
+        cfg->calls[i].callee = call[i].callee;
+        ok &= valid_routine(cfg, call[i].caller) && valid_routine(cfg, call[i].callee);
+    }
+
+    memcpy(cfg->targets, data + at.targets, cfg->target_count * sizeof(CfgTarget));
+    memcpy(cfg->indirect, data + at.indirect, cfg->indirect_count * sizeof(addr16));
+
+    if(!ok) {
+        free_cfg(cfg);
+        return NULL;
+    }
+
+    cfg_find_loops(cfg);
+    return cfg;
+}
+
+
+// Returns NULL when there is no cache, it belongs to another ROM or it is damaged
+Cfg *load_cfg_cache(char *filename) {
+    struct stat info;
+    int fd = open(filename, O_RDONLY);
+
+    if(fd < 0) { return NULL; }
+    if(fstat(fd, &info) < 0 || info.st_size < sizeof(CfgCacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    byte *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) { return NULL; }
+
+    CfgCacheHeader *header = (CfgCacheHeader *)data;
+    Cfg *cfg = NULL;
+
+    if(memcmp(header->magic, CFG_CACHE_MAGIC, 4) == 0 && header->version == CFG_CACHE_VERSION
+            && header->prg_hash == prg_hash() && header->instructions <= 0x10000
+            && header->blocks <= 0x10000 && header->routines <= CFG_MAX_ROUTINES
+            && header->calls <= CFG_MAX_CALLS && header->targets <= CFG_MAX_TARGETS
+            && header->indirect <= CFG_MAX_INDIRECT && layout_of(header).size <= info.st_size) {
+        cfg = rebuild(data);
+    }
+
+    munmap(data, info.st_size);
+    return cfg;
+}
+
+
+// Loads the graph of the ROM in memory from the cache directory, or builds and caches it
+Cfg *cached_cfg(char *dir, int *hit) {
+    char path[4096];
+    cfg_cache_path(path, sizeof(path), dir);
+
+    Cfg *cfg = load_cfg_cache(path);
+    *hit = cfg != NULL;
+
+    if(cfg == NULL) {
+        cfg = build_cfg();
+        save_cfg_cache(cfg, path);
+    }
+
+    return cfg;
+}
@@ -0,0 +1,248 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/exec_tree.h"
+#include"../include/cfg.h"
+
+
+// Edges inside a routine, a call continues with the block after it
+static int successors(CfgBlock *block, CfgBlock *out[2]) {
+    int count = 0;
+
+    if(block->exit != CFG_CALL && block->taken != NULL) { out[count++] = block->taken; }
+    if(block->next != NULL && block->next != block->taken) { out[count++] = block->next; }
+
+    return count;
+}
+
+
+// Numbers the blocks reachable from the entries in reverse postorder, index 0 is a
+// virtual root before every entry. Returns the number of indexes used.
+static int number_blocks(Cfg *cfg, CfgBlock **entries, int entry_count, CfgBlock **by_order) {
+    CfgBlock **stack = (CfgBlock **)arena_alloc(&cfg->map->arena, cfg->block_count * sizeof(CfgBlock *));
+    int *child = (int *)arena_alloc(&cfg->map->arena, cfg->block_count * sizeof(int));
+    int post = 0;
+
+    // Postorder first, order is 0 while a block is on the stack
+    for(int e=0; e<entry_count; e++) {
+        int size = 0;
+
+        if(entries[e]->order >= 0) { continue; }
+        entries[e]->order = 0;
+        stack[size] = entries[e];
+        child[size++] = 0;
+
+        while(size > 0) {
+            CfgBlock *block = stack[size - 1];
+            CfgBlock *succ[2];
+            int count = successors(block, succ);
+
+            if(child[size - 1] < count) {
+                CfgBlock *next = succ[child[size - 1]++];
+                if(next->order < 0) {
+                    next->order = 0;
+                    stack[size] = next;
+                    child[size++] = 0;
+                }
+                continue;
+            }
+
+            by_order[++post] = block;
+            size -= 1;
+        }
+    }
+
+    // Reverse it, the virtual root stays at 0
+    for(int i=1, j=post; i<j; i++, j--) {
+        CfgBlock *temp = by_order[i];
+        by_order[i] = by_order[j];
+        by_order[j] = temp;
+    }
+    for(int i=1; i<=post; i++) { by_order[i]->order = i; }
+
+    return post + 1;
+}
+
+
+static int intersect(int *idom, int a, int b) {
+    while(a != b) {
+        while(a > b) { a = idom[a]; }
+        while(b > a) { b = idom[b]; }
+    }
+
+    return a;
+}
+
+
+int cfg_dominates(CfgBlock *a, CfgBlock *b) {
+    for(; b != NULL; b = b->idom) {
+        if(b == a) { return 1; }
+    }
+
+    return 0;
+}
+
+
+/* Dominators with the iterative algorithm of Cooper, Harvey and Kennedy, then the natural
+   loop of every back edge (an edge to a block that dominates its source). The routines,
+   the vectors and the targets of indirect jumps are the entries. Each loop adds one to
+   the depth of the blocks in it.
+*/
+void cfg_find_loops(Cfg *cfg) {
+    int capacity = cfg->block_count + 1;
+    CfgBlock **by_order = (CfgBlock **)arena_alloc(&cfg->map->arena, capacity * sizeof(CfgBlock *));
+    CfgBlock **entries = (CfgBlock **)arena_alloc(&cfg->map->arena, (cfg->routine_count + cfg->target_count) * sizeof(CfgBlock *));
+    int entry_count = 0;
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        CfgBlock *block = cfg->block_at[addr];
+        if(block == NULL) { continue; }
+
+        block->order = -1;
+        block->idom = NULL;
+        block->depth = 0;
+        block->header = 0;
+    }
+
+    for(int r=0; r<cfg->routine_count; r++) {
+        if(cfg->block_at[cfg->routines[r].entry] != NULL) { entries[entry_count++] = cfg->block_at[cfg->routines[r].entry]; }
+    }
+    for(int t=0; t<cfg->target_count; t++) {
+        if(cfg->block_at[cfg->targets[t].target] != NULL) { entries[entry_count++] = cfg->block_at[cfg->targets[t].target]; }
+    }
+
+    int count = number_blocks(cfg, entries, entry_count, by_order);
+
+    // Predecessors by order, the entries also follow the virtual root
+    int *pred_start = (int *)arena_alloc(&cfg->map->arena, (count + 1) * sizeof(int));
+    int edges = 0;
+
+    memset(pred_start, 0, (count + 1) * sizeof(int));
+    for(int i=1; i<count; i++) {
+        CfgBlock *succ[2];
+        int n = successors(by_order[i], succ);
+        for(int s=0; s<n; s++) { pred_start[succ[s]->order + 1] += 1; }
+    }
+    for(int e=0; e<entry_count; e++) { pred_start[entries[e]->order + 1] += 1; }
+    for(int i=0; i<count; i++) { pred_start[i + 1] += pred_start[i]; }
+    edges = pred_start[count];
+
+    int *preds = (int *)arena_alloc(&cfg->map->arena, (edges + 1) * sizeof(int));
+    int *fill = (int *)arena_alloc(&cfg->map->arena, count * sizeof(int));
+
+    memcpy(fill, pred_start, count * sizeof(int));
+    for(int i=1; i<count; i++) {
+        CfgBlock *succ[2];
+        int n = successors(by_order[i], succ);
+        for(int s=0; s<n; s++) { preds[fill[succ[s]->order]++] = i; }
+    }
+    for(int e=0; e<entry_count; e++) { preds[fill[entries[e]->order]++] = 0; }
+
+    int *idom = (int *)arena_alloc(&cfg->map->arena, count * sizeof(int));
+    int changed = 1;
+
+    for(int i=0; i<count; i++) { idom[i] = -1; }
+    idom[0] = 0;
+
+    while(changed) {
+        changed = 0;
+
+        for(int i=1; i<count; i++) {
+            int dom = -1;
+
+            for(int p=pred_start[i]; p<pred_start[i + 1]; p++) {
+                if(idom[preds[p]] < 0) { continue; }
+                dom = dom < 0 ? preds[p] : intersect(idom, preds[p], dom);
+            }
+
+            if(dom != idom[i]) {
+                idom[i] = dom;
+                changed = 1;
+            }
+        }
+    }
+
+    for(int i=1; i<count; i++) {
+        by_order[i]->idom = idom[i] > 0 ? by_order[idom[i]] : NULL;
+    }
+
+    // Natural loops, the back edges to one header make one loop
+    int *stamp = (int *)arena_alloc(&cfg->map->arena, count * sizeof(int));
+    int *work = (int *)arena_alloc(&cfg->map->arena, count * sizeof(int));
+
+    for(int i=0; i<count; i++) { stamp[i] = 0; }
+    cfg->loop_count = 0;
+    cfg->max_depth = 0;
+
+    for(int h=1; h<count; h++) {
+        CfgBlock *header = by_order[h];
+        int size = 0, back = 0;
+
+        stamp[h] = h;
+        for(int p=pred_start[h]; p<pred_start[h + 1]; p++) {
+            int source = preds[p];
+            if(source == 0 || !cfg_dominates(header, by_order[source])) { continue; }
+
+            back = 1;
+            if(stamp[source] != h) {
+                stamp[source] = h;
+                work[size++] = source;
+            }
+        }
+
+        if(!back) { continue; }
+
+        header->header = 1;
+        header->depth += 1;
+        cfg->loop_count += 1;
+
+        // Everything that reaches a back edge without going through the header
+        while(size > 0) {
+            int i = work[--size];
+
+            by_order[i]->depth += 1;
+            for(int p=pred_start[i]; p<pred_start[i + 1]; p++) {
+                if(preds[p] != 0 && stamp[preds[p]] != h) {
+                    stamp[preds[p]] = h;
+                    work[size++] = preds[p];
+                }
+            }
+        }
+    }
+
+    for(int i=1; i<count; i++) {
+        if(by_order[i]->depth > cfg->max_depth) { cfg->max_depth = by_order[i]->depth; }
+    }
+}
+
+
+static int compare_hotness(const void *a, const void *b) {
+    const CfgBlock *x = *(CfgBlock * const *)a, *y = *(CfgBlock * const *)b;
+
+    if(x->depth != y->depth) { return y->depth - x->depth; }
+    return x->start - y->start;
+}
+
+
+// The blocks of the deepest loops first, up to max of them
+int cfg_hot_blocks(Cfg *cfg, CfgBlock **blocks, int max) {
+    CfgBlock **all = (CfgBlock **)malloc((cfg->block_count + 1) * sizeof(CfgBlock *));
+    int count = 0;
+
+    if(all == NULL) {
+        printf("Error: cannot allocate the hot block list\n");
+        exit(1);
+    }
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        if(cfg->block_at[addr] != NULL) { all[count++] = cfg->block_at[addr]; }
+    }
+
+    qsort(all, count, sizeof(CfgBlock *), compare_hotness);
+    if(count > max) { count = max; }
+    memcpy(blocks, all, count * sizeof(CfgBlock *));
+    free(all);
+
+    return count;
+}
@@ -19,6 +19,5 @@ void show_CPU_stat(char *cpu_state) {
     mvwprintw(CPU_WIN, 3, 1, cpu_state);
     box(CPU_WIN, 0, 0);
     mvwprintw(CPU_WIN, 0, 1, "CPU display");
-    refresh();
-    wrefresh(CPU_WIN);
+    wnoutrefresh(CPU_WIN);
 }
@@ -1,32 +1,86 @@
+#include<time.h>
+
 #include"../include/display.h"
 #include"../include/ram.h"
+#include"../include/bus.h"
 
-
-extern Iterator RAM_iter;
-extern  Iterator RAM_first;
+// The window keeps the bytes it shows and only redraws the cells that changed in the
+// pages the bus marked as written. Changed cells stay highlighted for a few refreshes.
+static int page = 1;
+static byte shown[PAGE_SIZE];
+static byte age[PAGE_SIZE]; // refreshes left with the cell highlighted
+static struct timespec last_refresh;
 
 
-void show_RAM_util(int index, byte val, int **rowptr, int **colptr) {
-    static int col = 1;
-    static int row = 0;
-    
-    col = (index % MAX_MEM_COLS) * 3 + 9;
-    row += (index % MAX_MEM_COLS) == 0;
+static void show_RAM_cell(int offset, byte val) {
+    int index = (page-1)*PAGE_SIZE + offset;
+    int row = offset / MAX_MEM_COLS + 1;
+    int col = (offset % MAX_MEM_COLS) * 3 + 9;
 
-    if(index % MAX_MEM_COLS == 0) {
+    if(offset % MAX_MEM_COLS == 0) {
         mvwprintw(RAM_WIN, row, 1, "0x%04x", index);
     }
+
+    if(age[offset]) { wattron(RAM_WIN, A_REVERSE); }
     mvwprintw(RAM_WIN, row, col, "%02x", val);
+    if(age[offset]) { wattroff(RAM_WIN, A_REVERSE); }
+
+    shown[offset] = val;
+}
+
+
+static void show_RAM_page() {
+    int start = (page-1)*PAGE_SIZE;
+
+    werase(RAM_WIN);
+    box(RAM_WIN, 0, 0);
+    mvwprintw(RAM_WIN, 0, 1, "RAM display");
+
+    for(int i=0; i<PAGE_SIZE; i++) {
+        age[i] = 0;
+        show_RAM_cell(i, mem_read(start + i));
+    }
+
+    // Writes before now are on the screen
+    for(int p=start >> 8; p<=(start + PAGE_SIZE - 1) >> 8 && p<0x100; p++) { bus_take_dirty(p); }
 
-    *colptr = &col;
-    *rowptr = &row;
+    wnoutrefresh(RAM_WIN);
+}
+
+
+// Redraws the cells written since the last refresh and the highlights that expired
+static void show_RAM_damage() {
+    int start = (page-1)*PAGE_SIZE;
+    int drawn = 0;
+
+    for(int i=0; i<PAGE_SIZE; i++) {
+        if(age[i] && --age[i] == 0) {
+            show_RAM_cell(i, shown[i]);
+            drawn += 1;
+        }
+    }
+
+    for(int p=start >> 8; p<=(start + PAGE_SIZE - 1) >> 8 && p<0x100; p++) {
+        if(!bus_take_dirty(p)) { continue; }
+
+        int low = p << 8 > start ? (p << 8) - start : 0;
+        int high = (p + 1) << 8 < start + PAGE_SIZE ? ((p + 1) << 8) - start : PAGE_SIZE;
+
+        for(int i=low; i<high; i++) {
+            byte val = mem_read(start + i);
+            if(val == shown[i]) { continue; }
+
+            age[i] = RAM_HIGHLIGHT_REFRESHES;
+            show_RAM_cell(i, val);
+            drawn += 1;
+        }
+    }
+
+    if(drawn) { wnoutrefresh(RAM_WIN); }
 }
 
 
 void show_RAM(byte move_opt) {
-    static int page = 1;
-    int *rowptr, *colptr;
-    
     if(move_opt == NEXT_PAGE) {
         if(page == MAX_PAGES) { page = 1; }
         else { page +=1; }
@@ -37,20 +91,20 @@ void show_RAM(byte move_opt) {
         else { page -=1; }
     }
 
-    werase(RAM_WIN);
-    box(RAM_WIN, 0, 0);
-    mvwprintw(RAM_WIN, 0, 1, "RAM display");
+    if(move_opt == CURR_PAGE) { show_RAM_damage(); }
+    else { show_RAM_page(); }
+
+    clock_gettime(CLOCK_MONOTONIC, &last_refresh);
+}
 
-    for(int i=(page-1)*PAGE_SIZE; i<page*PAGE_SIZE; i++) {
-        byte val;
-        RAM_iter = mem_read(RAM_iter, i, &val);
-        show_RAM_util(i, val, &rowptr, &colptr);
-    }
 
-    *colptr = 1;
-    *rowptr = 0;
+// Called on every pass of the UI thread, refreshes at most RAM_REFRESH_HZ times a second
+void refresh_RAM() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    wrefresh(RAM_WIN);
+    long elapsed = (now.tv_sec - last_refresh.tv_sec) * 1000000000L + (now.tv_nsec - last_refresh.tv_nsec);
+    if(elapsed >= 1000000000L / RAM_REFRESH_HZ) { show_RAM(CURR_PAGE); }
 }
 
 
@@ -63,6 +117,7 @@ WINDOW *create_win_RAM(int max_rows, int max_cols) {
     wrefresh(win);
 
     RAM_WIN = win;
+    show_RAM_page();
 
     return win;
 }
@@ -15,7 +15,15 @@ WINDOW *create_win_stat(int max_rows, int max_cols) {
 void show_key_press(char key) {
     wmove(STAT_WIN, 0, COLS-4);
     wclrtoeol(STAT_WIN);
-    mvwprintw(STAT_WIN, 0, COLS-3, &key);
-    refresh();
-    wrefresh(STAT_WIN);
+    mvwprintw(STAT_WIN, 0, COLS-3, "%c", key);
+    wnoutrefresh(STAT_WIN);
+}
+
+
+// Left part of the status line, padded up to the key shown by show_key_press so the key stays
+void show_run_stat(char *stat) {
+    int width = COLS - 5;
+
+    mvwprintw(STAT_WIN, 0, 0, " %-*.*s", width, width, stat);
+    wnoutrefresh(STAT_WIN);
 }
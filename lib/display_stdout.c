@@ -1,5 +1,17 @@
+#include<pthread.h>
+#include<stdio.h>
+
 #include"../include/display.h"
 
+
+int trace_opcodes = 1;
+
+// Messages wait here until the UI thread draws them, any thread can print
+static char log_lines[UI_LOG_LINES][UI_LOG_LEN];
+static int log_head = 0, log_count = 0;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 WINDOW *create_win_stdout(int max_rows, int max_cols) {
     WINDOW *win = newwin(
             (max_rows - max_rows/4) - 1, 
@@ -19,20 +31,52 @@ WINDOW *create_win_stdout(int max_rows, int max_cols) {
 }
 
 
+// The oldest message is dropped when the UI falls behind
+static void queue_line(char *line) {
+    pthread_mutex_lock(&log_lock);
+    if(log_count == UI_LOG_LINES) {
+        log_head = (log_head + 1) % UI_LOG_LINES;
+        log_count -= 1;
+    }
+    snprintf(log_lines[(log_head + log_count) % UI_LOG_LINES], UI_LOG_LEN, "%s", line);
+    log_count += 1;
+    pthread_mutex_unlock(&log_lock);
+}
+
+
+// Both print functions are no-ops when running without the ncurses front end,
+// the opcode trace is also turned off while running in real time
 void displ_print(char *msg) {
-    wprintw(STDOUT_WIN, " ");
-    wprintw(STDOUT_WIN, msg);
-    box(STDOUT_WIN, 0, 0);
-    refresh();
-    wrefresh(STDOUT_WIN);
+    if(STDOUT_WIN == NULL) { return; }
+
+    queue_line(msg);
 }
 
 
 void displ_print_opcode(char *msg, byte fmt) {
-    wprintw(STDOUT_WIN, " ");
-    wprintw(STDOUT_WIN, msg, fmt);
-    box(STDOUT_WIN, 0, 0);
-    refresh();
-    wrefresh(STDOUT_WIN);
+    if(STDOUT_WIN == NULL || !trace_opcodes) { return; }
+
+    char line[UI_LOG_LEN];
+    snprintf(line, sizeof(line), msg, fmt);
+    queue_line(line);
 }
 
+
+// Called by the UI thread, stages the window for the next doupdate
+void displ_flush() {
+    int printed = 0;
+
+    pthread_mutex_lock(&log_lock);
+    while(log_count > 0) {
+        wprintw(STDOUT_WIN, " %s", log_lines[log_head]);
+        log_head = (log_head + 1) % UI_LOG_LINES;
+        log_count -= 1;
+        printed = 1;
+    }
+    pthread_mutex_unlock(&log_lock);
+
+    if(printed) {
+        box(STDOUT_WIN, 0, 0);
+        wnoutrefresh(STDOUT_WIN);
+    }
+}
@@ -0,0 +1,210 @@
+#include<pthread.h>
+#include<stdio.h>
+#include<string.h>
+#include<stdlib.h>
+
+#include"../include/display.h"
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/bus.h"
+
+// The ncurses front end runs on its own thread, no other thread calls ncurses while it
+// runs. The emulator publishes snapshots of the machine and the UI draws the newest one
+// UI_RATE_HZ times a second, so a slow terminal never holds the emulation back.
+// Keys the emulator handles are queued for it.
+
+typedef struct {
+    CPU cpu;
+    byte ram[MAX_ADDR + 1];
+    byte dirty[0x100 / 8]; // pages written since the snapshot the UI last drew
+} UiSnapshot;
+
+// Shared by the two threads, everything below is guarded by lock
+static UiSnapshot snapshots[2];
+static int front = 0; // the newest snapshot, the emulator fills the other one
+static int consumed = 1; // the UI copied the front snapshot
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t key_ready = PTHREAD_COND_INITIALIZER;
+static int keys[UI_MAX_KEYS];
+static int key_head = 0, key_count = 0;
+static char run_stat[128];
+static int stat_changed = 0;
+static int running = 0;
+static unsigned long draws = 0;
+
+static pthread_t thread;
+
+
+// Called by the emulator, the snapshot is copied without holding the lock
+void ui_publish() {
+    UiSnapshot *back = &snapshots[1 - front];
+
+    back->cpu = mainCPU;
+    memcpy(back->ram, RAM, sizeof(back->ram));
+    memcpy(back->dirty, bus_dirty, sizeof(back->dirty));
+    memset(bus_dirty, 0, sizeof(bus_dirty));
+
+    pthread_mutex_lock(&lock);
+    // Writes in a snapshot the UI skipped still have to be drawn
+    if(!consumed) {
+        for(int i=0; i<sizeof(back->dirty); i++) { back->dirty[i] |= snapshots[front].dirty[i]; }
+    }
+    front = 1 - front;
+    consumed = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+
+void ui_run_stat(char *stat) {
+    pthread_mutex_lock(&lock);
+    snprintf(run_stat, sizeof(run_stat), "%s", stat);
+    stat_changed = 1;
+    pthread_mutex_unlock(&lock);
+}
+
+
+// Next key for the emulator, ERR if there is none and wait is 0
+int ui_key(int wait) {
+    int key = ERR;
+
+    pthread_mutex_lock(&lock);
+    while(wait && key_count == 0 && running) { pthread_cond_wait(&key_ready, &lock); }
+    if(key_count > 0) {
+        key = keys[key_head];
+        key_head = (key_head + 1) % UI_MAX_KEYS;
+        key_count -= 1;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return key;
+}
+
+
+unsigned long ui_draws() {
+    pthread_mutex_lock(&lock);
+    unsigned long count = draws;
+    pthread_mutex_unlock(&lock);
+
+    return count;
+}
+
+
+// Keys typed faster than the emulator takes them are dropped
+static void forward_key(int key) {
+    pthread_mutex_lock(&lock);
+    if(key_count < UI_MAX_KEYS) {
+        keys[(key_head + key_count) % UI_MAX_KEYS] = key;
+        key_count += 1;
+        pthread_cond_signal(&key_ready);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+// The UI thread's own RAM and CPU become the newest snapshot, so the windows read them
+// with mem_read and mainCPU like on the emulation thread
+static int take_snapshot(char *stat) {
+    int taken = 0;
+
+    pthread_mutex_lock(&lock);
+    if(!consumed) {
+        UiSnapshot *snapshot = &snapshots[front];
+
+        mainCPU = snapshot->cpu;
+        memcpy(RAM, snapshot->ram, sizeof(snapshot->ram));
+        for(int i=0; i<sizeof(bus_dirty); i++) { bus_dirty[i] |= snapshot->dirty[i]; }
+        consumed = 1;
+        taken = 1;
+    }
+
+    stat[0] = '\0';
+    if(stat_changed) {
+        strcpy(stat, run_stat);
+        stat_changed = 0;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return taken;
+}
+
+
+static void ui_key_press(int key) {
+    show_key_press(key);
+
+    switch(key) {
+        case 'l':
+            show_RAM(NEXT_PAGE);
+            break;
+        case 'h':
+            show_RAM(PREV_PAGE);
+            break;
+        case 'x':
+            tree_next(TREE_NON_COND);
+            break;
+        case 'c':
+            tree_next(TREE_COND);
+            break;
+        case 'n':
+            tree_follow_pc();
+            forward_key(key);
+            break;
+        default:
+            forward_key(key);
+    }
+}
+
+
+// Every window is staged with wnoutrefresh and the terminal is written once per pass
+static void *ui_thread(void *arg) {
+    char stat[128];
+
+    timeout(1000 / UI_RATE_HZ);
+
+    while(1) {
+        pthread_mutex_lock(&lock);
+        int run = running;
+        pthread_mutex_unlock(&lock);
+        if(!run) { break; }
+
+        int key = getch();
+        if(key != ERR) { ui_key_press(key); }
+
+        if(take_snapshot(stat)) {
+            show_CPU_stat(get_cpu_state());
+            display_tree();
+        }
+        if(stat[0]) { show_run_stat(stat); }
+        refresh_RAM();
+        displ_flush();
+
+        doupdate();
+
+        pthread_mutex_lock(&lock);
+        draws += 1;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+
+// The windows must exist, the emulator publishes the first snapshot before
+void ui_start() {
+    running = 1;
+
+    if(pthread_create(&thread, NULL, ui_thread, NULL) != 0) {
+        printf("Error: cannot start the UI thread\n");
+        exit(1);
+    }
+}
+
+
+// Returns once the UI thread stopped drawing, ncurses can be ended afterwards
+void ui_stop() {
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_cond_broadcast(&key_ready);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+}
@@ -1,23 +1,34 @@
+#include<string.h>
+
 #include"../include/display.h"
 #include"../include/exec_tree.h"
 #include"../include/6502c.h"
 
-ExecNode *tree_root = NULL;
+// Instructions are decoded from emulated memory when the window first shows them, so
+// nothing is parsed at startup and ROMs work like flat programs
+static ExecMap *tree_map = NULL;
+static addr16 tree_addr; // instruction at the top of the window
+static int tree_follow = 1; // the top follows the PC until x or c walks away from it
+static ExecNode drawn[3]; // what the window shows, it is only redrawn when that changes
+static addr16 drawn_pc;
+static int drawn_valid = 0;
 
-WINDOW *create_win_tree(int max_rows, int max_cols, char *filename) {
+WINDOW *create_win_tree(int max_rows, int max_cols) {
     WINDOW *win = newwin(
             max_rows/2 - 1,
             max_cols/2,
             max_rows/2,
             0
             );
-    
+
     box(win, 0, 0);
     mvwprintw(win, 0, 1, "Execution tree");
     refresh();
     wrefresh(win);
 
-    tree_root = build_tree(filename);
+    tree_map = create_exec_map();
+    tree_follow = 1;
+    drawn_valid = 0;
 
     TREE_WIN = win;
 
@@ -31,11 +42,11 @@ void display_node(ExecNode *node, int start_y, int start_x) {
         return;
     }
 
-    mvwprintw(TREE_WIN, start_y, start_x, "Index: %d\n", node->index);
+    mvwprintw(TREE_WIN, start_y, start_x, "Index: $%04x%s\n", node->index, node->index == mainCPU.PC ? " <- PC" : "");
     mvwprintw(TREE_WIN, start_y+1, start_x, "Opcode: 0x%02x\n", node->opcode);
-    mvwprintw(TREE_WIN, start_y+2, start_x, "Name: %s\n", node->name);
+    mvwprintw(TREE_WIN, start_y+2, start_x, "Name: %s\n", exec_node_name(node));
     mvwprintw(TREE_WIN, start_y+3, start_x, "Command length: %d\n", node->cmd_len);
-    mvwprintw(TREE_WIN, start_y+4, start_x, "Addressing mode: %s\n", node->addressing_mode_name);
+    mvwprintw(TREE_WIN, start_y+4, start_x, "Addressing mode: %s\n", exec_node_mode_name(node));
 
     int opc_len = node->cmd_len;
     if(opc_len == 2) {
@@ -47,36 +58,81 @@ void display_node(ExecNode *node, int start_y, int start_x) {
 }
 
 
-void display_tree() {
-    werase(TREE_WIN);
-    mvwprintw(TREE_WIN, 0, 1, "Execution tree");
-    display_node(tree_root, 2, 10);
+// Copies what a node shows, NULL is an index no instruction has
+static int remember(ExecNode *node, ExecNode *copy) {
+    ExecNode shown;
 
-    if(tree_root != NULL) {
-        display_node(tree_root->yes, 11, 2);
-        display_node(tree_root->no, 11, 30);
+    memset(&shown, 0, sizeof(ExecNode));
+    if(node != NULL) {
+        shown.index = node->index;
+        shown.opcode = node->opcode;
+        shown.cmd_len = node->cmd_len;
+        memcpy(shown.args, node->args, 2);
     }
+    else { shown.cmd_len = -1; }
+
+    int changed = memcmp(&shown, copy, sizeof(ExecNode)) != 0;
+    memcpy(copy, &shown, sizeof(ExecNode));
+
+    return changed;
+}
+
+
+// Decodes the instruction at the top and the two that can follow it, nothing else
+void display_tree() {
+    if(tree_map == NULL) { return; }
+    if(tree_follow) { tree_addr = mainCPU.PC; }
+
+    ExecNode *root = lazy_exec_node(tree_map, tree_addr);
+    lazy_link_node(tree_map, root);
+
+    int changed = !drawn_valid || drawn_pc != mainCPU.PC;
+    changed |= remember(root, &drawn[0]);
+    changed |= remember(root->yes, &drawn[1]);
+    changed |= remember(root->no, &drawn[2]);
+    if(!changed) { return; }
+    drawn_valid = 1;
+    drawn_pc = mainCPU.PC;
+
+    werase(TREE_WIN);
+    mvwprintw(TREE_WIN, 0, 1, "Execution tree%s", tree_follow ? " (following PC)" : "");
+    display_node(root, 2, 10);
+    display_node(root->yes, 11, 2);
+    display_node(root->no, 11, 30);
 
     mvwprintw(TREE_WIN, 10, 2, "--NON COND-- (x)");
     mvwprintw(TREE_WIN, 10, 30, "--COND-- (c)");
 
     box(TREE_WIN, 0, 0);
-    refresh();
-    wrefresh(TREE_WIN);
+    wnoutrefresh(TREE_WIN);
 }
 
 
 void tree_next(int pos_next) {
-    if(tree_root == NULL) {
+    if(tree_map == NULL) {
         return;
     }
-    if(pos_next == TREE_NON_COND) {
-        tree_root = tree_root->yes;
-    }
-    else if(pos_next == TREE_COND) {
-        tree_root = tree_root->no;
+
+    ExecNode *root = lazy_exec_node(tree_map, tree_addr);
+    lazy_link_node(tree_map, root);
+
+    ExecNode *next = pos_next == TREE_NON_COND ? root->yes : pos_next == TREE_COND ? root->no : NULL;
+    if(next == NULL) {
+        return;
     }
 
+    tree_addr = next->index;
+    tree_follow = 0;
+    drawn_valid = 0;
+
     display_tree();
 }
 
+
+// Moves the top back to the PC, stepping the CPU calls it
+void tree_follow_pc() {
+    if(!tree_follow) { drawn_valid = 0; }
+    tree_follow = 1;
+
+    display_tree();
+}
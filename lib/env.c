@@ -0,0 +1,191 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/env.h"
+#include"../include/snapshot.h"
+#include"../include/bus.h"
+#include"../include/ppu.h"
+#include"../include/input.h"
+
+
+// Makes the machine of an instance the one on the calling worker
+static void make_resident(EnvBatch *batch, int worker, int instance) {
+    int resident = batch->resident[worker];
+
+    if(resident == instance) { return; }
+    if(resident >= 0) { save_state(batch->states[resident]); }
+
+    load_state(batch->states[instance]);
+    batch->resident[worker] = instance;
+}
+
+
+// Advances one instance on its worker, the last frame lands in the caller's observation slot
+static void step_instance(EnvBatch *batch, int worker, int instance) {
+    make_resident(batch, worker, instance);
+
+    ppu_target = batch->observations + (long)instance * ENV_OBS_SIZE;
+    for(int i=0; i<batch->frames; i++) {
+        input_push(0, batch->actions[instance]);
+        input_begin_frame();
+        run_frame();
+    }
+    ppu_target = NULL;
+}
+
+
+// Every worker runs the instances it owns, a slow instance only holds up its own worker
+static void *worker_thread(void *arg) {
+    EnvBatch *batch = (EnvBatch *)arg;
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    int worker = batch->next_worker;
+    batch->next_worker += 1;
+
+    while(1) {
+        while(batch->generation == generation && !batch->stop) {
+            pthread_cond_wait(&batch->job_ready, &batch->lock);
+        }
+        if(batch->stop) { break; }
+        generation = batch->generation;
+
+        pthread_mutex_unlock(&batch->lock);
+        if(batch->sync) {
+            int resident = batch->resident[worker];
+            if(resident >= 0) { save_state(batch->states[resident]); }
+        }
+        else {
+            for(int instance=worker; instance<batch->instances; instance+=batch->threads) {
+                step_instance(batch, worker, instance);
+            }
+        }
+        pthread_mutex_lock(&batch->lock);
+
+        batch->done_workers += 1;
+        if(batch->done_workers == batch->threads) {
+            pthread_cond_signal(&batch->job_done);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+
+// Hands a job to every worker and waits until all of them are done
+static void run_job(EnvBatch *batch) {
+    batch->done_workers = 0;
+    batch->generation += 1;
+    pthread_cond_broadcast(&batch->job_ready);
+
+    while(batch->done_workers < batch->threads) {
+        pthread_cond_wait(&batch->job_done, &batch->lock);
+    }
+}
+
+
+// Loads the ROM once on the calling thread, every instance starts from that state
+EnvBatch *env_create(char *rom, int instances, int threads) {
+    EnvBatch *batch = (EnvBatch *)calloc(1, sizeof(EnvBatch));
+
+    if(threads < 1) { threads = 1; }
+    if(threads > ENV_MAX_THREADS) { threads = ENV_MAX_THREADS; }
+    if(threads > instances) { threads = instances > 0 ? instances : 1; }
+
+    batch->instances = instances;
+    batch->threads = threads;
+    batch->states = (Snapshot **)calloc(instances, sizeof(Snapshot *));
+
+    if(batch->states == NULL) {
+        printf("Error: cannot allocate %d instances\n", instances);
+        exit(1);
+    }
+
+    start_bus_ines(rom);
+    batch->reset_state = create_snapshot();
+    save_state(batch->reset_state);
+
+    for(int i=0; i<instances; i++) {
+        batch->states[i] = create_snapshot();
+        save_state(batch->states[i]);
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->job_ready, NULL);
+    pthread_cond_init(&batch->job_done, NULL);
+
+    for(int i=0; i<threads; i++) {
+        batch->resident[i] = -1;
+    }
+    for(int i=0; i<threads; i++) {
+        pthread_create(&batch->workers[i], NULL, worker_thread, batch);
+    }
+
+    return batch;
+}
+
+
+void env_destroy(EnvBatch *batch) {
+    pthread_mutex_lock(&batch->lock);
+    batch->stop = 1;
+    pthread_cond_broadcast(&batch->job_ready);
+    pthread_mutex_unlock(&batch->lock);
+
+    for(int i=0; i<batch->threads; i++) {
+        pthread_join(batch->workers[i], NULL);
+    }
+
+    for(int i=0; i<batch->instances; i++) {
+        free_snapshot(batch->states[i]);
+    }
+    free_snapshot(batch->reset_state);
+    free(batch->states);
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->job_ready);
+    pthread_cond_destroy(&batch->job_done);
+    free(batch);
+}
+
+
+/* Runs every instance for the given number of frames with its controller 1 held as
+   actions[instance] and waits until all of them are done.
+   observations must hold instances * ENV_OBS_SIZE bytes, every frame of instance i is rendered
+   into its slot so it ends up with the last one. frames must be at least 1.
+*/
+void env_step(EnvBatch *batch, byte *actions, int frames, byte *observations) {
+    pthread_mutex_lock(&batch->lock);
+
+    batch->actions = actions;
+    batch->observations = observations;
+    batch->frames = frames;
+    batch->sync = 0;
+    run_job(batch);
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+
+// Puts an instance back to the reset state, only call between two env_step calls
+void env_reset(EnvBatch *batch, int instance) {
+    int worker = instance % batch->threads;
+
+    memcpy(batch->states[instance], batch->reset_state, snapshot_size());
+    // The resident machine is thrown away, its worker loads the snapshot next time
+    if(batch->resident[worker] == instance) { batch->resident[worker] = -1; }
+}
+
+
+// Makes the current state of an instance the state every instance is reset to
+void env_save_reset_state(EnvBatch *batch, int instance) {
+    if(batch->resident[instance % batch->threads] == instance) {
+        pthread_mutex_lock(&batch->lock);
+        batch->sync = 1;
+        run_job(batch);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    memcpy(batch->reset_state, batch->states[instance], snapshot_size());
+}
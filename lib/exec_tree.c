@@ -2,6 +2,7 @@
 #include<stdlib.h>
 #include"../include/exec_tree.h"
 #include"../include/6502c.h"
+#include"../include/ram.h"
 
 
 void print_tree(ExecNode *tree_root) {
@@ -12,21 +13,13 @@ void print_tree(ExecNode *tree_root) {
 }
 
 
-ExecNode *allocate_exec_node() {
-    static byte args_none[2] = {0, 0};
-
-    ExecNode *node = (ExecNode *)malloc(sizeof(ExecNode));
-    if(node == NULL) {
-        printf("Cannot allocate memory for ExecNode\n");
-        exit(1);
-    }
+ExecNode *allocate_exec_node(ExecMap *map) {
+    ExecNode *node = (ExecNode *)arena_alloc(&map->arena, sizeof(ExecNode));
 
     node->index = 0xffff;
     node->opcode = 0xff;
-    node->name = "Unknown";
-    node->args = args_none;
+    node->args[0] = node->args[1] = 0;
     node->cmd_len = 0;
-    node->addressing_mode_name = "Unknown";
     node->addressing_mode = NULL;
     node->yes = NULL;
     node->no = NULL;
@@ -35,36 +28,88 @@ ExecNode *allocate_exec_node() {
 }
 
 
-ExecNode *get_exec_node(FILE *fp, byte opcode) {
-        static addr16 index = 0x0600;
-
-        char *opc_name = get_opcode_name(opcode);
+ExecNode *get_exec_node(ExecMap *map, FILE *fp, byte opcode, addr16 index) {
         int opc_len = instruction_len(opcode);
+        if(opc_len == 0) { opc_len = 1; } // Unknown opcodes are skipped like in tick()
         byte (*addressing)(byte*, addr16*) = get_opcode_addressing(opcode);
-        char *addressing_name = get_addressing_name(addressing);
-        byte *opc_args = get_opcode_args(fp, opc_len - 1);
-        ExecNode *node = allocate_exec_node();
+        ExecNode *node = allocate_exec_node(map);
 
 
         node->opcode = opcode;
-        node->name = opc_name;
-        node->args = opc_args;
+        get_opcode_args(fp, node->args, opc_len - 1);
         node->cmd_len = opc_len;
-        node->addressing_mode_name = addressing_name;
         node->addressing_mode = addressing;
         node->yes = NULL;
         node->no = NULL;
         node->index = index;
 
-        index += opc_len;
-
         return node;
 }
 
 
-ExecNode *get_jmp_node(ExecNode *jmp_cmd) {
-    ExecNode *node = allocate_exec_node();
-    node->name = "Unknown jump";
+// Fills node with the instruction at addr in emulated memory
+static void decode_from_memory(ExecNode *node, addr16 addr) {
+    byte opcode = mem_read(addr);
+    int len = instruction_len(opcode);
+
+    node->index = addr;
+    node->opcode = opcode;
+    node->cmd_len = len ? len : 1; // Unknown opcodes are skipped like in tick()
+    node->args[0] = len > 1 ? mem_read(addr + 1) : 0;
+    node->args[1] = len > 2 ? mem_read(addr + 2) : 0;
+    node->addressing_mode = get_opcode_addressing(opcode);
+    node->yes = NULL;
+    node->no = NULL;
+}
+
+
+// Decodes the instruction at addr from emulated memory into the map
+ExecNode *decode_exec_node(ExecMap *map, addr16 addr) {
+    ExecNode *node = allocate_exec_node(map);
+
+    decode_from_memory(node, addr);
+    map->at[addr] = node;
+    map->count += 1;
+
+    return node;
+}
+
+
+// The instruction at addr, decoded the first time it is asked for and again when the
+// program overwrote its bytes since
+ExecNode *lazy_exec_node(ExecMap *map, addr16 addr) {
+    ExecNode *node = map->at[addr];
+
+    if(node == NULL) { return decode_exec_node(map, addr); }
+
+    if(mem_read(addr) != node->opcode || (node->cmd_len > 1 && mem_read(addr + 1) != node->args[0])
+            || (node->cmd_len > 2 && mem_read(addr + 2) != node->args[1])) {
+        decode_from_memory(node, addr);
+    }
+
+    return node;
+}
+
+
+// Links the node to the instructions that can follow it, yes is the next one or the target
+// of JMP and JSR, no the target of a branch. Returns and JMP (indirect) are left unlinked.
+void lazy_link_node(ExecMap *map, ExecNode *node) {
+    addr16 next = node->index + node->cmd_len;
+    int kind = is_opcode_jump(node->opcode);
+
+    node->yes = node->no = NULL;
+
+    if(kind == NOT_JUMP_OP || kind == BRANCH_OP) { node->yes = lazy_exec_node(map, next); }
+    if(kind == BRANCH_OP) { node->no = lazy_exec_node(map, next + (sbyte)node->args[0]); }
+    if(node->opcode == 0x4c || node->opcode == 0x20) {
+        node->yes = lazy_exec_node(map, le_to_be(node->args[0], node->args[1]));
+    }
+}
+
+
+ExecNode *get_jmp_node(ExecMap *map, ExecNode *jmp_cmd) {
+    ExecNode *node = allocate_exec_node(map);
+    node->opcode = jmp_cmd->opcode;
 
     if(jmp_cmd->addressing_mode == absolute) {
         addr16 mem_addr = le_to_be(jmp_cmd->args[0], jmp_cmd->args[1]);
@@ -75,42 +120,42 @@ ExecNode *get_jmp_node(ExecNode *jmp_cmd) {
 }
 
 
-ExecNode *get_return_node(ExecNode *return_cmd) {
-    ExecNode *node = allocate_exec_node();
-    node->name = "Unknown return";
+ExecNode *get_return_node(ExecMap *map, ExecNode *return_cmd) {
+    ExecNode *node = allocate_exec_node(map);
+    node->opcode = return_cmd->opcode;
 
     return node;
 }
 
 
-ExecNode *get_branch_node(ExecNodeList *list_root, ExecNode *branch_cmd) {
+ExecNode *get_branch_node(ExecMap *map, ExecNode *branch_cmd) {
     addr16 index = branch_cmd->index + (sbyte)branch_cmd->args[0] + 2;
-    ExecNode *node = find_by_index(list_root, index);
+    ExecNode *node = exec_map_find(map, index);
     return node;
 }
 
 
-ExecNode *build_tree_util(ExecNodeList *list_root, ExecNodeList *curr_cmd, ExecNode *tree_root) {
+ExecNode *build_tree_util(ExecMap *map, ExecNode *curr_cmd, ExecNode *tree_root) {
     if(curr_cmd == NULL) {
         return tree_root;
     } 
 
-    int is_jump = is_opcode_jump(curr_cmd->val->opcode);
+    int is_jump = is_opcode_jump(curr_cmd->opcode);
     
     switch(is_jump) {
         case NOT_JUMP_OP:
-            tree_root->yes = build_tree_util(list_root, curr_cmd->next, curr_cmd->val);
+            tree_root->yes = build_tree_util(map, exec_map_next(map, curr_cmd), curr_cmd);
             break;
         case BRANCH_OP:
-            tree_root->yes = build_tree_util(list_root, curr_cmd->next, curr_cmd->val);
-            tree_root->yes->no = get_branch_node(list_root, curr_cmd->val);
+            tree_root->yes = build_tree_util(map, exec_map_next(map, curr_cmd), curr_cmd);
+            tree_root->yes->no = get_branch_node(map, curr_cmd);
             break;
         case JUMP_OP:
         case SR_JUMP_OP:
-            return get_jmp_node(curr_cmd->val);
+            return get_jmp_node(map, curr_cmd);
             break;
         case RETURN_OP:
-            return get_return_node(curr_cmd->val);
+            return get_return_node(map, curr_cmd);
             break;
         default:
             printf("This should not happen");
@@ -120,34 +165,51 @@ ExecNode *build_tree_util(ExecNodeList *list_root, ExecNodeList *curr_cmd, ExecN
 }
 
 
-byte *get_opcode_args(FILE *fp, int args_len) {
-    byte *buff = (byte *)malloc(sizeof(byte) * args_len);
-    fread(buff, sizeof(byte), args_len, fp);
-
-    return buff;
+// Operands missing at the end of the file read as 0
+void get_opcode_args(FILE *fp, byte args[2], int args_len) {
+    if(args_len > 0) { fread(args, sizeof(byte), args_len, fp); }
 }
 
 
-ExecNode *build_tree(char *filename) {
+// Decodes a flat program loaded at $0600 into its instructions in address order
+ExecMap *build_exec_map(char *filename) {
     FILE *prg = fopen(filename, "rb"); 
-    ExecNodeList *exec_list_root = create_list(NULL);
+    ExecMap *map = create_exec_map();
+    addr16 index = EXEC_PRG_START;
     byte buff[1];
+
+    if(prg == NULL) {
+        printf("Cannot open program %s\n", filename);
+        exit(1);
+    }
     
-    while(!feof(prg)) {
-        fread(buff, sizeof(byte), 1, prg);
-        ExecNode *exec_node = get_exec_node(prg, *buff);
-        list_push(exec_list_root, exec_node);
+    while(fread(buff, sizeof(byte), 1, prg) == 1) {
+        ExecNode *exec_node = get_exec_node(map, prg, *buff, index);
+        exec_map_push(map, exec_node);
+        index += exec_node->cmd_len;
     }
 
     fclose(prg);
 
-    if(exec_list_root->next == NULL) {
+    return map;
+}
+
+
+// Links the decoded instructions into the tree, its nodes live in the map's arena
+ExecNode *link_tree(ExecMap *map) {
+    ExecNode *tree_root = map->at[EXEC_PRG_START];
+
+    if(tree_root == NULL) {
         printf("Progam not loaded\n");
         return NULL;
     }
 
-    ExecNode *tree_root = exec_list_root->next->val;
-    build_tree_util(exec_list_root, exec_list_root->next->next, tree_root);
+    build_tree_util(map, exec_map_next(map, tree_root), tree_root);
 
     return tree_root;
 }
+
+
+ExecNode *build_tree(char *filename) {
+    return link_tree(build_exec_map(filename));
+}
@@ -6,57 +6,127 @@
 
 
 char *get_addressing_name(byte (*addressing)(byte*, addr16*)) {
-    char buff[30] = "";
-
-    if(addressing == immediate) { strcat(buff, "immediate") ; }
-    else if(addressing == implied) { strcat(buff, "implied"); }
-    else if(addressing == zero_page) { strcat(buff, "zero_page"); }
-    else if(addressing == zero_page_x) { strcat(buff, "zero_page_x") ; }
-    else if(addressing == zero_page_y) { strcat(buff, "zero_page_y"); }
-    else if(addressing == absolute) { strcat(buff, "absolute") ; }
-    else if(addressing == abs_x) { strcat(buff, "abs_x"); }
-    else if(addressing == abs_y) {  strcat(buff, "abs_y"); }
-    else if(addressing == indirect) { strcat(buff, "indirect"); }
-    else if(addressing == indirect_x) { strcat(buff, "indirect_x"); }
-    else if(addressing == indirect_y) {  strcat(buff, "indirect_y"); }
-    else if(addressing == relative) {  strcat(buff, "relative"); }
+    if(addressing == immediate) { return "immediate"; }
+    else if(addressing == implied) { return "implied"; }
+    else if(addressing == zero_page) { return "zero_page"; }
+    else if(addressing == zero_page_x) { return "zero_page_x"; }
+    else if(addressing == zero_page_y) { return "zero_page_y"; }
+    else if(addressing == absolute) { return "absolute"; }
+    else if(addressing == abs_x) { return "abs_x"; }
+    else if(addressing == abs_y) { return "abs_y"; }
+    else if(addressing == indirect) { return "indirect"; }
+    else if(addressing == indirect_x) { return "indirect_x"; }
+    else if(addressing == indirect_y) { return "indirect_y"; }
+    else if(addressing == relative) { return "relative"; }
     
-    return strdup(buff);
+    return "";
 }
 
 
-ExecNodeList *create_list(ExecNode *val) {
-    ExecNodeList *list = (ExecNodeList *)malloc(sizeof(ExecNodeList));
-    if(list == NULL) {
-        printf("Cannot allocate memory for ExecNodeList\n");
-        exit(1);
+// Bump allocation from chunks of EXEC_ARENA_CHUNK bytes, larger requests get their own chunk
+void *arena_alloc(ExecArena *arena, size_t size) {
+    ExecArenaChunk *chunk = arena->chunk;
+
+    size = (size + 7) & ~(size_t)7;
+    if(chunk == NULL || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > EXEC_ARENA_CHUNK ? size : EXEC_ARENA_CHUNK;
+
+        chunk = (ExecArenaChunk *)malloc(sizeof(ExecArenaChunk) + chunk_size);
+        if(chunk == NULL) {
+            printf("Cannot allocate memory for ExecArena\n");
+            exit(1);
+        }
+
+        chunk->next = arena->chunk;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        arena->chunk = chunk;
+        arena->chunks += 1;
+        arena->reserved += sizeof(ExecArenaChunk) + chunk_size;
     }
 
-    list->val = val;
-    list->next = NULL;
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocations += 1;
+    arena->used += size;
 
-    return list;
+    return ptr;
 }
 
 
-ExecNodeList *list_push(ExecNodeList *root, ExecNode *val) {
-    ExecNodeList *new_node = create_list(val); 
-    ExecNodeList *last = root;
+void arena_free(ExecArena *arena) {
+    ExecArenaChunk *chunk = arena->chunk;
 
-    while(last->next != NULL) { last = last->next; }
-    last->next = new_node;
+    while(chunk != NULL) {
+        ExecArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
 
-    return root;
+    memset(arena, 0, sizeof(ExecArena));
 }
 
 
-ExecNode *find_by_index(ExecNodeList *list_root, addr16 index) {
-    ExecNodeList *temp;
-    foreach_list(list_root, temp) {
-        if(temp->val->index == index) { return temp->val; }
+ExecMap *create_exec_map() {
+    ExecMap *map = (ExecMap *)calloc(1, sizeof(ExecMap));
+    if(map == NULL) {
+        printf("Cannot allocate memory for ExecMap\n");
+        exit(1);
     }
 
-    return NULL;
+    return map;
+}
+
+
+// Releases the map and every node and placeholder of its tree
+void free_exec_map(ExecMap *map) {
+    arena_free(&map->arena);
+    free(map);
+}
+
+
+void print_exec_map_memory(ExecMap *map) {
+    printf("exec map: %d instructions, %lu allocations in %d chunks, %lu bytes used of %lu, %lu bytes of address index\n",
+            map->count, map->arena.allocations, map->arena.chunks, map->arena.used, map->arena.reserved,
+            (unsigned long)sizeof(map->at));
+}
+
+
+// Adds the next instruction in address order
+void exec_map_push(ExecMap *map, ExecNode *val) {
+    map->at[val->index] = val;
+    map->count += 1;
+}
+
+
+// Instruction starting at index, NULL for data or the middle of an instruction
+ExecNode *exec_map_find(ExecMap *map, addr16 index) {
+    return map->at[index];
+}
+
+
+// Instruction right after node, NULL past the end of the program
+ExecNode *exec_map_next(ExecMap *map, ExecNode *node) {
+    unsigned int next = node->index + node->cmd_len;
+
+    return next < EXEC_MAP_SIZE ? map->at[next] : NULL;
+}
+
+
+// Placeholders are named after the jump or return they stand for
+char *exec_node_name(ExecNode *node) {
+    if(node->cmd_len > 0) { return get_opcode_name(node->opcode); }
+
+    int kind = is_opcode_jump(node->opcode);
+    if(kind == JUMP_OP || kind == SR_JUMP_OP) { return "Unknown jump"; }
+    if(kind == RETURN_OP) { return "Unknown return"; }
+
+    return "Unknown";
+}
+
+
+char *exec_node_mode_name(ExecNode *node) {
+    return node->cmd_len > 0 ? get_addressing_name(node->addressing_mode) : "Unknown";
 }
 
 
@@ -74,9 +144,9 @@ void print_args(byte *args, int opc_len) {
 void print_node(ExecNode *node) {
         printf("Index: %d\n", node->index);
         printf("Opcode: 0x%02x\n", node->opcode);
-        printf("Name: %s\n", node->name);
+        printf("Name: %s\n", exec_node_name(node));
         printf("Command length: %d\n", node->cmd_len);
-        printf("Addressing mode: %s\n", node->addressing_mode_name);
+        printf("Addressing mode: %s\n", exec_node_mode_name(node));
         print_args(node->args, node->cmd_len);
 }
 
@@ -87,9 +157,9 @@ char *get_node_data(ExecNode *node) {
 
     sprintf(buff, "Index: %d\n", node->index);
     sprintf(buff, "Opcode: 0x%02x\n", node->opcode);
-    sprintf(buff, "Name: %s\n", node->name);
+    sprintf(buff, "Name: %s\n", exec_node_name(node));
     sprintf(buff, "Command length: %d\n", node->cmd_len);
-    sprintf(buff, "Addressing mode: %s\n", node->addressing_mode_name);
+    sprintf(buff, "Addressing mode: %s\n", exec_node_mode_name(node));
 
     int opc_len = node->cmd_len;
     if(opc_len == 2) {
@@ -102,11 +172,11 @@ char *get_node_data(ExecNode *node) {
 }
 
 
-void print_exec_list(ExecNodeList *root) {
-    ExecNodeList *temp;
+void print_exec_map(ExecMap *map) {
+    for(int addr=0; addr<EXEC_MAP_SIZE; addr++) {
+        if(map->at[addr] == NULL) { continue; }
 
-    foreach_list(root, temp) {
-        print_node(temp->val);
+        print_node(map->at[addr]);
         printf("#######################################\n");
     }
 }
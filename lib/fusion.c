@@ -0,0 +1,295 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/ppu.h"
+#include"../include/scheduler.h"
+#include"../include/fusion.h"
+#include"../include/cfg.h"
+
+
+// Every addressing mode of an instruction fuses, the handlers get the real opcode.
+// A triple is tried before the pair made of its first two instructions.
+static Fusion fusions[] = {
+    { "DEX;BNE", 2, {DEX, BNE} },
+    { "DEY;BNE", 2, {DEY, BNE} },
+    { "INX;BNE", 2, {INX, BNE} },
+    { "INY;BNE", 2, {INY, BNE} },
+    { "CPX;BNE", 2, {CPX, BNE} },
+    { "CPY;BNE", 2, {CPY, BNE} },
+    { "CMP;BNE", 2, {CMP, BNE} },
+    { "CMP;BEQ", 2, {CMP, BEQ} },
+    { "LDA;STA", 2, {LDA, STA} },
+    { "LDA;BNE", 2, {LDA, BNE} },
+    { "LDA;BEQ", 2, {LDA, BEQ} },
+    { "LDA;BPL", 2, {LDA, BPL} },
+    { "LDA;BMI", 2, {LDA, BMI} },
+    { "STA;STA", 2, {STA, STA} },
+    { "INX;CPX;BNE", 3, {INX, CPX, BNE} },
+    { "INY;CPY;BNE", 3, {INY, CPY, BNE} },
+};
+
+#define FUSION_COUNT ((int)(sizeof(fusions) / sizeof(fusions[0])))
+
+_Thread_local int fusion_enabled = 1;
+_Thread_local FusionMiner *fusion_miner = NULL;
+
+static _Thread_local unsigned long fusion_runs[FUSION_COUNT];
+static _Thread_local unsigned long fusion_instructions[FUSION_COUNT];
+
+// Built once by init_fusion and only read afterwards, so every thread shares them
+static int initialized = 0;
+static byte op_len[256];
+static byte op_cycles[256];
+static void (*op_func[256])(byte, byte*);
+static byte first_fusion[256]; // non zero if a fusion starts with the opcode
+static byte pair_fusion[256][256]; // index + 1 of the pair fusion
+static byte triple_fusion[256][256]; // index + 1 of the triple fusion starting with the pair
+
+
+// Decodes every opcode pair once, called from the thread that starts the bus
+void init_fusion() {
+    if(initialized) { return; }
+
+    for(int op=0; op<256; op++) {
+        op_len[op] = instruction_len(op);
+        op_cycles[op] = instruction_cycles(op);
+        op_func[op] = get_opcode_func(op);
+    }
+
+    for(int f=0; f<FUSION_COUNT; f++) {
+        for(int op1=0; op1<256; op1++) {
+            if(op_func[op1] == NULL || op_func[op1] != fusions[f].funcs[0]) { continue; }
+
+            for(int op2=0; op2<256; op2++) {
+                if(op_func[op2] != fusions[f].funcs[1]) { continue; }
+
+                first_fusion[op1] = 1;
+                if(fusions[f].count == 3) { triple_fusion[op1][op2] = f + 1; }
+                else { pair_fusion[op1][op2] = f + 1; }
+            }
+        }
+    }
+
+    initialized = 1;
+}
+
+
+void fusion_enable(int enabled) {
+    fusion_enabled = enabled;
+}
+
+
+/* Runs the instructions of a fusion one after the other without going back to tick().
+   The next instruction is left to tick() when an event or an NMI is due, when a branch
+   was taken or when the previous instruction overwrote it. tick() reported the first
+   instruction to the control-flow graph, the others are reported here.
+*/
+static int run_sequence(int index, byte *opcodes, addr16 *last) {
+    Fusion *fusion = &fusions[index];
+    int i;
+
+    for(i=0; i<fusion->count; i++) {
+        addr16 pc = mainCPU.PC;
+        int len = op_len[opcodes[i]];
+        byte args[2] = {mem_read(pc + 1), mem_read(pc + 2)};
+
+        if(i > 0 && cfg_runtime != NULL) { cfg_execute(pc); }
+        *last = pc;
+        mainCPU.opcode = opcodes[i];
+        mainCPU.PC += len;
+        fusion->funcs[i](opcodes[i], args);
+        mainCPU.cycles += op_cycles[opcodes[i]];
+
+        if(i + 1 == fusion->count) { break; }
+        if(mainCPU.cycles >= mainScheduler.next || mainPPU.nmi_pending) { break; }
+        if(mainCPU.PC != (addr16)(pc + len) || mem_read(mainCPU.PC) != opcodes[i+1]) { break; }
+    }
+
+    fusion_runs[index] += 1;
+    fusion_instructions[index] += i + 1;
+
+    return i + 1;
+}
+
+
+// Runs the fusion at the PC, returns the number of instructions run, 0 if none matches.
+// last is set to the address of the last instruction run.
+int run_fusion(addr16 *last) {
+    addr16 pc = mainCPU.PC;
+    byte opcodes[FUSION_MAX_LEN];
+
+    opcodes[0] = mem_read(pc);
+    if(!first_fusion[opcodes[0]]) { return 0; }
+
+    pc += op_len[opcodes[0]];
+    opcodes[1] = mem_read(pc);
+
+    int triple = triple_fusion[opcodes[0]][opcodes[1]];
+    if(triple) {
+        opcodes[2] = mem_read(pc + op_len[opcodes[1]]);
+        if(op_func[opcodes[2]] == fusions[triple - 1].funcs[2]) {
+            return run_sequence(triple - 1, opcodes, last);
+        }
+    }
+
+    int pair = pair_fusion[opcodes[0]][opcodes[1]];
+    return pair ? run_sequence(pair - 1, opcodes, last) : 0;
+}
+
+
+void print_fusion_stats() {
+    unsigned long runs = 0, instructions = 0;
+
+    for(int f=0; f<FUSION_COUNT; f++) {
+        runs += fusion_runs[f];
+        instructions += fusion_instructions[f];
+    }
+
+    printf("fusion: %s, %lu instructions in %lu fused dispatches\n",
+            fusion_enabled ? "on" : "off", instructions, runs);
+    for(int f=0; f<FUSION_COUNT; f++) {
+        if(fusion_runs[f]) {
+            printf("    %-12s %10lu runs %10lu instructions\n", fusions[f].name, fusion_runs[f], fusion_instructions[f]);
+        }
+    }
+}
+
+
+// Counts every executed opcode with the one or two before it
+void fusion_mine(byte opcode) {
+    FusionMiner *miner = fusion_miner;
+
+    if(miner->total >= 1) { miner->pairs[miner->last[1]][opcode] += 1; }
+    if(miner->total >= 2) {
+        unsigned int key = miner->last[0] << 16 | miner->last[1] << 8 | opcode;
+        unsigned int slot = (key * 2654435761u) & (FUSION_MINE_TRIPLES - 1);
+
+        // Linear probing, triples that find no free slot are not counted
+        for(int probe=0; probe<FUSION_MINE_TRIPLES; probe++) {
+            unsigned int *stored = &miner->triple_keys[(slot + probe) & (FUSION_MINE_TRIPLES - 1)];
+
+            if(*stored == 0) { *stored = key | 0x01000000; }
+            if(*stored == (key | 0x01000000)) {
+                miner->triple_counts[(slot + probe) & (FUSION_MINE_TRIPLES - 1)] += 1;
+                break;
+            }
+        }
+    }
+
+    miner->last[0] = miner->last[1];
+    miner->last[1] = opcode;
+    miner->total += 1;
+}
+
+
+// Starts counting on the calling thread, tick() records every instruction it runs
+FusionMiner *fusion_mine_start() {
+    FusionMiner *miner = (FusionMiner *)calloc(1, sizeof(FusionMiner));
+
+    if(miner == NULL) {
+        printf("Error: cannot allocate the fusion miner\n");
+        exit(1);
+    }
+
+    fusion_miner = miner;
+    return miner;
+}
+
+
+void fusion_mine_stop() {
+    fusion_miner = NULL;
+}
+
+
+typedef struct {
+    char name[16];
+    int count; // instructions
+    unsigned long seen;
+    int fused;
+} Candidate;
+
+
+static int compare_saved(const void *a, const void *b) {
+    const Candidate *x = a, *y = b;
+    unsigned long saved_x = x->seen * (x->count - 1), saved_y = y->seen * (y->count - 1);
+
+    return saved_x < saved_y ? 1 : saved_x > saved_y ? -1 : 0;
+}
+
+
+// Adds the count of an opcode sequence to its candidate, sequences that only differ in
+// the addressing modes are one candidate like they are one fusion
+static int add_candidate(Candidate *list, int size, byte *opcodes, int count, unsigned long seen) {
+    char name[16] = "";
+
+    for(int i=0; i<count; i++) {
+        if(op_func[opcodes[i]] == NULL) { return size; }
+        if(i) { strcat(name, ";"); }
+        strcat(name, get_opcode_name(opcodes[i]));
+    }
+
+    for(int i=0; i<size; i++) {
+        if(strcmp(list[i].name, name) == 0) {
+            list[i].seen += seen;
+            return size;
+        }
+    }
+
+    strcpy(list[size].name, name);
+    list[size].count = count;
+    list[size].seen = seen;
+    list[size].fused = 0;
+    for(int f=0; f<FUSION_COUNT; f++) {
+        if(strcmp(fusions[f].name, name) == 0) { list[size].fused = 1; }
+    }
+
+    return size + 1;
+}
+
+
+// Prints the sequences that would save the most dispatches if they were fused.
+// Sequences overlap, so the savings of two candidates do not add up.
+void print_fusion_ranking(FusionMiner *miner, int top) {
+    int capacity = 256 * 256 + FUSION_MINE_TRIPLES;
+    Candidate *list = (Candidate *)malloc(capacity * sizeof(Candidate));
+    int size = 0;
+
+    if(list == NULL) {
+        printf("Error: cannot allocate the fusion ranking\n");
+        exit(1);
+    }
+
+    init_fusion();
+
+    for(int op1=0; op1<256; op1++) {
+        for(int op2=0; op2<256; op2++) {
+            if(miner->pairs[op1][op2] == 0) { continue; }
+
+            byte opcodes[2] = {op1, op2};
+            size = add_candidate(list, size, opcodes, 2, miner->pairs[op1][op2]);
+        }
+    }
+
+    for(int slot=0; slot<FUSION_MINE_TRIPLES; slot++) {
+        unsigned int key = miner->triple_keys[slot];
+        if(key == 0) { continue; }
+
+        byte opcodes[3] = {key >> 16, key >> 8, key};
+        size = add_candidate(list, size, opcodes, 3, miner->triple_counts[slot]);
+    }
+
+    qsort(list, size, sizeof(Candidate), compare_saved);
+
+    printf("%lu instructions traced, best fusions by dispatches saved:\n", miner->total);
+    for(int i=0; i<size && i<top; i++) {
+        unsigned long saved = list[i].seen * (list[i].count - 1);
+
+        printf("    %-12s %10lu times, saves %5.1f%% of dispatches%s\n", list[i].name, list[i].seen,
+                miner->total ? saved * 100.0 / miner->total : 0.0, list[i].fused ? " (fused)" : "");
+    }
+
+    free(list);
+}
@@ -0,0 +1,104 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/golden.h"
+
+
+static int parse_hash(char *text, hash64 *hash) {
+    if(strcmp(text, "-") == 0) { return 0; }
+
+    char *end;
+    *hash = strtoull(text, &end, 16);
+
+    return *end == '\0';
+}
+
+
+void load_golden(char *filename, Golden *golden) {
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    int line_num = 0;
+
+    if(file == NULL) {
+        printf("Error: cannot open golden file %s\n", filename);
+        exit(1);
+    }
+
+    memset(golden, 0, sizeof(Golden));
+
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char frame_text[32], frame_hash[32], state_hash[32];
+        line_num += 1;
+
+        if(line[0] == '#' || line[0] == '\n') { continue; }
+
+        if(golden->count == GOLDEN_MAX_CHECKS) {
+            printf("Error: %s has more than %d checks\n", filename, GOLDEN_MAX_CHECKS);
+            exit(1);
+        }
+
+        GoldenCheck *check = golden->checks + golden->count;
+
+        if(sscanf(line, "%31s %31s %31s", frame_text, frame_hash, state_hash) != 3) {
+            printf("Error: %s:%d: expected <frame> <frame hash> <state hash>\n", filename, line_num);
+            exit(1);
+        }
+
+        check->frame = strtoul(frame_text, NULL, 10);
+        check->has_frame = parse_hash(frame_hash, &check->frame_hash);
+        check->has_state = parse_hash(state_hash, &check->state_hash);
+
+        if(golden->count > 0 && check->frame < golden->checks[golden->count - 1].frame) {
+            printf("Error: %s:%d: checks are not in frame order\n", filename, line_num);
+            exit(1);
+        }
+
+        golden->count += 1;
+    }
+
+    fclose(file);
+}
+
+
+unsigned long golden_last_frame(Golden *golden) {
+    return golden->count ? golden->checks[golden->count - 1].frame : 0;
+}
+
+
+// Runs every check listed for this frame, returns the number of mismatches
+int golden_check(Golden *golden, unsigned long frame) {
+    int failures = 0;
+
+    while(golden->next < golden->count && golden->checks[golden->next].frame <= frame) {
+        GoldenCheck *check = golden->checks + golden->next;
+        golden->next += 1;
+
+        if(check->frame != frame) { continue; }
+
+        if(check->has_frame) {
+            hash64 hash = hash_frame();
+            if(hash != check->frame_hash) {
+                printf("frame %lu: framebuffer hash %016llx, expected %016llx\n", frame, hash, check->frame_hash);
+                failures += 1;
+            }
+        }
+
+        if(check->has_state) {
+            hash64 hash = hash_state();
+            if(hash != check->state_hash) {
+                printf("frame %lu: CPU and RAM hash %016llx, expected %016llx\n", frame, hash, check->state_hash);
+                failures += 1;
+            }
+        }
+    }
+
+    golden->failures += failures;
+
+    return failures;
+}
+
+
+void golden_record(FILE *file, unsigned long frame) {
+    fprintf(file, "%lu %016llx %016llx\n", frame, hash_frame(), hash_state());
+}
@@ -0,0 +1,115 @@
+#include<string.h>
+
+#include"../include/hash.h"
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/ppu.h"
+
+#define PRIME1 0x9e3779b185ebca87ULL
+#define PRIME2 0xc2b2ae3d27d4eb4fULL
+#define PRIME3 0x165667b19e3779f9ULL
+#define PRIME4 0x85ebca77c2b2ae63ULL
+#define PRIME5 0x27d4eb2f165667c5ULL
+
+#define rotl(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+
+// Unaligned little endian loads
+static hash64 read64(const byte *p) {
+    hash64 val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+
+static hash64 read32(const byte *p) {
+    unsigned int val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+
+static hash64 round64(hash64 acc, hash64 input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+
+static hash64 merge_round(hash64 acc, hash64 val) {
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+
+hash64 xxhash64(const void *data, unsigned long len, hash64 seed) {
+    const byte *p = (const byte *)data;
+    const byte *end = p + len;
+    hash64 h;
+
+    if(len >= 32) {
+        hash64 v1 = seed + PRIME1 + PRIME2;
+        hash64 v2 = seed + PRIME2;
+        hash64 v3 = seed;
+        hash64 v4 = seed - PRIME1;
+
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while(p + 32 <= end);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else {
+        h = seed + PRIME5;
+    }
+
+    h += len;
+
+    for(; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+
+    if(p + 4 <= end) {
+        h ^= read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+
+    for(; p < end; p++) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+hash64 hash_frame() {
+    return xxhash64(mainPPU.frame, sizeof(mainPPU.frame), 0);
+}
+
+
+// The registers are packed first so padding in the CPU struct does not end up in the hash
+hash64 hash_state() {
+    byte regs[8] = {
+        mainCPU.A, mainCPU.X, mainCPU.Y, mainCPU.SP,
+        get_lo(mainCPU.PC), get_hi(mainCPU.PC), mainCPU.status, 0
+    };
+
+    return xxhash64(RAM, sizeof(RAM), xxhash64(regs, sizeof(regs), 0));
+}
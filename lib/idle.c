@@ -0,0 +1,155 @@
+#include<stdio.h>
+
+#include"../include/6502c.h"
+#include"../include/ram.h"
+#include"../include/ppu.h"
+#include"../include/scheduler.h"
+#include"../include/idle.h"
+
+
+_Thread_local Idle mainIdle = { .enabled=1 };
+
+
+void init_idle() {
+    mainIdle.head = mainIdle.jump = 0;
+    mainIdle.safe = -1;
+    mainIdle.cycle = 0;
+    mainIdle.skipped_cycles = 0;
+    mainIdle.skips = 0;
+}
+
+
+// Stops watching the loop, the machine state it was taken from is gone
+void idle_forget() {
+    mainIdle.head = mainIdle.jump = 0;
+    mainIdle.safe = -1;
+}
+
+
+void idle_enable(int enabled) {
+    mainIdle.enabled = enabled;
+    mainIdle.safe = -1;
+}
+
+
+// Instructions that only read and set registers from registers and memory. AND and ORA
+// give the same result when repeated, so a pass that starts in the same state always
+// ends in the same state.
+static int is_pure_opcode(byte opcode) {
+    void (*func)(byte, byte*) = get_opcode_func(opcode);
+
+    return func == LDA || func == LDX || func == LDY || func == CMP || func == CPX
+        || func == CPY || func == BIT || func == AND || func == ORA || func == TAX
+        || func == TAY || func == TXA || func == TYA || func == CLC || func == SEC
+        || func == CLV || func == NOP || func == BCC || func == BCS || func == BEQ
+        || func == BMI || func == BNE || func == BPL || func == BVC || func == BVS
+        || func == JMP;
+}
+
+
+// Reading RAM, PPUSTATUS or the cartridge has no effect that a second read would change.
+// Other device registers (PPUDATA, $4015, the controllers) change on every read.
+static int is_plain_read(unsigned int addr) {
+    if(addr < PPU_REG_BEGIN) { return 1; }
+    if(addr <= PPU_REG_END) { return (addr & 0x0007) == 2; }
+    return addr >= 0x4020 && addr <= MAX_ADDR;
+}
+
+
+// X and Y may change inside the loop, so an indexed read can reach any of the 256 bytes
+// from base. None of them may be a device register.
+static int is_plain_range(unsigned int base) {
+    return base + 0xff < PPU_REG_BEGIN || (base >= 0x4020 && base + 0xff <= MAX_ADDR);
+}
+
+
+// Checks the instructions from head to the jump back at jump. Branches must stay in the
+// loop or leave it right after the jump back.
+static int is_idle_loop(addr16 head, addr16 jump) {
+    addr16 pc = head;
+    addr16 exit = jump + instruction_len(mem_read(jump));
+
+    while(pc <= jump) {
+        byte opcode = mem_read(pc);
+        byte args[2] = {mem_read(pc + 1), mem_read(pc + 2)};
+        int len = instruction_len(opcode);
+        byte (*addressing)(byte*, addr16*) = get_opcode_addressing(opcode);
+        unsigned int base = le_to_be(args[0], args[1]);
+
+        if(!is_pure_opcode(opcode)) { return 0; }
+
+        int kind = is_opcode_jump(opcode);
+        if(kind == BRANCH_OP) {
+            addr16 target = pc + len + (sbyte)args[0];
+            if(target < head || target > exit) { return 0; }
+        }
+        else if(kind == JUMP_OP) {
+            if(addressing == indirect || base < head || base > jump) { return 0; }
+        }
+        else if(addressing == absolute) {
+            if(!is_plain_read(base)) { return 0; }
+        }
+        else if(addressing == abs_x || addressing == abs_y) {
+            if(!is_plain_range(base)) { return 0; }
+        }
+        else if(addressing != immediate && addressing != implied && addressing != zero_page
+                && addressing != zero_page_x && addressing != zero_page_y) {
+            return 0;
+        }
+
+        pc += len;
+    }
+
+    return pc == exit;
+}
+
+
+static void watch(addr16 head, addr16 jump) {
+    if(head != mainIdle.head || jump != mainIdle.jump || mainIdle.safe < 0) {
+        mainIdle.head = head;
+        mainIdle.jump = jump;
+        mainIdle.safe = jump - head < IDLE_MAX_BODY && is_idle_loop(head, jump);
+    }
+
+    mainIdle.A = mainCPU.A;
+    mainIdle.X = mainCPU.X;
+    mainIdle.Y = mainCPU.Y;
+    mainIdle.SP = mainCPU.SP;
+    mainIdle.status = mainCPU.status;
+    mainIdle.cycle = mainCPU.cycles;
+    mainIdle.next_event = mainScheduler.next;
+}
+
+
+/* Called by tick() after an instruction at from moved the PC back.
+   The last pass ran undisturbed when no event ran or was scheduled meanwhile: events are
+   the only source of NMI, and every other way back into the loop is a backward jump from
+   somewhere else, which starts watching that one instead.
+*/
+void idle_jump_back(addr16 from) {
+    addr16 head = mainCPU.PC;
+
+    int same_pass = head == mainIdle.head && from == mainIdle.jump
+        && mainIdle.next_event == mainScheduler.next && mainCPU.cycles > mainIdle.cycle;
+
+    if(same_pass && mainIdle.safe == 1 && mainScheduler.next != NO_EVENT
+            && mainCPU.A == mainIdle.A && mainCPU.X == mainIdle.X && mainCPU.Y == mainIdle.Y
+            && mainCPU.SP == mainIdle.SP && mainCPU.status == mainIdle.status) {
+        unsigned long period = mainCPU.cycles - mainIdle.cycle;
+        unsigned long passes = mainScheduler.next > mainCPU.cycles ? (mainScheduler.next - mainCPU.cycles) / period : 0;
+
+        if(passes > 0) {
+            mainCPU.cycles += passes * period;
+            mainIdle.skipped_cycles += passes * period;
+            mainIdle.skips += 1;
+        }
+    }
+
+    watch(head, from);
+}
+
+
+void print_idle_stats() {
+    printf("idle skip: %s, %lu cycles skipped in %lu skips\n",
+            mainIdle.enabled ? "on" : "off", mainIdle.skipped_cycles, mainIdle.skips);
+}
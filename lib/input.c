@@ -0,0 +1,54 @@
+#include<string.h>
+
+#include"../include/input.h"
+
+
+_Thread_local Input mainInput;
+
+
+void init_input() {
+    memset(&mainInput, 0, sizeof(Input));
+}
+
+
+// Queues the new state of a controller, the oldest change is dropped when the queue is full
+void input_push(int port, byte buttons) {
+    if(mainInput.head - mainInput.tail == INPUT_QUEUE_SIZE) { mainInput.tail += 1; }
+
+    InputEvent *event = mainInput.queue + (mainInput.head & (INPUT_QUEUE_SIZE - 1));
+    event->port = port;
+    event->buttons = buttons;
+    mainInput.head += 1;
+}
+
+
+void input_begin_frame() {
+    while(mainInput.tail != mainInput.head) {
+        InputEvent *event = mainInput.queue + (mainInput.tail & (INPUT_QUEUE_SIZE - 1));
+        mainInput.buttons[event->port] = event->buttons;
+        mainInput.tail += 1;
+    }
+}
+
+
+// While the strobe is high the shift register keeps reloading and A is read
+byte input_read(addr16 addr) {
+    int port = addr - INPUT_PORT_1;
+
+    if(mainInput.strobe) { return 0x40 | (mainInput.buttons[port] & 1); }
+
+    byte bit = mainInput.shift[port] & 1;
+    mainInput.shift[port] = 0x80 | (mainInput.shift[port] >> 1); // official controllers return 1 after 8 reads
+
+    return 0x40 | bit; // upper bits are open bus, usually the high byte of $4016
+}
+
+
+void input_write(byte data) {
+    mainInput.strobe = data & 1;
+
+    if(mainInput.strobe) {
+        mainInput.shift[0] = mainInput.buttons[0];
+        mainInput.shift[1] = mainInput.buttons[1];
+    }
+}
@@ -0,0 +1,521 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#include"../include/6502c.h"
+#include"../include/ppu.h"
+#include"../include/lockstep.h"
+
+// Operations with a vector handler. Each one mirrors its handler in 6502c_opcodes.c,
+// flags included, so a lane ends up in the same state whichever path runs it.
+#define LS_NONE 0
+#define LS_LDA 1
+#define LS_LDX 2
+#define LS_LDY 3
+#define LS_STA 4
+#define LS_STX 5
+#define LS_STY 6
+#define LS_ADC 7
+#define LS_AND 8
+#define LS_ORA 9
+#define LS_CMP 10
+#define LS_CPX 11
+#define LS_CPY 12
+#define LS_INC 13
+#define LS_DEC 14
+#define LS_INX 15
+#define LS_INY 16
+#define LS_DEX 17
+#define LS_DEY 18
+#define LS_TAX 19
+#define LS_TAY 20
+#define LS_TXA 21
+#define LS_TYA 22
+#define LS_CLC 23
+#define LS_SEC 24
+#define LS_BPL 25
+#define LS_BMI 26
+#define LS_BNE 27
+#define LS_BEQ 28
+#define LS_BCC 29
+#define LS_BCS 30
+#define LS_JMP 31
+#define LS_NOP 32
+
+#define MODE_IMPLIED 0
+#define MODE_IMM 1
+#define MODE_ZP 2
+#define MODE_ZPX 3
+#define MODE_ZPY 4
+#define MODE_ABS 5
+#define MODE_ABSX 6
+#define MODE_ABSY 7
+
+typedef struct { byte op; byte mode; } VectorOp;
+
+// Indirect modes, the stack and the ZP,Y / ZP,X forms of STX and STY are left to the interpreter
+static const VectorOp vector_ops[256] = {
+    [0xa9] = {LS_LDA, MODE_IMM}, [0xa5] = {LS_LDA, MODE_ZP}, [0xb5] = {LS_LDA, MODE_ZPX},
+    [0xad] = {LS_LDA, MODE_ABS}, [0xbd] = {LS_LDA, MODE_ABSX}, [0xb9] = {LS_LDA, MODE_ABSY},
+    [0xa2] = {LS_LDX, MODE_IMM}, [0xa6] = {LS_LDX, MODE_ZP}, [0xb6] = {LS_LDX, MODE_ZPY},
+    [0xae] = {LS_LDX, MODE_ABS}, [0xbe] = {LS_LDX, MODE_ABSY},
+    [0xa0] = {LS_LDY, MODE_IMM}, [0xa4] = {LS_LDY, MODE_ZP}, [0xb4] = {LS_LDY, MODE_ZPX},
+    [0xac] = {LS_LDY, MODE_ABS}, [0xbc] = {LS_LDY, MODE_ABSX},
+    [0x85] = {LS_STA, MODE_ZP}, [0x95] = {LS_STA, MODE_ZPX}, [0x8d] = {LS_STA, MODE_ABS},
+    [0x9d] = {LS_STA, MODE_ABSX}, [0x99] = {LS_STA, MODE_ABSY},
+    [0x86] = {LS_STX, MODE_ZP}, [0x8e] = {LS_STX, MODE_ABS},
+    [0x84] = {LS_STY, MODE_ZP}, [0x8c] = {LS_STY, MODE_ABS},
+    [0x69] = {LS_ADC, MODE_IMM}, [0x65] = {LS_ADC, MODE_ZP}, [0x75] = {LS_ADC, MODE_ZPX},
+    [0x6d] = {LS_ADC, MODE_ABS}, [0x7d] = {LS_ADC, MODE_ABSX}, [0x79] = {LS_ADC, MODE_ABSY},
+    [0x29] = {LS_AND, MODE_IMM}, [0x25] = {LS_AND, MODE_ZP}, [0x35] = {LS_AND, MODE_ZPX},
+    [0x2d] = {LS_AND, MODE_ABS}, [0x3d] = {LS_AND, MODE_ABSX}, [0x39] = {LS_AND, MODE_ABSY},
+    [0x09] = {LS_ORA, MODE_IMM}, [0x05] = {LS_ORA, MODE_ZP}, [0x15] = {LS_ORA, MODE_ZPX},
+    [0x0d] = {LS_ORA, MODE_ABS}, [0x1d] = {LS_ORA, MODE_ABSX}, [0x19] = {LS_ORA, MODE_ABSY},
+    [0xc9] = {LS_CMP, MODE_IMM}, [0xc5] = {LS_CMP, MODE_ZP}, [0xd5] = {LS_CMP, MODE_ZPX},
+    [0xcd] = {LS_CMP, MODE_ABS}, [0xdd] = {LS_CMP, MODE_ABSX}, [0xd9] = {LS_CMP, MODE_ABSY},
+    [0xe0] = {LS_CPX, MODE_IMM}, [0xe4] = {LS_CPX, MODE_ZP}, [0xec] = {LS_CPX, MODE_ABS},
+    [0xc0] = {LS_CPY, MODE_IMM}, [0xc4] = {LS_CPY, MODE_ZP}, [0xcc] = {LS_CPY, MODE_ABS},
+    [0xe6] = {LS_INC, MODE_ZP}, [0xf6] = {LS_INC, MODE_ZPX}, [0xee] = {LS_INC, MODE_ABS},
+    [0xfe] = {LS_INC, MODE_ABSX},
+    [0xc6] = {LS_DEC, MODE_ZP}, [0xd6] = {LS_DEC, MODE_ZPX}, [0xce] = {LS_DEC, MODE_ABS},
+    [0xde] = {LS_DEC, MODE_ABSX},
+    [0xe8] = {LS_INX, MODE_IMPLIED}, [0xc8] = {LS_INY, MODE_IMPLIED},
+    [0xca] = {LS_DEX, MODE_IMPLIED}, [0x88] = {LS_DEY, MODE_IMPLIED},
+    [0xaa] = {LS_TAX, MODE_IMPLIED}, [0xa8] = {LS_TAY, MODE_IMPLIED},
+    [0x8a] = {LS_TXA, MODE_IMPLIED}, [0x98] = {LS_TYA, MODE_IMPLIED},
+    [0x18] = {LS_CLC, MODE_IMPLIED}, [0x38] = {LS_SEC, MODE_IMPLIED},
+    [0x10] = {LS_BPL, MODE_IMM}, [0x30] = {LS_BMI, MODE_IMM},
+    [0xd0] = {LS_BNE, MODE_IMM}, [0xf0] = {LS_BEQ, MODE_IMM},
+    [0x90] = {LS_BCC, MODE_IMM}, [0xb0] = {LS_BCS, MODE_IMM},
+    [0x4c] = {LS_JMP, MODE_IMPLIED}, [0xea] = {LS_NOP, MODE_IMPLIED},
+};
+
+
+// 1 when the opcode has a vector handler
+int lockstep_vectorized(byte opcode) {
+    return vector_ops[opcode].op != LS_NONE;
+}
+
+
+static _Thread_local byte *lane_mem;
+
+static byte lane_read(addr16 addr) {
+    return lane_mem[addr];
+}
+
+
+static void lane_write(addr16 addr, byte val) {
+    lane_mem[addr] = val;
+}
+
+
+Lockstep *lockstep_create(int lanes, int kernel) {
+    if(lanes < 1 || lanes > LOCKSTEP_MAX_LANES) {
+        printf("Error: a lockstep core has 1 to %d lanes\n", LOCKSTEP_MAX_LANES);
+        exit(1);
+    }
+
+    Lockstep *ls = (Lockstep *)calloc(1, sizeof(Lockstep));
+    // Padding so a 4 byte gather at the last address of the last lane stays in the buffer
+    byte *memory = (byte *)calloc((long)lanes * LOCKSTEP_MEM_SIZE + 4, 1);
+    if(ls == NULL || memory == NULL) {
+        printf("Error: cannot allocate a lockstep core\n");
+        exit(1);
+    }
+
+    int best = KERNEL_SCALAR;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) { best = KERNEL_AVX2; }
+#endif
+    if(kernel == KERNEL_BEST || kernel > best) { kernel = best; }
+
+    ls->lanes = lanes;
+    ls->kernel = kernel == KERNEL_AVX2 ? KERNEL_AVX2 : KERNEL_SCALAR;
+    ls->memory = memory;
+    lockstep_reset(ls, 0x0000);
+
+    return ls;
+}
+
+
+void lockstep_free(Lockstep *ls) {
+    free(ls->memory);
+    free(ls);
+}
+
+
+byte *lockstep_memory(Lockstep *ls, int lane) {
+    return ls->memory + (long)lane * LOCKSTEP_MEM_SIZE;
+}
+
+
+// Copies the same data into every lane
+void lockstep_load(Lockstep *ls, addr16 addr, byte *data, int len) {
+    for(int lane=0; lane<ls->lanes; lane++) {
+        memcpy(lockstep_memory(ls, lane) + addr, data, len);
+    }
+}
+
+
+void lockstep_reset(Lockstep *ls, addr16 pc) {
+    for(int lane=0; lane<ls->lanes; lane++) {
+        ls->A[lane] = ls->X[lane] = ls->Y[lane] = 0;
+        ls->SP[lane] = STACK_END;
+        ls->PC[lane] = pc;
+        ls->status[lane] = 0;
+        ls->retired[lane] = 0;
+        ls->cycles[lane] = 0;
+    }
+
+    ls->vector_steps = ls->vector_lanes = ls->scalar_steps = 0;
+}
+
+
+static void load_lane(Lockstep *ls, int lane) {
+    lane_mem = lockstep_memory(ls, lane);
+
+    mainCPU.A = ls->A[lane];
+    mainCPU.X = ls->X[lane];
+    mainCPU.Y = ls->Y[lane];
+    mainCPU.SP = ls->SP[lane];
+    mainCPU.PC = ls->PC[lane];
+    mainCPU.status = ls->status[lane];
+    mainCPU.cycles = ls->cycles[lane];
+    mainCPU.readbus = lane_read;
+    mainCPU.writebus = lane_write;
+    mainCPU.pullstack = stack_pull;
+    mainCPU.pushstack = stack_push;
+}
+
+
+static void store_lane(Lockstep *ls, int lane) {
+    ls->A[lane] = mainCPU.A;
+    ls->X[lane] = mainCPU.X;
+    ls->Y[lane] = mainCPU.Y;
+    ls->SP[lane] = mainCPU.SP;
+    ls->PC[lane] = mainCPU.PC;
+    ls->status[lane] = mainCPU.status;
+    ls->cycles[lane] = mainCPU.cycles;
+}
+
+
+// One instruction of the loaded lane, the same steps as tick() without the devices
+static void interpret() {
+    byte opcode = mainCPU.readbus(mainCPU.PC);
+    mainCPU.PC += 1;
+
+    int len = instruction_len(opcode);
+
+    byte args[2] = {0, 0};
+    for(int i=1; i<len; i++) {
+        args[i-1] = mainCPU.readbus(mainCPU.PC);
+        mainCPU.PC += 1;
+    }
+
+    void (*opcode_func)(byte, byte*) = get_opcode_func(opcode);
+    if(opcode_func != NULL) { opcode_func(opcode, args); }
+
+    mainCPU.cycles += instruction_cycles(opcode);
+}
+
+
+// Runs one lane on its own on the interpreter, as if it was the only machine
+void lockstep_run_lane(Lockstep *ls, int lane, int instructions) {
+    CPU saved = mainCPU;
+
+    load_lane(ls, lane);
+    for(int i=0; i<instructions; i++) { interpret(); }
+    store_lane(ls, lane);
+
+    ls->retired[lane] += instructions;
+    ls->scalar_steps += instructions;
+    mainCPU = saved;
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static inline __m256i set_flag(__m256i status, int flag, __m256i cond) {
+    const __m256i bit = _mm256_set1_epi32(1 << flag);
+    return _mm256_or_si256(_mm256_andnot_si256(bit, status), _mm256_and_si256(cond, bit));
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i flag_is_set(__m256i status, int flag) {
+    const __m256i bit = _mm256_set1_epi32(1 << flag);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(status, bit), bit);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i bit7(__m256i val) {
+    const __m256i bit = _mm256_set1_epi32(0x80);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(val, bit), bit);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i is_zero(__m256i val) {
+    return _mm256_cmpeq_epi32(val, _mm256_setzero_si256());
+}
+
+
+/* Runs the instruction at the PC of the lanes in group for all of them at once.
+   Registers are ints, values stay in 0 - 255 except in the intermediate results
+   where the handlers also compute with ints (e.g. X - 1 for DEX).
+   Returns 0 when the instruction has no vector handler.
+*/
+__attribute__((target("avx2")))
+static int step_group_avx2(Lockstep *ls, unsigned int group) {
+    int lead = __builtin_ctz(group);
+    byte *code = lockstep_memory(ls, lead) + ls->PC[lead];
+    byte opcode = code[0];
+    VectorOp vop = vector_ops[opcode];
+
+    if(vop.op == LS_NONE) { return 0; }
+
+    int len = instruction_len(opcode);
+    int cycles = instruction_cycles(opcode);
+    int arg8 = code[1];
+    int arg16 = code[1] | code[2] << 8;
+
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i lane_offset = _mm256_setr_epi32(0, 1 << 16, 2 << 16, 3 << 16, 4 << 16, 5 << 16, 6 << 16, 7 << 16);
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    const __m256i addr_mask = _mm256_set1_epi32(0xffff);
+    const __m256i all = _mm256_set1_epi32(-1);
+    const __m256i none = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+
+    for(int h=0; h<ls->lanes; h+=8) {
+        unsigned int bits = (group >> h) & 0xff;
+        if(!bits) { continue; }
+
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane_bits), lane_bits);
+        __m256i A = _mm256_loadu_si256((__m256i *)(ls->A + h));
+        __m256i X = _mm256_loadu_si256((__m256i *)(ls->X + h));
+        __m256i Y = _mm256_loadu_si256((__m256i *)(ls->Y + h));
+        __m256i P = _mm256_loadu_si256((__m256i *)(ls->status + h));
+        __m256i PC = _mm256_loadu_si256((__m256i *)(ls->PC + h));
+
+        __m256i nA = A, nX = X, nY = Y, nP = P;
+        __m256i nPC = _mm256_and_si256(_mm256_add_epi32(PC, _mm256_set1_epi32(len)), addr_mask);
+        __m256i addr = none, val = none, res;
+        __m256i store = none;
+        int stores = 0;
+
+        switch(vop.mode) {
+            case MODE_IMM: val = _mm256_set1_epi32(arg8); break;
+            case MODE_ZP: addr = _mm256_set1_epi32(arg8); break;
+            case MODE_ZPX: addr = _mm256_and_si256(_mm256_add_epi32(X, _mm256_set1_epi32(arg8)), byte_mask); break;
+            case MODE_ZPY: addr = _mm256_and_si256(_mm256_add_epi32(Y, _mm256_set1_epi32(arg8)), byte_mask); break;
+            case MODE_ABS: addr = _mm256_set1_epi32(arg16); break;
+            case MODE_ABSX: addr = _mm256_and_si256(_mm256_add_epi32(X, _mm256_set1_epi32(arg16)), addr_mask); break;
+            case MODE_ABSY: addr = _mm256_and_si256(_mm256_add_epi32(Y, _mm256_set1_epi32(arg16)), addr_mask); break;
+        }
+
+        // Every lane reads its own memory, plain RAM so reading for a store is harmless
+        if(vop.mode >= MODE_ZP) {
+            __m256i index = _mm256_add_epi32(_mm256_add_epi32(lane_offset, _mm256_set1_epi32(h << 16)), addr);
+            val = _mm256_and_si256(_mm256_i32gather_epi32((const int *)ls->memory, index, 1), byte_mask);
+        }
+
+        switch(vop.op) {
+            case LS_LDA: nA = val; nP = set_flag(nP, ZERO_FLAG, bit7(val)); break;
+            case LS_LDX: nX = val; nP = set_flag(nP, ZERO_FLAG, bit7(val)); break;
+            case LS_LDY: nY = val; nP = set_flag(nP, ZERO_FLAG, bit7(val)); break;
+            case LS_STA: store = A; stores = 1; break;
+            case LS_STX: store = X; stores = 1; break;
+            case LS_STY: store = Y; stores = 1; break;
+            case LS_ADC: {
+                __m256i carry = _mm256_and_si256(_mm256_srli_epi32(P, CARRY_FLAG), one);
+                __m256i temp = _mm256_add_epi32(_mm256_add_epi32(val, A), carry);
+                __m256i sum = _mm256_and_si256(temp, byte_mask);
+                __m256i overflow = _mm256_and_si256(_mm256_xor_si256(val, sum), _mm256_xor_si256(A, sum));
+
+                nP = set_flag(nP, OVERFLOW_FLAG, bit7(overflow));
+                nP = set_flag(nP, CARRY_FLAG, _mm256_cmpgt_epi32(temp, byte_mask));
+                nP = set_flag(nP, ZERO_FLAG, is_zero(sum));
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(sum));
+                nA = sum;
+                break;
+            }
+            case LS_AND:
+                nA = _mm256_and_si256(A, val);
+                nP = set_flag(nP, ZERO_FLAG, bit7(nA));
+                break;
+            case LS_ORA:
+                nA = _mm256_or_si256(A, val);
+                nP = set_flag(nP, ZERO_FLAG, is_zero(nA));
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(nA));
+                break;
+            case LS_CMP: case LS_CPX: case LS_CPY:
+                res = _mm256_sub_epi32(vop.op == LS_CMP ? A : vop.op == LS_CPX ? X : Y, val);
+                nP = set_flag(nP, CARRY_FLAG, all);
+                nP = set_flag(nP, ZERO_FLAG, bit7(res));
+                break;
+            case LS_INC:
+                res = _mm256_add_epi32(val, one);
+                nP = set_flag(nP, ZERO_FLAG, none);
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(res));
+                store = _mm256_and_si256(res, byte_mask);
+                stores = 1;
+                break;
+            case LS_DEC:
+                res = _mm256_sub_epi32(val, one);
+                nP = set_flag(nP, ZERO_FLAG, is_zero(res));
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(res));
+                store = _mm256_and_si256(res, byte_mask);
+                stores = 1;
+                break;
+            case LS_INX: case LS_INY:
+                res = _mm256_add_epi32(vop.op == LS_INX ? X : Y, one);
+                nP = set_flag(nP, ZERO_FLAG, none);
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(res));
+                if(vop.op == LS_INX) { nX = _mm256_and_si256(res, byte_mask); }
+                else { nY = _mm256_and_si256(res, byte_mask); }
+                break;
+            case LS_DEX: case LS_DEY:
+                res = _mm256_sub_epi32(vop.op == LS_DEX ? X : Y, one);
+                nP = set_flag(nP, ZERO_FLAG, is_zero(res));
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(res));
+                if(vop.op == LS_DEX) { nX = _mm256_and_si256(res, byte_mask); }
+                else { nY = _mm256_and_si256(res, byte_mask); }
+                break;
+            case LS_TAX: case LS_TAY: case LS_TXA: case LS_TYA:
+                res = vop.op == LS_TXA ? X : vop.op == LS_TYA ? Y : A;
+                if(vop.op == LS_TAX) { nX = res; }
+                else if(vop.op == LS_TAY) { nY = res; }
+                else { nA = res; }
+                nP = set_flag(nP, ZERO_FLAG, is_zero(res));
+                nP = set_flag(nP, NEGATIVE_FLAG, bit7(res));
+                break;
+            case LS_CLC: nP = set_flag(nP, CARRY_FLAG, none); break;
+            case LS_SEC: nP = set_flag(nP, CARRY_FLAG, all); break;
+            case LS_BPL: case LS_BMI: case LS_BNE: case LS_BEQ: case LS_BCC: case LS_BCS: {
+                int flag = vop.op <= LS_BMI ? NEGATIVE_FLAG : vop.op <= LS_BEQ ? ZERO_FLAG : CARRY_FLAG;
+                int when_set = vop.op == LS_BMI || vop.op == LS_BEQ || vop.op == LS_BCS;
+                __m256i taken = flag_is_set(P, flag);
+                if(!when_set) { taken = _mm256_xor_si256(taken, all); }
+
+                nPC = _mm256_add_epi32(nPC, _mm256_and_si256(taken, _mm256_set1_epi32((sbyte)arg8)));
+                nPC = _mm256_and_si256(nPC, addr_mask);
+                break;
+            }
+            case LS_JMP: nPC = _mm256_set1_epi32(arg16); break;
+            case LS_NOP: break;
+        }
+
+        // AVX2 has no scatter, the stores are done one lane at a time
+        if(stores) {
+            int lane_addr[8], lane_val[8];
+            _mm256_storeu_si256((__m256i *)lane_addr, addr);
+            _mm256_storeu_si256((__m256i *)lane_val, store);
+
+            for(unsigned int b=bits; b; b&=b-1) {
+                int i = __builtin_ctz(b);
+                lockstep_memory(ls, h + i)[lane_addr[i]] = lane_val[i];
+            }
+        }
+
+        _mm256_storeu_si256((__m256i *)(ls->A + h), _mm256_blendv_epi8(A, nA, mask));
+        _mm256_storeu_si256((__m256i *)(ls->X + h), _mm256_blendv_epi8(X, nX, mask));
+        _mm256_storeu_si256((__m256i *)(ls->Y + h), _mm256_blendv_epi8(Y, nY, mask));
+        _mm256_storeu_si256((__m256i *)(ls->status + h), _mm256_blendv_epi8(P, nP, mask));
+        _mm256_storeu_si256((__m256i *)(ls->PC + h), _mm256_blendv_epi8(PC, nPC, mask));
+
+        __m256i retired = _mm256_loadu_si256((__m256i *)(ls->retired + h));
+        _mm256_storeu_si256((__m256i *)(ls->retired + h), _mm256_add_epi32(retired, _mm256_and_si256(mask, one)));
+
+        for(unsigned int b=bits; b; b&=b-1) { ls->cycles[h + __builtin_ctz(b)] += cycles; }
+    }
+
+    ls->vector_steps += 1;
+    ls->vector_lanes += __builtin_popcount(group);
+
+    return 1;
+}
+
+#endif
+
+
+// Drops the lanes whose code at the PC differs from the first lane of the group
+static unsigned int same_code(Lockstep *ls, unsigned int group) {
+    int lead = __builtin_ctz(group);
+    int pc = ls->PC[lead];
+    byte *code = lockstep_memory(ls, lead) + pc;
+    int len = instruction_len(code[0]);
+
+    for(unsigned int b=group & (group - 1); b; b&=b-1) {
+        int lane = __builtin_ctz(b);
+        if(memcmp(lockstep_memory(ls, lane) + pc, code, len) != 0) { group &= ~(1u << lane); }
+    }
+
+    return group;
+}
+
+
+/* Runs every lane for the given number of instructions.
+   The lane with the lowest PC leads and every lane at that PC follows. Lanes that took
+   a forward branch wait for the others at the join, so they line up again there.
+*/
+void lockstep_run(Lockstep *ls, int instructions) {
+    int target[LOCKSTEP_MAX_LANES];
+    CPU saved = mainCPU;
+
+    for(int lane=0; lane<ls->lanes; lane++) { target[lane] = ls->retired[lane] + instructions; }
+
+    while(1) {
+        int lead = -1;
+        for(int lane=0; lane<ls->lanes; lane++) {
+            if(ls->retired[lane] < target[lane] && (lead < 0 || ls->PC[lane] < ls->PC[lead])) {
+                lead = lane;
+            }
+        }
+        if(lead < 0) { break; }
+
+        unsigned int group = 0;
+        for(int lane=0; lane<ls->lanes; lane++) {
+            if(ls->PC[lane] == ls->PC[lead] && ls->retired[lane] < target[lane]) { group |= 1u << lane; }
+        }
+
+#ifdef HAVE_X86_KERNELS
+        // Instructions running over the end of the address space are left to the interpreter
+        if(ls->kernel == KERNEL_AVX2 && (group & (group - 1)) && ls->PC[lead] < 0xfffe) {
+            group = same_code(ls, group);
+            if(step_group_avx2(ls, group)) { continue; }
+        }
+#endif
+
+        for(unsigned int b=group; b; b&=b-1) {
+            int lane = __builtin_ctz(b);
+
+            load_lane(ls, lane);
+            interpret();
+            store_lane(ls, lane);
+
+            ls->retired[lane] += 1;
+            ls->scalar_steps += 1;
+        }
+    }
+
+    mainCPU = saved;
+}
+
+
+void print_lockstep_stats(Lockstep *ls) {
+    unsigned long total = ls->vector_lanes + ls->scalar_steps;
+
+    printf("%d lanes (%s): %lu lane instructions, %.1f%% vectorized, %.1f lanes per vector step\n",
+            ls->lanes, ls->kernel == KERNEL_AVX2 ? "avx2" : "scalar", total,
+            total ? ls->vector_lanes * 100.0 / total : 0.0,
+            ls->vector_steps ? (double)ls->vector_lanes / ls->vector_steps : 0.0);
+}
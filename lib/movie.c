@@ -0,0 +1,127 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include"../include/movie.h"
+#include"../include/input.h"
+
+
+static void write_header(Movie *movie) {
+    byte header[MOVIE_HEADER_SIZE] = {'N', 'E', 'S', 'M', MOVIE_VERSION, movie->ports};
+
+    for(int i=0; i<4; i++) {
+        header[8 + i] = (movie->frames >> (i * 8)) & 0xff;
+    }
+
+    fseek(movie->file, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, movie->file);
+}
+
+
+Movie *movie_record(char *filename) {
+    Movie *movie = (Movie *)calloc(1, sizeof(Movie));
+
+    if(movie == NULL) {
+        printf("Error: cannot allocate the movie\n");
+        exit(1);
+    }
+
+    movie->mode = MOVIE_RECORD;
+    movie->ports = INPUT_PORTS;
+    movie->file = fopen(filename, "wb");
+
+    if(movie->file == NULL) {
+        printf("Error: cannot open movie %s for writing\n", filename);
+        exit(1);
+    }
+
+    write_header(movie);
+
+    return movie;
+}
+
+
+Movie *movie_play(char *filename) {
+    Movie *movie = (Movie *)calloc(1, sizeof(Movie));
+    struct stat info;
+
+    if(movie == NULL) {
+        printf("Error: cannot allocate the movie\n");
+        exit(1);
+    }
+
+    int fd = open(filename, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &info) < 0) {
+        printf("Error: cannot open movie %s\n", filename);
+        exit(1);
+    }
+
+    movie->mode = MOVIE_PLAY;
+    movie->size = info.st_size;
+    movie->data = movie->size ? mmap(NULL, movie->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if(movie->data == MAP_FAILED || movie->size < MOVIE_HEADER_SIZE || memcmp(movie->data, "NESM", 4) != 0) {
+        printf("Error: %s is not an input movie\n", filename);
+        exit(1);
+    }
+
+    if(movie->data[4] != MOVIE_VERSION) {
+        printf("Error: movie version %d is not supported\n", movie->data[4]);
+        exit(1);
+    }
+
+    movie->ports = movie->data[5];
+    for(int i=0; i<4; i++) {
+        movie->frames |= (unsigned long)movie->data[8 + i] << (i * 8);
+    }
+
+    if(movie->ports < 1 || MOVIE_HEADER_SIZE + movie->frames * movie->ports > movie->size) {
+        printf("Error: movie %s is truncated\n", filename);
+        exit(1);
+    }
+
+    madvise(movie->data, movie->size, MADV_SEQUENTIAL);
+
+    return movie;
+}
+
+
+// Stores the controller state the game sees this frame
+void movie_record_frame(Movie *movie) {
+    fwrite(mainInput.buttons, 1, movie->ports, movie->file);
+    movie->frame += 1;
+    movie->frames += 1;
+}
+
+
+// Overrides the controllers with the next frame of the movie, returns 0 when the movie has ended
+int movie_play_frame(Movie *movie) {
+    if(movie->frame >= movie->frames) { return 0; }
+
+    byte *buttons = movie->data + MOVIE_HEADER_SIZE + movie->frame * movie->ports;
+    int ports = movie->ports < INPUT_PORTS ? movie->ports : INPUT_PORTS;
+
+    memcpy(mainInput.buttons, buttons, ports);
+    movie->frame += 1;
+
+    return 1;
+}
+
+
+void movie_close(Movie *movie) {
+    if(movie->mode == MOVIE_RECORD) {
+        write_header(movie);
+        fclose(movie->file);
+    }
+    else {
+        munmap(movie->data, movie->size);
+    }
+
+    free(movie);
+}
@@ -0,0 +1,531 @@
+#include<string.h>
+
+#include"../include/ppu.h"
+#include"../include/scheduler.h"
+
+
+_Thread_local PPU mainPPU;
+_Thread_local byte *ppu_target = NULL;
+
+static void schedule_frame(unsigned long frame_dot);
+
+
+void init_PPU(byte mirroring) {
+    memset(&mainPPU, 0, sizeof(PPU));
+
+    mainPPU.mirroring = mirroring;
+    mainPPU.chr_is_ram = 1;
+
+    schedule_frame(0);
+}
+
+
+void ppu_load_chr(byte *data, int len) {
+    if(len > CHR_SIZE) { len = CHR_SIZE; }
+
+    memcpy(mainPPU.chr, data, len);
+    memset(mainPPU.tile_valid, 0, CHR_TILES);
+    mainPPU.chr_is_ram = 0;
+}
+
+
+static int nametable_index(addr16 addr) {
+    int offset = (addr - 0x2000) & 0x0fff;
+    int table = offset / 0x0400;
+
+    if(mainPPU.mirroring == MIRROR_VERTICAL) { table &= 1; }
+    else { table >>= 1; }
+
+    return table * 0x0400 + (offset & 0x03ff);
+}
+
+
+static int palette_index(addr16 addr) {
+    int index = addr & 0x1f;
+
+    // $3f10/$3f14/$3f18/$3f1c mirror the background entries
+    if((index & 0x13) == 0x10) { index &= ~0x10; }
+
+    return index;
+}
+
+
+byte ppu_read(addr16 addr) {
+    addr &= 0x3fff;
+
+    if(addr < 0x2000) { return mainPPU.chr[addr]; }
+    else if(addr < 0x3f00) { return mainPPU.vram[nametable_index(addr)]; }
+
+    return mainPPU.palette[palette_index(addr)];
+}
+
+
+void ppu_write(addr16 addr, byte data) {
+    addr &= 0x3fff;
+
+    if(addr < 0x2000) {
+        if(!mainPPU.chr_is_ram) { return; }
+
+        mainPPU.chr[addr] = data;
+        mainPPU.tile_valid[addr >> 4] = 0;
+    }
+    else if(addr < 0x3f00) {
+        mainPPU.vram[nametable_index(addr)] = data;
+    }
+    else {
+        mainPPU.palette[palette_index(addr)] = data;
+    }
+}
+
+
+// OAM DMA copies a whole page starting at OAMADDR, wrapping around the end of OAM
+void ppu_oam_dma(byte *page) {
+    int first = 256 - mainPPU.oam_addr;
+
+    memcpy(mainPPU.oam + mainPPU.oam_addr, page, first);
+    memcpy(mainPPU.oam, page + first, mainPPU.oam_addr);
+    mainPPU.predict_dirty = 1;
+}
+
+
+static addr16 vram_increment() {
+    return get_ppu_bit(mainPPU.ctrl, CTRL_INCREMENT) ? 32 : 1;
+}
+
+
+byte ppu_read_register(addr16 addr) {
+    byte val = 0;
+
+    switch(addr & 0x0007) {
+        case 2: // PPUSTATUS
+            val = (mainPPU.status & 0xe0) | (mainPPU.data_buffer & 0x1f);
+            mainPPU.status &= ~(1 << STATUS_VBLANK);
+            mainPPU.w = 0;
+            break;
+        case 4: // OAMDATA
+            val = mainPPU.oam[mainPPU.oam_addr];
+            break;
+        case 7: // PPUDATA
+            if((mainPPU.v & 0x3fff) < 0x3f00) {
+                val = mainPPU.data_buffer;
+                mainPPU.data_buffer = ppu_read(mainPPU.v);
+            }
+            else {
+                val = ppu_read(mainPPU.v);
+                mainPPU.data_buffer = ppu_read(mainPPU.v - 0x1000);
+            }
+            mainPPU.v += vram_increment();
+            break;
+    }
+
+    return val;
+}
+
+
+void ppu_write_register(addr16 addr, byte data) {
+    mainPPU.predict_dirty = 1;
+
+    switch(addr & 0x0007) {
+        case 0: // PPUCTRL
+            if(!get_ppu_bit(mainPPU.ctrl, CTRL_NMI) && get_ppu_bit(data, CTRL_NMI)
+                    && get_ppu_bit(mainPPU.status, STATUS_VBLANK)) {
+                mainPPU.nmi_pending = 1;
+            }
+            mainPPU.ctrl = data;
+            mainPPU.t = (mainPPU.t & 0xf3ff) | ((data & 0x03) << 10);
+            break;
+        case 1: // PPUMASK
+            mainPPU.mask = data;
+            break;
+        case 3: // OAMADDR
+            mainPPU.oam_addr = data;
+            break;
+        case 4: // OAMDATA
+            mainPPU.oam[mainPPU.oam_addr++] = data;
+            break;
+        case 5: // PPUSCROLL
+            if(mainPPU.w == 0) {
+                mainPPU.t = (mainPPU.t & 0xffe0) | (data >> 3);
+                mainPPU.x = data & 0x07;
+                mainPPU.w = 1;
+            }
+            else {
+                mainPPU.t = (mainPPU.t & 0x8c1f) | ((data & 0x07) << 12) | ((data & 0xf8) << 2);
+                mainPPU.w = 0;
+            }
+            break;
+        case 6: // PPUADDR
+            if(mainPPU.w == 0) {
+                mainPPU.t = (mainPPU.t & 0x00ff) | ((data & 0x3f) << 8);
+                mainPPU.w = 1;
+            }
+            else {
+                mainPPU.t = (mainPPU.t & 0xff00) | data;
+                mainPPU.v = mainPPU.t;
+                mainPPU.w = 0;
+            }
+            break;
+        case 7: // PPUDATA
+            ppu_write(mainPPU.v, data);
+            mainPPU.v += vram_increment();
+            break;
+    }
+}
+
+
+static void decode_tile(int tile) {
+    byte *planes = mainPPU.chr + tile * 16;
+
+    for(int row=0; row<8; row++) {
+        byte lo = planes[row];
+        byte hi = planes[row + 8];
+
+        for(int px=0; px<8; px++) {
+            int bit = 7 - px;
+            mainPPU.tile_cache[tile][row][px] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        }
+    }
+
+    mainPPU.tile_valid[tile] = 1;
+}
+
+
+byte *ppu_get_tile_row(int tile, int row) {
+    if(!mainPPU.tile_valid[tile]) { decode_tile(tile); }
+    return mainPPU.tile_cache[tile][row];
+}
+
+
+static int rendering_enabled() {
+    return get_ppu_bit(mainPPU.mask, MASK_BG) || get_ppu_bit(mainPPU.mask, MASK_SPRITE);
+}
+
+
+static void render_background(byte *line_buff) {
+    addr16 v = mainPPU.v;
+    int fine_y = (v >> 12) & 0x07;
+    int table = get_ppu_bit(mainPPU.ctrl, CTRL_BG_TABLE) ? 256 : 0;
+    int x = -mainPPU.x;
+
+    for(int i=0; i<33; i++, x+=8) {
+        int tile = mainPPU.vram[nametable_index(0x2000 | (v & 0x0fff))];
+        addr16 attr_addr = 0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+        byte attr = mainPPU.vram[nametable_index(attr_addr)];
+        int pal = ((attr >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03) << 2;
+        byte *row = ppu_get_tile_row(table + tile, fine_y);
+
+        for(int px=0; px<8; px++) {
+            int sx = x + px;
+            if(sx < 0 || sx >= SCREEN_WIDTH) { continue; }
+            line_buff[sx] = row[px] ? pal | row[px] : 0;
+        }
+
+        // Increment coarse X, wrapping into the horizontal nametable
+        if((v & 0x001f) == 31) {
+            v &= ~0x001f;
+            v ^= 0x0400;
+        }
+        else {
+            v += 1;
+        }
+    }
+}
+
+
+static int sprite_height() {
+    return get_ppu_bit(mainPPU.ctrl, CTRL_SPRITE_SIZE) ? 16 : 8;
+}
+
+
+// Decoded pixels of the given sprite row, before horizontal flipping
+static byte *sprite_tile_row(byte *sprite, int row, int height) {
+    int tile;
+
+    if(sprite[2] & 0x80) { row = height - 1 - row; }
+
+    if(height == 16) {
+        tile = (sprite[1] & 0x01) * 256 + (sprite[1] & 0xfe) + (row >= 8);
+        row &= 0x07;
+    }
+    else {
+        tile = (get_ppu_bit(mainPPU.ctrl, CTRL_SPRITE_TABLE) ? 256 : 0) + sprite[1];
+    }
+
+    return ppu_get_tile_row(tile, row);
+}
+
+
+static void render_sprites(int line, byte *line_buff, byte *behind, byte *zero) {
+    int height = sprite_height();
+    int count = 0;
+
+    for(int i=0; i<64; i++) {
+        byte *sprite = mainPPU.oam + i * 4;
+        int row = line - (sprite[0] + 1);
+
+        if(row < 0 || row >= height) { continue; }
+
+        if(++count > 8) {
+            mainPPU.status |= 1 << STATUS_OVERFLOW;
+            break;
+        }
+
+        byte attr = sprite[2];
+        byte *pixels = sprite_tile_row(sprite, row, height);
+        int pal = 0x10 | ((attr & 0x03) << 2);
+
+        for(int px=0; px<8; px++) {
+            int sx = sprite[3] + px;
+            byte col = (attr & 0x40) ? pixels[7 - px] : pixels[px];
+
+            if(sx >= SCREEN_WIDTH) { break; }
+            if(!col || line_buff[sx]) { continue; } // lower OAM index wins
+
+            line_buff[sx] = pal | col;
+            behind[sx] = attr & 0x20;
+            zero[sx] = i == 0;
+        }
+    }
+}
+
+
+static void increment_y() {
+    if((mainPPU.v & 0x7000) != 0x7000) {
+        mainPPU.v += 0x1000;
+        return;
+    }
+
+    mainPPU.v &= ~0x7000;
+    int coarse_y = (mainPPU.v & 0x03e0) >> 5;
+
+    if(coarse_y == 29) {
+        coarse_y = 0;
+        mainPPU.v ^= 0x0800;
+    }
+    else if(coarse_y == 31) {
+        coarse_y = 0;
+    }
+    else {
+        coarse_y += 1;
+    }
+
+    mainPPU.v = (mainPPU.v & ~0x03e0) | (coarse_y << 5);
+}
+
+
+void ppu_render_scanline(int line) {
+    byte *out = ppu_target ? ppu_target + line * SCREEN_WIDTH : mainPPU.frame[line];
+
+    if(!rendering_enabled()) {
+        memset(out, mainPPU.palette[0] & 0x3f, SCREEN_WIDTH);
+        return;
+    }
+
+    byte bg[SCREEN_WIDTH] = {0};
+    byte spr[SCREEN_WIDTH] = {0};
+    byte behind[SCREEN_WIDTH] = {0};
+    byte zero[SCREEN_WIDTH] = {0};
+
+    int show_bg = get_ppu_bit(mainPPU.mask, MASK_BG);
+    int show_spr = get_ppu_bit(mainPPU.mask, MASK_SPRITE);
+
+    if(show_bg) { render_background(bg); }
+    if(show_spr) { render_sprites(line, spr, behind, zero); }
+
+    if(!get_ppu_bit(mainPPU.mask, MASK_BG_LEFT)) { memset(bg, 0, 8); }
+    if(!get_ppu_bit(mainPPU.mask, MASK_SPRITE_LEFT)) { memset(spr, 0, 8); }
+
+    if(ppu_compose_line(bg, spr, behind, zero, out)) {
+        mainPPU.status |= 1 << STATUS_SPRITE0;
+    }
+
+    // Advance to the next line and reload the horizontal scroll
+    increment_y();
+    mainPPU.v = (mainPPU.v & ~0x041f) | (mainPPU.t & 0x041f);
+}
+
+
+void ppu_render_frame() {
+    if(rendering_enabled()) {
+        mainPPU.v = mainPPU.t;
+    }
+
+    for(int line=0; line<SCREEN_HEIGHT; line++) {
+        ppu_render_scanline(line);
+    }
+
+    mainPPU.frame_count += 1;
+}
+
+
+static void finish_scanline(int line) {
+    if(line < SCREEN_HEIGHT) {
+        ppu_render_scanline(line);
+    }
+    else if(line == PRERENDER_LINE && rendering_enabled()) {
+        // Reload the vertical scroll bits for the next frame
+        mainPPU.v = (mainPPU.v & 0x041f) | (mainPPU.t & ~0x041f);
+    }
+}
+
+
+// Renders every scanline that ended before the given CPU cycle (3 dots per CPU cycle)
+void ppu_catch_up(unsigned long cpu_cycles) {
+    unsigned long target_dot = cpu_cycles * 3;
+
+    while(target_dot >= mainPPU.line_dot + DOTS_PER_LINE) {
+        finish_scanline(mainPPU.scanline);
+        mainPPU.line_dot += DOTS_PER_LINE;
+        mainPPU.scanline = (mainPPU.scanline + 1) % LINES_PER_FRAME;
+
+        if(mainPPU.scanline == 0) { mainPPU.frame_dot = mainPPU.line_dot; }
+    }
+}
+
+
+static unsigned long dot_to_cycle(unsigned long dot) {
+    return (dot + 2) / 3;
+}
+
+
+static void vblank_event(unsigned long cycle) {
+    ppu_catch_up(cycle);
+
+    mainPPU.status |= 1 << STATUS_VBLANK;
+    mainPPU.frame_count += 1;
+    if(get_ppu_bit(mainPPU.ctrl, CTRL_NMI)) { mainPPU.nmi_pending = 1; }
+}
+
+
+static void prerender_event(unsigned long cycle) {
+    ppu_catch_up(cycle);
+
+    mainPPU.status &= ~((1 << STATUS_VBLANK) | (1 << STATUS_SPRITE0) | (1 << STATUS_OVERFLOW));
+
+    schedule_frame(mainPPU.frame_dot + DOTS_PER_LINE * LINES_PER_FRAME);
+    ppu_predict(cycle);
+}
+
+
+static void sprite0_event(unsigned long cycle) {
+    mainPPU.status |= 1 << STATUS_SPRITE0;
+}
+
+
+static void overflow_event(unsigned long cycle) {
+    mainPPU.status |= 1 << STATUS_OVERFLOW;
+}
+
+
+static void schedule_frame(unsigned long frame_dot) {
+    schedule_event(EVENT_VBLANK, dot_to_cycle(frame_dot + VBLANK_LINE * DOTS_PER_LINE + 1), vblank_event);
+    schedule_event(EVENT_PRERENDER, dot_to_cycle(frame_dot + PRERENDER_LINE * DOTS_PER_LINE + 1), prerender_event);
+}
+
+
+// Background color (0 - 3) at pixel x, lines_down lines below the line that starts at v
+static int background_pixel(int x, int lines_down, addr16 v) {
+    int y = ((v >> 5) & 0x1f) * 8 + ((v >> 12) & 0x07) + lines_down;
+    int nt_v = (v >> 11) & 1;
+    int sx = (mainPPU.t & 0x1f) * 8 + mainPPU.x + x;
+    int nt_h = (mainPPU.t >> 10) & 1;
+
+    while(y >= SCREEN_HEIGHT) {
+        y -= SCREEN_HEIGHT;
+        nt_v ^= 1;
+    }
+    if(sx >= SCREEN_WIDTH) {
+        sx -= SCREEN_WIDTH;
+        nt_h ^= 1;
+    }
+
+    addr16 addr = 0x2000 | (nt_v << 11) | (nt_h << 10) | ((y >> 3) << 5) | (sx >> 3);
+    int table = get_ppu_bit(mainPPU.ctrl, CTRL_BG_TABLE) ? 256 : 0;
+
+    return ppu_get_tile_row(table + mainPPU.vram[nametable_index(addr)], y & 0x07)[sx & 0x07];
+}
+
+
+// Frame relative dot of the first sprite 0 hit at or below start_line, -1 if there is none
+static long predict_sprite0(int start_line, addr16 v) {
+    if(!get_ppu_bit(mainPPU.mask, MASK_BG) || !get_ppu_bit(mainPPU.mask, MASK_SPRITE)) { return -1; }
+
+    byte *sprite = mainPPU.oam;
+    int height = sprite_height();
+    int top = sprite[0] + 1;
+    int clip_left = !get_ppu_bit(mainPPU.mask, MASK_BG_LEFT) || !get_ppu_bit(mainPPU.mask, MASK_SPRITE_LEFT);
+
+    for(int line=(top > start_line ? top : start_line); line<top+height && line<SCREEN_HEIGHT; line++) {
+        byte *pixels = sprite_tile_row(sprite, line - top, height);
+
+        for(int px=0; px<8; px++) {
+            int x = sprite[3] + px;
+            byte col = (sprite[2] & 0x40) ? pixels[7 - px] : pixels[px];
+
+            if(x >= SCREEN_WIDTH - 1) { break; }
+            if(!col || (x < 8 && clip_left)) { continue; }
+
+            if(background_pixel(x, line - start_line, v)) {
+                return (long)line * DOTS_PER_LINE + x + 2;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+// Frame relative dot at which more than 8 sprites are found on a line, -1 if never
+static long predict_overflow(int start_line) {
+    byte count[SCREEN_HEIGHT] = {0};
+    int height = sprite_height();
+
+    for(int i=0; i<64; i++) {
+        int top = mainPPU.oam[i * 4] + 1;
+
+        for(int line=top; line<top+height && line<SCREEN_HEIGHT; line++) {
+            if(line < start_line) { continue; }
+
+            // Sprites for a line are evaluated at the end of the line before it
+            if(++count[line] > 8) { return (long)(line - 1) * DOTS_PER_LINE + 256; }
+        }
+    }
+
+    return -1;
+}
+
+
+// Schedules the sprite 0 hit and overflow for the rest of the frame from the current OAM and scroll
+void ppu_predict(unsigned long cpu_cycles) {
+    ppu_catch_up(cpu_cycles);
+
+    mainPPU.predict_dirty = 0;
+    cancel_event(EVENT_SPRITE0);
+    cancel_event(EVENT_OVERFLOW);
+
+    if(!rendering_enabled()) { return; }
+
+    unsigned long frame_dot = mainPPU.frame_dot;
+    int start_line = mainPPU.scanline;
+    addr16 v = mainPPU.v;
+
+    if(start_line >= SCREEN_HEIGHT) {
+        // Past the visible lines, predict the next frame
+        frame_dot += DOTS_PER_LINE * LINES_PER_FRAME;
+        start_line = 0;
+        v = mainPPU.t;
+    }
+
+    long hit = predict_sprite0(start_line, v);
+    if(hit >= 0) { schedule_event(EVENT_SPRITE0, dot_to_cycle(frame_dot + hit), sprite0_event); }
+
+    long overflow = predict_overflow(start_line);
+    if(overflow >= 0) { schedule_event(EVENT_OVERFLOW, dot_to_cycle(frame_dot + overflow), overflow_event); }
+}
+
+
+// Brings $2002 up to date: only predicted events run, no scanline is stepped unless a register changed
+void ppu_sync_status(unsigned long cpu_cycles) {
+    if(mainPPU.predict_dirty) { ppu_predict(cpu_cycles); }
+    run_events(cpu_cycles);
+}
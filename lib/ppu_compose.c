@@ -0,0 +1,218 @@
+#include<string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#include"../include/ppu.h"
+
+
+// 2C02 system palette as RGBA bytes (R in the lowest byte)
+#define RGBA(rgb) (0xff000000 | ((rgb & 0xff) << 16) | (rgb & 0xff00) | ((rgb >> 16) & 0xff))
+
+static const unsigned int nes_rgba[64] = {
+    RGBA(0x666666), RGBA(0x002a88), RGBA(0x1412a7), RGBA(0x3b00a4), RGBA(0x5c007e), RGBA(0x6e0040), RGBA(0x6c0600), RGBA(0x561d00),
+    RGBA(0x333500), RGBA(0x0b4800), RGBA(0x005200), RGBA(0x004f08), RGBA(0x00404d), RGBA(0x000000), RGBA(0x000000), RGBA(0x000000),
+    RGBA(0xadadad), RGBA(0x155fd9), RGBA(0x4240ff), RGBA(0x7527fe), RGBA(0xa01acc), RGBA(0xb71e7b), RGBA(0xb53120), RGBA(0x994e00),
+    RGBA(0x6b6d00), RGBA(0x388700), RGBA(0x0c9300), RGBA(0x008f32), RGBA(0x007c8d), RGBA(0x000000), RGBA(0x000000), RGBA(0x000000),
+    RGBA(0xfffeff), RGBA(0x64b0ff), RGBA(0x9290ff), RGBA(0xc676ff), RGBA(0xf36aff), RGBA(0xfe6ecc), RGBA(0xfe8170), RGBA(0xea9e22),
+    RGBA(0xbcbe00), RGBA(0x88d800), RGBA(0x5ce430), RGBA(0x45e082), RGBA(0x48cdde), RGBA(0x4f4f4f), RGBA(0x000000), RGBA(0x000000),
+    RGBA(0xfffeff), RGBA(0xc0dfff), RGBA(0xd3d2ff), RGBA(0xe8c8ff), RGBA(0xfbc2ff), RGBA(0xfec4ea), RGBA(0xfeccc5), RGBA(0xf7d8a5),
+    RGBA(0xe4e594), RGBA(0xcfef96), RGBA(0xbdf4ab), RGBA(0xb3f3cc), RGBA(0xb5ebf2), RGBA(0xb8b8b8), RGBA(0x000000), RGBA(0x000000),
+};
+
+
+/* Every compose kernel merges one scanline:
+    bg: background pixels (palette << 2 | color), 0 if transparent
+    spr: sprite pixels (0x10 | palette << 2 | color), 0 if transparent
+    behind: non zero where the sprite is behind the background
+    zero: non zero where the pixel comes from sprite 0
+   It writes NES color numbers to out and returns 1 on a sprite 0 hit.
+*/
+static int compose_line_scalar(byte *bg, byte *spr, byte *behind, byte *zero, byte *palette, byte *out) {
+    int hit = 0;
+
+    for(int x=0; x<SCREEN_WIDTH; x++) {
+        byte index = 0;
+        int bg_opaque = bg[x] & 0x03;
+
+        if(spr[x] && bg_opaque) {
+            if(zero[x] && x != 255) { hit = 1; }
+            index = behind[x] ? bg[x] : spr[x];
+        }
+        else if(spr[x]) { index = spr[x]; }
+        else if(bg_opaque) { index = bg[x]; }
+
+        out[x] = palette[index] & 0x3f;
+    }
+
+    return hit;
+}
+
+
+static void frame_to_rgba_scalar(byte *frame, unsigned int *rgba) {
+    for(int i=0; i<SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+        rgba[i] = nes_rgba[frame[i] & 0x3f];
+    }
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static int compose_line_sse2(byte *bg, byte *spr, byte *behind, byte *zero, byte *palette, byte *out) {
+    const __m128i none = _mm_setzero_si128();
+    const __m128i color_bits = _mm_set1_epi8(0x03);
+    byte index[SCREEN_WIDTH];
+    int hit = 0;
+
+    for(int x=0; x<SCREEN_WIDTH; x+=16) {
+        __m128i b = _mm_loadu_si128((__m128i *)(bg + x));
+        __m128i s = _mm_loadu_si128((__m128i *)(spr + x));
+
+        __m128i bg_clear = _mm_cmpeq_epi8(_mm_and_si128(b, color_bits), none);
+        __m128i spr_clear = _mm_cmpeq_epi8(s, none);
+        __m128i in_front = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(behind + x)), none);
+        __m128i not_zero = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(zero + x)), none);
+
+        // Sprite wins where it is opaque and either in front or over a clear background
+        __m128i use_spr = _mm_andnot_si128(spr_clear, _mm_or_si128(bg_clear, in_front));
+        __m128i res = _mm_or_si128(
+                _mm_and_si128(use_spr, s),
+                _mm_andnot_si128(use_spr, _mm_andnot_si128(bg_clear, b))
+                );
+        _mm_storeu_si128((__m128i *)(index + x), res);
+
+        int hits = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(bg_clear, spr_clear), not_zero)) & 0xffff;
+        if(x == SCREEN_WIDTH - 16) { hits &= 0x7fff; } // No hit on x = 255
+        hit |= hits;
+    }
+
+    // SSE2 has no byte shuffle, the palette lookup stays scalar
+    for(int x=0; x<SCREEN_WIDTH; x++) {
+        out[x] = palette[index[x]] & 0x3f;
+    }
+
+    return hit != 0;
+}
+
+
+__attribute__((target("avx2")))
+static int compose_line_avx2(byte *bg, byte *spr, byte *behind, byte *zero, byte *palette, byte *out) {
+    const __m256i none = _mm256_setzero_si256();
+    const __m256i color_bits = _mm256_set1_epi8(0x03);
+    const __m256i sprite_bit = _mm256_set1_epi8(0x10);
+    const __m256i color_mask = _mm256_set1_epi8(0x3f);
+    const __m256i pal_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)palette));
+    const __m256i pal_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)(palette + 16)));
+    int hit = 0;
+
+    for(int x=0; x<SCREEN_WIDTH; x+=32) {
+        __m256i b = _mm256_loadu_si256((__m256i *)(bg + x));
+        __m256i s = _mm256_loadu_si256((__m256i *)(spr + x));
+
+        __m256i bg_clear = _mm256_cmpeq_epi8(_mm256_and_si256(b, color_bits), none);
+        __m256i spr_clear = _mm256_cmpeq_epi8(s, none);
+        __m256i in_front = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(behind + x)), none);
+        __m256i not_zero = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(zero + x)), none);
+
+        __m256i use_spr = _mm256_andnot_si256(spr_clear, _mm256_or_si256(bg_clear, in_front));
+        __m256i res = _mm256_or_si256(
+                _mm256_and_si256(use_spr, s),
+                _mm256_andnot_si256(use_spr, _mm256_andnot_si256(bg_clear, b))
+                );
+
+        // 32 entry palette lookup as two 16 entry shuffles
+        __m256i high_half = _mm256_cmpeq_epi8(_mm256_and_si256(res, sprite_bit), sprite_bit);
+        __m256i color = _mm256_blendv_epi8(
+                _mm256_shuffle_epi8(pal_lo, res),
+                _mm256_shuffle_epi8(pal_hi, res),
+                high_half
+                );
+        _mm256_storeu_si256((__m256i *)(out + x), _mm256_and_si256(color, color_mask));
+
+        unsigned int hits = ~(unsigned int)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_or_si256(bg_clear, spr_clear), not_zero));
+        if(x == SCREEN_WIDTH - 32) { hits &= 0x7fffffff; }
+        hit |= hits != 0;
+    }
+
+    return hit;
+}
+
+
+__attribute__((target("avx2")))
+static void frame_to_rgba_avx2(byte *frame, unsigned int *rgba) {
+    const __m256i color_mask = _mm256_set1_epi32(0x3f);
+
+    for(int i=0; i<SCREEN_WIDTH * SCREEN_HEIGHT; i+=8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(frame + i)));
+        __m256i color = _mm256_i32gather_epi32((const int *)nes_rgba, _mm256_and_si256(index, color_mask), 4);
+        _mm256_storeu_si256((__m256i *)(rgba + i), color);
+    }
+}
+
+#endif
+
+
+// Every thread picks its own kernels, the best ones on first use unless it forced a level
+static _Thread_local int (*compose_line)(byte*, byte*, byte*, byte*, byte*, byte*) = NULL;
+static _Thread_local void (*frame_to_rgba)(byte*, unsigned int*) = NULL;
+
+
+// Picks the kernels for the given level, or the best one the CPU supports, and returns the level used
+int ppu_select_kernels(int level) {
+    int best = KERNEL_SCALAR;
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) { best = KERNEL_SSE2; }
+    if(__builtin_cpu_supports("avx2")) { best = KERNEL_AVX2; }
+#endif
+
+    if(level == KERNEL_BEST || level > best) { level = best; }
+
+    compose_line = compose_line_scalar;
+    frame_to_rgba = frame_to_rgba_scalar;
+
+#ifdef HAVE_X86_KERNELS
+    if(level == KERNEL_SSE2) {
+        compose_line = compose_line_sse2;
+    }
+    else if(level == KERNEL_AVX2) {
+        compose_line = compose_line_avx2;
+        frame_to_rgba = frame_to_rgba_avx2;
+    }
+#endif
+
+    return level;
+}
+
+
+char *ppu_kernel_name(int level) {
+    switch(level) {
+        case KERNEL_SCALAR: return "scalar";
+        case KERNEL_SSE2: return "sse2";
+        case KERNEL_AVX2: return "avx2";
+        default: return "best";
+    }
+}
+
+
+int ppu_compose_line(byte *bg, byte *spr, byte *behind, byte *zero, byte *out) {
+    if(compose_line == NULL) { ppu_select_kernels(KERNEL_BEST); }
+    return compose_line(bg, spr, behind, zero, mainPPU.palette, out);
+}
+
+
+// Converts the frame the PPU renders into, ppu_target when it is set
+void ppu_frame_to_rgba(unsigned int *rgba) {
+    if(frame_to_rgba == NULL) { ppu_select_kernels(KERNEL_BEST); }
+    frame_to_rgba(ppu_target ? ppu_target : &mainPPU.frame[0][0], rgba);
+}
+
+
+unsigned int ppu_color_rgba(byte color) {
+    return nes_rgba[color & 0x3f];
+}
@@ -3,135 +3,29 @@
 
 #include"../include/ram.h"
 
-Register RAM = {
-    0x0000,
-    0x00,
-    NULL,
-    NULL
-};
+_Thread_local byte RAM[MAX_ADDR + 1];
 
-Iterator RAM_iter = &RAM;
-Iterator RAM_stack = &RAM;
-Iterator RAM_instr = &RAM;
-Iterator RAM_first = &RAM;
 
-
-Register *create_register(addr16 address, byte val) {
-    Register *new = (Register *)malloc(sizeof(Register));
-
-    if(new == NULL) { 
-        printf("Error: failed to allocate memory for register\n");
-        exit(1);
-    }
-
-    new->address = address;
-    new->val = val;
-    new->after = NULL; 
-    new->before = NULL;
-
-    return new;
+void mem_write(addr16 address, byte val) {
+    RAM[address] = val;
 }
 
 
-Iterator create_iterator() {
-    return &RAM;
-}
-
-
-Iterator insert_after(Iterator iter, addr16 address, byte val) {
-    Register *new = create_register(address, val);
-
-    if(iter->after == NULL) { 
-        new->before = iter;
-        iter->after = new; 
-
-        return new;
-    }
-
-    new->before = iter;
-    new->after = iter->after;
-
-    iter->after->before = new;
-    iter->after = new;
-
-    return new;
-}
-
-
-Iterator insert_before(Iterator iter, addr16 address, byte val) {
-    Register *new = create_register(address, val);
-
-    if(iter->before == NULL) {
-        new->after = iter;
-        iter->before = new;
-
-        return new;
-    }
-
-    new->after = iter;
-    new->before = iter->before;
-
-    iter->before->after = new;
-    iter->before = new;
-
-    return new;
+byte mem_read(addr16 address) {
+    return RAM[address];
 }
 
 
-Iterator mem_write(Iterator iter, addr16 address, byte val) {
-    if(address > iter->address) { 
-        if(iter->after == NULL || address < iter->after->address) { 
-            return insert_after(iter, address, val);
-        }
-        else {
-            return mem_write(iter->after, address, val);
-        }
-    }
-    else if(address < iter->address) {
-        if(iter->before == NULL || address > iter->before->address) {
-            return insert_before(iter, address, val);
-        }
-        else {
-            return mem_write(iter->before, address, val);
-        }
-    }
-
-    iter->val = val;
-    return iter;
+byte *mem_page(byte page) {
+    return RAM + page * RAM_PAGE_SIZE;
 }
 
 
-Iterator mem_read(Iterator iter, addr16 address, byte *valptr) {
-    if(address > iter->address) { 
-        if(iter->after == NULL || address < iter->after->address) { 
-            *valptr = 0x00; 
-            return iter;
-        }
-        else {
-            return mem_read(iter->after, address, valptr);
-        }
-    }
-    else if(address < iter->address) {
-        if(iter->before == NULL || address > iter->before->address) {
-            *valptr = 0x00; 
-            return iter;
-        }
-        else {
-            return mem_read(iter->before, address, valptr);
+void print_memory() {
+    printf("ADDR \t VAL\n");
+    for(int address=0; address<=MAX_ADDR; address++) {
+        if(RAM[address] != 0) {
+            printf("0x%04x\t0x%02x\n", address, RAM[address]);
         }
     }
-
-    *valptr = iter->val; 
-    return iter;
-}
-
-
-void print_memory(Register *first) {
-    Iterator iter = create_iterator();
-
-    printf("ADDR \t VAL\n");
-    foreach(iter, first) {
-        printf("0x%04x\t0x%02x\n", iter->address, iter->val);
-    } 
 }
-
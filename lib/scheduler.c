@@ -0,0 +1,57 @@
+#include"../include/scheduler.h"
+
+
+_Thread_local Scheduler mainScheduler = {
+    .events={ [0 ... MAX_EVENTS-1] = { .cycle=NO_EVENT, .handler=0 } },
+    .next=NO_EVENT,
+};
+
+
+static void update_next() {
+    mainScheduler.next = NO_EVENT;
+
+    for(int i=0; i<MAX_EVENTS; i++) {
+        if(mainScheduler.events[i].cycle < mainScheduler.next) {
+            mainScheduler.next = mainScheduler.events[i].cycle;
+        }
+    }
+}
+
+
+void clear_events() {
+    for(int i=0; i<MAX_EVENTS; i++) {
+        mainScheduler.events[i].cycle = NO_EVENT;
+        mainScheduler.events[i].handler = 0;
+    }
+
+    mainScheduler.next = NO_EVENT;
+}
+
+
+void schedule_event(int type, unsigned long cycle, void (*handler)(unsigned long)) {
+    mainScheduler.events[type].cycle = cycle;
+    mainScheduler.events[type].handler = handler;
+    update_next();
+}
+
+
+void cancel_event(int type) {
+    mainScheduler.events[type].cycle = NO_EVENT;
+    update_next();
+}
+
+
+// Runs every event due at or before the given cycle, in cycle order
+void run_events(unsigned long cycle) {
+    while(mainScheduler.next <= cycle) {
+        int type = 0;
+
+        for(int i=1; i<MAX_EVENTS; i++) {
+            if(mainScheduler.events[i].cycle < mainScheduler.events[type].cycle) { type = i; }
+        }
+
+        Event event = mainScheduler.events[type];
+        cancel_event(type);
+        event.handler(event.cycle);
+    }
+}
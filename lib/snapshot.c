@@ -0,0 +1,120 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stddef.h>
+#include<time.h>
+
+#include"../include/6502c.h"
+#include"../include/bus.h"
+#include"../include/ram.h"
+#include"../include/ppu.h"
+#include"../include/apu.h"
+#include"../include/scheduler.h"
+#include"../include/input.h"
+#include"../include/idle.h"
+#include"../include/snapshot.h"
+
+// Everything in the APU before the audio log is emulated state
+#define APU_STATE_SIZE offsetof(APU, changes)
+
+struct _snapshot {
+    CPU cpu;
+    byte ram[MAX_ADDR + 1];
+    PPU ppu;
+    byte apu[APU_STATE_SIZE];
+    Scheduler scheduler;
+    Input input;
+};
+
+
+static double now_sec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+Snapshot *create_snapshot() {
+    Snapshot *snap = (Snapshot *)malloc(sizeof(Snapshot));
+
+    if(snap == NULL) {
+        printf("Error: cannot allocate a snapshot\n");
+        exit(1);
+    }
+
+    return snap;
+}
+
+
+void free_snapshot(Snapshot *snap) {
+    free(snap);
+}
+
+
+unsigned long snapshot_size() {
+    return sizeof(Snapshot);
+}
+
+
+void save_state(Snapshot *snap) {
+    snap->cpu = mainCPU;
+    memcpy(snap->ram, RAM, sizeof(RAM));
+    snap->ppu = mainPPU;
+    memcpy(snap->apu, &mainAPU, APU_STATE_SIZE);
+    snap->scheduler = mainScheduler;
+    snap->input = mainInput;
+}
+
+
+void load_state(Snapshot *snap) {
+    mainCPU = snap->cpu;
+    memcpy(RAM, snap->ram, sizeof(RAM));
+    mainPPU = snap->ppu;
+    memcpy(&mainAPU, snap->apu, APU_STATE_SIZE);
+    mainScheduler = snap->scheduler;
+    mainInput = snap->input;
+    idle_forget();
+}
+
+
+// Runs one real frame, then `ahead` more frames whose result is copied to display and thrown away
+void run_frame_ahead(Snapshot *snap, int ahead, byte *display, RunAheadStats *stats) {
+    double start = now_sec();
+    run_frame();
+    double ran = now_sec();
+
+    if(ahead > 0) {
+        save_state(snap);
+        double saved = now_sec();
+
+        // Muting also skips the channel timers, the snapshot brings them back
+        mainAPU.sample_rate = 0;
+        for(int i=0; i<ahead; i++) {
+            run_frame();
+        }
+        memcpy(display, mainPPU.frame, sizeof(mainPPU.frame));
+        double ahead_done = now_sec();
+
+        load_state(snap);
+        double loaded = now_sec();
+
+        stats->save_sec += saved - ran;
+        stats->ahead_sec += ahead_done - saved;
+        stats->load_sec += loaded - ahead_done;
+    }
+    else {
+        memcpy(display, mainPPU.frame, sizeof(mainPPU.frame));
+    }
+
+    stats->frame_sec += ran - start;
+    stats->frames += 1;
+}
+
+
+void print_run_ahead_stats(RunAheadStats *stats) {
+    double frames = stats->frames ? stats->frames : 1;
+
+    printf("run-ahead: %lu frames, per frame %.1f us real frame, %.1f us ahead, %.1f us save, %.1f us load (%lu byte snapshot)\n",
+            stats->frames, stats->frame_sec * 1e6 / frames, stats->ahead_sec * 1e6 / frames,
+            stats->save_sec * 1e6 / frames, stats->load_sec * 1e6 / frames, snapshot_size());
+}
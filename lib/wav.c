@@ -0,0 +1,138 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"../include/wav.h"
+
+
+static void put_le(unsigned char *buf, unsigned long val, int len) {
+    for(int i=0; i<len; i++) {
+        buf[i] = (val >> (i * 8)) & 0xff;
+    }
+}
+
+
+// The sizes are patched in wav_close once the length is known
+static void write_header(WavWriter *wav) {
+    unsigned char header[44];
+    unsigned long data_size = wav->samples_written * sizeof(short);
+
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, 36 + data_size, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4); // fmt chunk size
+    put_le(header + 20, 1, 2); // PCM
+    put_le(header + 22, 1, 2); // mono
+    put_le(header + 24, wav->sample_rate, 4);
+    put_le(header + 28, wav->sample_rate * sizeof(short), 4); // bytes per second
+    put_le(header + 32, sizeof(short), 2); // bytes per frame
+    put_le(header + 34, 16, 2); // bits per sample
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, data_size, 4);
+
+    fseek(wav->file, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, wav->file);
+}
+
+
+// Writes everything between tail and head, the samples are stored as they are in memory (little endian hosts)
+static void *writer_thread(void *arg) {
+    WavWriter *wav = (WavWriter *)arg;
+
+    pthread_mutex_lock(&wav->lock);
+    while(1) {
+        while(wav->head == wav->tail && !wav->done) {
+            pthread_cond_wait(&wav->not_empty, &wav->lock);
+        }
+
+        if(wav->head == wav->tail) { break; }
+
+        // Write up to the end of the ring, the producer does not touch this part until tail moves
+        long start = wav->tail % WAV_RING_SIZE;
+        long count = wav->head - wav->tail;
+        if(start + count > WAV_RING_SIZE) { count = WAV_RING_SIZE - start; }
+
+        pthread_mutex_unlock(&wav->lock);
+        fwrite(wav->ring + start, sizeof(short), count, wav->file);
+        pthread_mutex_lock(&wav->lock);
+
+        wav->tail += count;
+        wav->samples_written += count;
+        pthread_cond_signal(&wav->not_full);
+    }
+    pthread_mutex_unlock(&wav->lock);
+
+    return NULL;
+}
+
+
+WavWriter *wav_open(char *filename, int sample_rate) {
+    WavWriter *wav = (WavWriter *)malloc(sizeof(WavWriter));
+
+    if(wav == NULL) {
+        printf("Error: cannot allocate the WAV writer\n");
+        exit(1);
+    }
+
+    memset(wav, 0, sizeof(WavWriter));
+    wav->sample_rate = sample_rate;
+    wav->file = fopen(filename, "wb");
+
+    if(wav->file == NULL) {
+        printf("Error: cannot open %s for writing\n", filename);
+        exit(1);
+    }
+
+    write_header(wav);
+
+    pthread_mutex_init(&wav->lock, NULL);
+    pthread_cond_init(&wav->not_empty, NULL);
+    pthread_cond_init(&wav->not_full, NULL);
+    pthread_create(&wav->thread, NULL, writer_thread, wav);
+
+    return wav;
+}
+
+
+void wav_write(WavWriter *wav, short *samples, int count) {
+    pthread_mutex_lock(&wav->lock);
+
+    while(count > 0) {
+        while(wav->head - wav->tail == WAV_RING_SIZE) {
+            pthread_cond_wait(&wav->not_full, &wav->lock);
+        }
+
+        long start = wav->head % WAV_RING_SIZE;
+        long space = WAV_RING_SIZE - (wav->head - wav->tail);
+        long chunk = count < space ? count : space;
+        if(start + chunk > WAV_RING_SIZE) { chunk = WAV_RING_SIZE - start; }
+
+        memcpy(wav->ring + start, samples, chunk * sizeof(short));
+        wav->head += chunk;
+        samples += chunk;
+        count -= chunk;
+
+        pthread_cond_signal(&wav->not_empty);
+    }
+
+    pthread_mutex_unlock(&wav->lock);
+}
+
+
+// Waits for the writer thread to drain the ring and finishes the header
+void wav_close(WavWriter *wav) {
+    pthread_mutex_lock(&wav->lock);
+    wav->done = 1;
+    pthread_cond_signal(&wav->not_empty);
+    pthread_mutex_unlock(&wav->lock);
+
+    pthread_join(wav->thread, NULL);
+
+    write_header(wav);
+    fclose(wav->file);
+
+    pthread_mutex_destroy(&wav->lock);
+    pthread_cond_destroy(&wav->not_empty);
+    pthread_cond_destroy(&wav->not_full);
+    free(wav);
+}
@@ -1,9 +1,18 @@
 #include<ncurses.h>
 #include<stdlib.h>
 #include<stdio.h>
+#include<time.h>
 
 #include"./include/bus.h"
 #include"./include/display.h"
+#include"./include/input.h"
+#include"./include/fusion.h"
+
+#define FRAME_RATE 60.0988 // NTSC
+#define FRAME_NS 16639267L // 1e9 / FRAME_RATE
+#define MAX_TURBO 8
+#define MAX_BEHIND 4 // frames late before pacing starts again from now
+#define KEY_HOLD_FRAMES 8 // terminals only report presses, a pressed button is held this long
 
 
 extern WINDOW *STDOUT_WIN;
@@ -15,37 +24,149 @@ extern WINDOW *TREE_WIN;
 WINDOW *ROOT_WIN;
 
 int ROWS, COLS;
-    
 
-void key_press(char key) {
-    show_key_press(key);
 
+long diff_ns(struct timespec *a, struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
+}
+
+
+void add_ns(struct timespec *t, long ns) {
+    t->tv_nsec += ns;
+    while(t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec += 1;
+    }
+}
+
+
+void quit() {
+    ui_stop();
+    delwin(RAM_WIN);
+    endwin();
+    exit(EXIT_SUCCESS);
+}
+
+
+int button_for_key(int key) {
+    switch(key) {
+        case 'w': return BUTTON_UP;
+        case 's': return BUTTON_DOWN;
+        case 'a': return BUTTON_LEFT;
+        case 'd': return BUTTON_RIGHT;
+        case 'k': return BUTTON_A;
+        case 'j': return BUTTON_B;
+        case ' ': return BUTTON_SELECT;
+        case '\n': return BUTTON_START;
+        default: return -1;
+    }
+}
+
+
+// Runs the machine paced to the NTSC frame rate until 'r' is pressed again.
+// Every frame has an absolute deadline so sleeping late never adds up. Every frame is
+// published to the UI thread, which draws the newest one at its own rate.
+void run_realtime() {
+    struct timespec deadline, now, stat_start;
+    int turbo = 1;
+    int held[8] = {0};
+    unsigned long frames = 0, drawn = ui_draws();
+    long jitter_sum = 0, jitter_max = 0, wakeups = 0;
+    char stat[128];
+
+    trace_opcodes = 0;
+    fusion_enable(1);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    stat_start = deadline;
+
+    while(1) {
+        int key;
+        while((key = ui_key(0)) != ERR) {
+            int button = button_for_key(key);
+
+            if(button >= 0) { held[button] = KEY_HOLD_FRAMES; }
+            else if(key == '+' && turbo < MAX_TURBO) { turbo += 1; }
+            else if(key == '-' && turbo > 1) { turbo -= 1; }
+            else if(key == 'q') { quit(); }
+            else if(key == 'r') {
+                trace_opcodes = 1;
+                fusion_enable(0);
+                ui_run_stat("paused");
+                ui_publish();
+                return;
+            }
+        }
+
+        byte buttons = 0;
+        for(int i=0; i<8; i++) {
+            if(held[i] > 0) {
+                buttons |= 1 << i;
+                held[i] -= 1;
+            }
+        }
+        input_push(0, buttons);
+
+        for(int i=0; i<turbo; i++) {
+            input_begin_frame();
+            run_frame();
+            frames += 1;
+        }
+
+        ui_publish();
+        add_ns(&deadline, FRAME_NS);
+
+        // Far behind (e.g. stopped in a debugger), start pacing again from now
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(diff_ns(&now, &deadline) > FRAME_NS * MAX_BEHIND) { deadline = now; }
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long late = diff_ns(&now, &deadline);
+        if(late < 0) { late = 0; }
+        jitter_sum += late;
+        if(late > jitter_max) { jitter_max = late; }
+        wakeups += 1;
+
+        long elapsed = diff_ns(&now, &stat_start);
+        if(elapsed >= 1000000000L) {
+            double secs = elapsed / 1e9;
+            unsigned long draws = ui_draws();
+
+            snprintf(stat, sizeof(stat), "speed %3.0f%%  %4.1f fps drawn  turbo x%d  jitter avg %.2f ms max %.2f ms",
+                    frames / secs / FRAME_RATE * 100, (draws - drawn) / secs, turbo,
+                    jitter_sum / 1e6 / wakeups, jitter_max / 1e6);
+            ui_run_stat(stat);
+
+            frames = 0;
+            drawn = draws;
+            jitter_sum = jitter_max = wakeups = 0;
+            stat_start = now;
+        }
+    }
+}
+
+
+// Keys the UI thread passed on, paging and walking the tree stay on the UI thread
+void key_press(int key) {
     switch(key){
         case 'q':
-            delwin(RAM_WIN);
-            endwin();
-            exit(EXIT_SUCCESS);
-        case 'l':
-            show_RAM(NEXT_PAGE);
-            break;
-        case 'h':
-            show_RAM(PREV_PAGE);
-            break;
+            quit();
         case 'n':
             tick();
-            show_CPU_stat(get_cpu_state());
-            break;
-        case 'x':
-            tree_next(TREE_NON_COND);
+            ui_publish();
             break;
-        case 'c':
-            tree_next(TREE_COND);
+        case 'r':
+            run_realtime();
             break;
     }
 }
 
 
-int main() {
+// ./main runs the test program, ./main rom.nes an iNES ROM
+int main(int argc, char **argv) {
+    char *rom = argc > 1 ? argv[1] : NULL;
+
     newterm(NULL, stderr, stdin);
     ROOT_WIN = stdscr;
     cbreak(); // Stop buffering of typed characters by TTY
@@ -55,25 +176,21 @@ int main() {
     getmaxyx(ROOT_WIN, ROWS, COLS);
     create_win_stdout(ROWS, COLS);
 
-    start_bus("./tests/test1.bin");
+    if(rom != NULL) { start_bus_ines(rom); }
+    else { start_bus("./tests/test1.bin"); }
+    fusion_enable(0); // 'n' steps one instruction, fusion only while running
     
     create_win_RAM(ROWS, COLS);
-    show_RAM(CURR_PAGE);
-
     create_win_stat(ROWS, COLS);
-
     create_win_CPU(ROWS, COLS);
-    show_CPU_stat(get_cpu_state());
-
-    create_win_tree(ROWS, COLS, "./tests/test1.bin");
-    display_tree();
-
+    create_win_tree(ROWS, COLS);
 
+    // From here on only the UI thread calls ncurses
+    ui_publish();
+    ui_start();
 
-    char key;
     while(1) {
-        key = getch();
-        key_press(key);
+        key_press(ui_key(1));
     }
 
     return 0;
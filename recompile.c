@@ -0,0 +1,285 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"./include/6502c.h"
+#include"./include/bus.h"
+#include"./include/exec_tree.h"
+#include"./include/cfg.h"
+
+#define PRG_START 0x0600
+#define ROM_START 0x8000
+#define DEVICE_BEGIN 0x2000 // PPU, APU and controller registers
+#define DEVICE_END 0x401f
+#define ROM_BLOCKS 64 // compiled from a ROM unless told otherwise
+
+// Recompiles a flat program loaded at $0600 (see build_tree), or the hottest blocks of a
+// ROM, to a C file that links against the emulator, see include/aot.h for the runtime.
+
+static ExecNode *at[0x10000]; // instruction starting at each address
+static byte leader[0x10000]; // a basic block starts at the address
+static byte compiled[0x10000]; // the block starting at the address is emitted
+static unsigned int prg_start, prg_end; // code that stores can overwrite
+
+
+// Lowest and highest address an instruction can access, 0 if it accesses no memory
+static int access_range(ExecNode *node, unsigned int *low, unsigned int *high) {
+    byte (*addressing)(byte*, addr16*) = node->addressing_mode;
+    unsigned int base = node->cmd_len == 3 ? le_to_be(node->args[0], node->args[1]) : node->args[0];
+
+    if(is_opcode_jump(node->opcode) != NOT_JUMP_OP) { return 0; }
+
+    if(addressing == absolute) { *low = *high = base; }
+    else if(addressing == abs_x || addressing == abs_y) { *low = base; *high = base + 0xff; }
+    else if(addressing == zero_page || addressing == zero_page_x || addressing == zero_page_y) { *low = 0x00; *high = 0xff; }
+    else if(addressing == indirect_x || addressing == indirect_y) { *low = 0x0000; *high = 0xffff; }
+    else { return 0; }
+
+    return 1;
+}
+
+
+static int is_store(ExecNode *node) {
+    void (*func)(byte, byte*) = get_opcode_func(node->opcode);
+
+    return func == STA || func == STX || func == STY || func == INC || func == DEC
+        || func == ASL || func == LSR || func == ROL || func == ROR;
+}
+
+
+// A store into the program ends its block, the next block checks its code before running
+static int may_write_code(ExecNode *node) {
+    unsigned int low, high;
+
+    return is_store(node) && access_range(node, &low, &high) && low < prg_end && high >= prg_start;
+}
+
+
+// Device registers can run events in the middle of an instruction
+static int may_access_device(ExecNode *node) {
+    unsigned int low, high;
+
+    return access_range(node, &low, &high) && low <= DEVICE_END && high >= DEVICE_BEGIN;
+}
+
+
+// Control transfers end their block, BRK included
+static int ends_block(ExecNode *node) {
+    return is_opcode_jump(node->opcode) != NOT_JUMP_OP || node->opcode == 0x00 || may_write_code(node);
+}
+
+
+static void mark_leader(unsigned int addr) {
+    if(addr < 0x10000 && at[addr] != NULL) { leader[addr] = 1; }
+}
+
+
+// Keeps the instructions up to the first opcode the CPU does not know, the rest is treated as data
+static int analyse(char *filename) {
+    ExecMap *map = build_exec_map(filename);
+    int count = 0;
+
+    prg_start = prg_end = PRG_START;
+    for(ExecNode *node=map->at[PRG_START]; node!=NULL; node=exec_map_next(map, node)) {
+        if(get_opcode_func(node->opcode) == NULL) { break; }
+        at[node->index] = node;
+        prg_end = node->index + node->cmd_len;
+        count += 1;
+    }
+
+    mark_leader(PRG_START);
+    for(unsigned int addr=PRG_START; addr<prg_end; addr++) {
+        ExecNode *node = at[addr];
+        if(node == NULL) { continue; }
+
+        int kind = is_opcode_jump(node->opcode);
+        unsigned int next = addr + node->cmd_len;
+
+        if(kind == BRANCH_OP) { mark_leader((addr16)(next + (sbyte)node->args[0])); }
+        if(node->opcode == 0x4c || node->opcode == 0x20) { mark_leader(le_to_be(node->args[0], node->args[1])); }
+        if(ends_block(node)) { mark_leader(next); }
+    }
+
+    for(unsigned int addr=PRG_START; addr<prg_end; addr++) { compiled[addr] = leader[addr]; }
+
+    return count;
+}
+
+
+static int block_is_known(Cfg *cfg, CfgBlock *block) {
+    for(addr16 pc=block->start; pc!=block->end; pc+=cfg->map->at[pc]->cmd_len) {
+        if(get_opcode_func(cfg->map->at[pc]->opcode) == NULL) { return 0; }
+    }
+
+    return 1;
+}
+
+
+/* Takes the blocks of the graph of a ROM, innermost loops first, until the budget is
+   spent. They are compiled before the game runs any of them, the interpreter runs the
+   rest. Blocks outside of loops are never picked, their code runs too rarely to pay
+   for the check of its bytes.
+*/
+static int analyse_rom(char *filename, int budget, int *loops) {
+    start_bus_ines(filename);
+
+    Cfg *cfg = build_cfg();
+    CfgBlock **hot = (CfgBlock **)malloc(cfg->block_count * sizeof(CfgBlock *));
+    int count = 0, picked = 0;
+
+    if(hot == NULL) {
+        printf("Error: cannot allocate the hot blocks\n");
+        exit(1);
+    }
+
+    prg_start = ROM_START;
+    prg_end = 0x10000;
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        at[addr] = cfg->map->at[addr];
+        leader[addr] = cfg->leader[addr];
+    }
+
+    int size = cfg_hot_blocks(cfg, hot, cfg->block_count);
+    for(int i=0; i<size && picked<budget && hot[i]->depth>0; i++) {
+        if(!block_is_known(cfg, hot[i])) { continue; }
+
+        compiled[hot[i]->start] = 1;
+        count += hot[i]->instructions;
+        picked += 1;
+    }
+
+    *loops = cfg->loop_count;
+    free(hot);
+    // The instructions stay in the graph's arena until the program ends
+    return count;
+}
+
+
+static void emit_block(FILE *out, unsigned int start) {
+    unsigned int addr = start;
+
+    fprintf(out, "static int block_%04x() {\n", start);
+
+    while(1) {
+        ExecNode *node = at[addr];
+        unsigned int next = addr + node->cmd_len;
+        int last = ends_block(node) || next >= 0x10000 || leader[next] || at[next] == NULL;
+
+        fprintf(out, "    // $%04x %s %s\n", addr, exec_node_name(node), exec_node_mode_name(node));
+
+        // Handlers of control transfers read the PC of the next instruction, like in tick()
+        if(ends_block(node) && !may_write_code(node)) {
+            fprintf(out, "    mainCPU.PC = 0x%04x;\n", next);
+        }
+
+        // Devices may time themselves from the instruction, like OAM DMA
+        if(may_access_device(node)) {
+            fprintf(out, "    mainCPU.opcode = 0x%02x;\n", node->opcode);
+        }
+
+        fprintf(out, "    %s(0x%02x, (byte[]){0x%02x, 0x%02x});\n", exec_node_name(node), node->opcode,
+                node->cmd_len > 1 ? node->args[0] : 0, node->cmd_len > 2 ? node->args[1] : 0);
+        fprintf(out, "    mainCPU.cycles += %d;\n", instruction_cycles(node->opcode));
+
+        if(ends_block(node) && !may_write_code(node)) {
+            fprintf(out, "    if(mainCPU.cycles >= mainScheduler.next) { run_events(mainCPU.cycles); }\n");
+            fprintf(out, "    return 1;\n");
+            break;
+        }
+
+        fprintf(out, "    if(mainCPU.cycles >= mainScheduler.next) { aot_events(0x%04x); return 1; }\n", next);
+        if(may_access_device(node)) {
+            fprintf(out, "    if(aot_stopped(0x%04x)) { return 1; }\n", next);
+        }
+
+        if(last) {
+            fprintf(out, "    mainCPU.PC = 0x%04x;\n", next);
+            fprintf(out, "    return 1;\n");
+            break;
+        }
+
+        addr = next;
+    }
+
+    fprintf(out, "}\n\n\n");
+}
+
+
+static void emit_code(FILE *out, unsigned int start) {
+    unsigned int addr = start;
+
+    fprintf(out, "static const byte code_%04x[] = {", start);
+    while(1) {
+        ExecNode *node = at[addr];
+        unsigned int next = addr + node->cmd_len;
+
+        fprintf(out, "%s0x%02x", addr == start ? "" : ", ", node->opcode);
+        for(int i=1; i<node->cmd_len; i++) { fprintf(out, ", 0x%02x", node->args[i-1]); }
+
+        if(ends_block(node) || next >= 0x10000 || leader[next] || at[next] == NULL) { break; }
+        addr = next;
+    }
+    fprintf(out, "};\n");
+}
+
+
+int main(int argc, char **argv) {
+    int rom = argc >= 5 && strcmp(argv[1], "--rom") == 0;
+
+    if(argc < 4 || (argc == 4 && strcmp(argv[1], "--rom") == 0)) {
+        printf("Usage: %s <program.bin> <out.c> <name>\n", argv[0]);
+        printf("       %s --rom <rom.nes> <out.c> <name> [blocks]\n", argv[0]);
+        printf("    recompiles a program loaded at $%04x, or the blocks of the innermost loops of a ROM\n", PRG_START);
+        printf("    (%d unless told otherwise), the dispatch function is aot_<name>\n", ROM_BLOCKS);
+        return 1;
+    }
+
+    char *input = argv[1 + rom], *output = argv[2 + rom], *name = argv[3 + rom];
+    int loops = 0;
+    int count = rom ? analyse_rom(input, argc > 5 ? atoi(argv[5]) : ROM_BLOCKS, &loops) : analyse(input);
+    int blocks = 0;
+
+    FILE *out = fopen(output, "w");
+    if(out == NULL) {
+        printf("Error: cannot write %s\n", output);
+        exit(1);
+    }
+
+    fprintf(out, "// Recompiled from %s by ./recompile, do not edit\n\n", input);
+    fprintf(out, "#include\"./include/6502c.h\"\n");
+    fprintf(out, "#include\"./include/scheduler.h\"\n");
+    fprintf(out, "#include\"./include/aot.h\"\n\n\n");
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        if(compiled[addr]) {
+            emit_block(out, addr);
+            blocks += 1;
+        }
+    }
+
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        if(compiled[addr]) { emit_code(out, addr); }
+    }
+
+    fprintf(out, "\n\nint aot_%s(addr16 pc) {\n", name);
+    fprintf(out, "    switch(pc) {\n");
+    for(unsigned int addr=0; addr<0x10000; addr++) {
+        if(compiled[addr]) {
+            fprintf(out, "        case 0x%04x: return aot_code_matches(0x%04x, code_%04x, sizeof(code_%04x)) && block_%04x();\n",
+                    addr, addr, addr, addr, addr);
+        }
+    }
+    fprintf(out, "        default: return 0;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n");
+
+    fclose(out);
+    if(rom) {
+        printf("%s: %d instructions in %d blocks of %d loops\n", output, count, blocks, loops);
+    }
+    else {
+        printf("%s: %d instructions in %d blocks, $%04x - $%04x\n", output, count, blocks, PRG_START, prg_end - 1);
+    }
+
+    return 0;
+}
@@ -1,9 +1,852 @@
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+
 #include"./include/exec_tree.h"
+#include"./include/6502c.h"
+#include"./include/bus.h"
+#include"./include/ram.h"
+#include"./include/ppu.h"
+#include"./include/scheduler.h"
+#include"./include/input.h"
+#include"./include/idle.h"
+#include"./include/snapshot.h"
+#include"./include/capture.h"
+#include"./include/cfg.h"
+#include"./include/cfg_cache.h"
+#include"./include/lockstep.h"
+#include"./include/apu.h"
+#include"./include/aot.h"
+#include"./include/hash.h"
+#include"./include/fusion.h"
+
+
+// Generated from tests/smc_loop.bin by ./recompile
+int aot_smc_loop(addr16 pc);
+
+
+// The test is linked with -Wl,--wrap for these, so the calls from the emulator's objects
+// come here. The heap calls of this thread while counting_heap is set are counted,
+// test_run_ahead expects none inside run_frame_ahead.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static _Thread_local int counting_heap = 0;
+static _Thread_local unsigned long heap_calls = 0;
+
+void *__wrap_malloc(size_t size) { heap_calls += counting_heap; return __real_malloc(size); }
+void *__wrap_calloc(size_t count, size_t size) { heap_calls += counting_heap; return __real_calloc(count, size); }
+void *__wrap_realloc(void *ptr, size_t size) { heap_calls += counting_heap; return __real_realloc(ptr, size); }
+void __wrap_free(void *ptr) { heap_calls += counting_heap && ptr != NULL; __real_free(ptr); }
+
+
+void reset_machine(byte *prg, int len) {
+    initCPU(readCPU, writeCPU);
+    clear_events();
+    init_PPU(MIRROR_HORIZONTAL);
+    memset(RAM, 0, sizeof(RAM));
+
+    for(int i=0; i<len; i++) { mem_write(0x0600 + i, prg[i]); }
+    mainCPU.PC = 0x0600;
+}
+
+
+// LDA #$02, STA $4014 starting on an even cycle, then STA $4014 again starting on an odd one.
+// Then an indexed store to $4014, which takes a cycle more.
+int test_oam_dma() {
+    byte prg[] = {0xa9, 0x02, 0x8d, 0x14, 0x40, 0x8d, 0x14, 0x40};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    for(int i=0; i<256; i++) { mem_write(0x0200 + i, i ^ 0x5a); }
+
+    tick();
+    tick();
+    ok &= mainCPU.cycles == 2 + 4 + 513;
+    ok &= memcmp(mainPPU.oam, mem_page(0x02), 256) == 0;
+
+    tick();
+    ok &= mainCPU.cycles == 519 + 4 + 514;
+
+    // LDX #$14, STA $4000,X takes 5 cycles, starting on an even cycle the DMA starts on an odd one
+    byte indexed[] = {0xa9, 0x02, 0xa2, 0x14, 0x9d, 0x00, 0x40};
+    reset_machine(indexed, sizeof(indexed));
+
+    for(int i=0; i<3; i++) { tick(); }
+    ok &= mainCPU.cycles == 2 + 2 + 5 + 514;
+
+    printf("OAM DMA timing: %s (%lu cycles)\n", ok ? "OK" : "FAILED", mainCPU.cycles);
+    return ok;
+}
+
+
+// Strobes controller 1 and stores 9 reads of $4016 at $0300
+int test_controller() {
+    byte prg[10 + 9 * 6] = {0xa9, 0x01, 0x8d, 0x16, 0x40, 0xa9, 0x00, 0x8d, 0x16, 0x40};
+    byte buttons = (1 << BUTTON_A) | (1 << BUTTON_START) | (1 << BUTTON_RIGHT);
+    int ok = 1;
+
+    for(int i=0; i<9; i++) {
+        byte read_store[6] = {0xad, 0x16, 0x40, 0x8d, i, 0x03};
+        memcpy(prg + 10 + i * 6, read_store, 6);
+    }
+
+    reset_machine(prg, sizeof(prg));
+    init_input();
+    input_push(0, buttons);
+    input_begin_frame();
+
+    for(int i=0; i<4 + 9 * 2; i++) { tick(); }
+
+    for(int i=0; i<8; i++) {
+        ok &= (mem_read(0x0300 + i) & 1) == ((buttons >> i) & 1);
+    }
+    ok &= (mem_read(0x0308) & 1) == 1;
+
+    printf("Controller reads: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// LDA #1 / STA $0345 / STA $2000 marks page 3 only, the PPU register is not RAM
+int test_dirty_pages() {
+    byte prg[] = {0xa9, 0x01, 0x8d, 0x45, 0x03, 0x8d, 0x00, 0x20};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    for(int page=0; page<0x100; page++) { bus_take_dirty(page); }
+    for(int i=0; i<3; i++) { tick(); }
+
+    ok &= bus_take_dirty(0x03) && !bus_take_dirty(0x03);
+    for(int page=0; page<0x100; page++) { ok &= !bus_take_dirty(page); }
+
+    printf("Dirty RAM pages: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// LDA #0 / ORA $2002 / BPL waits for vblank with NMI off, then INC $10 and JMP * until the third frame.
+// Skipping the idle loops must end in the same state as running every pass.
+int test_idle_skip() {
+    byte prg[] = {0xa9, 0x00, 0x0d, 0x02, 0x20, 0x10, 0xf9, 0xe6, 0x10, 0x4c, 0x09, 0x06};
+    unsigned long ticks[2] = {0, 0};
+    CPU cpu[2];
+    byte counter[2];
+    int ok = 1;
+
+    for(int skip=0; skip<2; skip++) {
+        reset_machine(prg, sizeof(prg));
+        init_idle();
+        idle_enable(skip);
+
+        while(mainPPU.frame_count < 3) {
+            tick();
+            ticks[skip] += 1;
+        }
+
+        cpu[skip] = mainCPU;
+        counter[skip] = mem_read(0x10);
+    }
+    idle_enable(1);
+
+    ok &= cpu[0].cycles == cpu[1].cycles && cpu[0].PC == cpu[1].PC;
+    ok &= cpu[0].A == cpu[1].A && cpu[0].status == cpu[1].status;
+    ok &= counter[0] == 1 && counter[1] == 1;
+    ok &= ticks[1] * 100 < ticks[0];
+
+    printf("Idle loop skip: %s (%lu instructions instead of %lu)\n", ok ? "OK" : "FAILED", ticks[1], ticks[0]);
+    return ok;
+}
+
+
+
+// LDX #$f4 then ORA $3f22,X reads the controller at $4016 on every pass, the loop must
+// run every pass even though both ends of the indexed range are plain reads
+int test_idle_device_read() {
+    byte prg[] = {0xa2, 0xf4, 0xa9, 0x00, 0x1d, 0x22, 0x3f, 0x10, 0xf9};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    init_idle();
+
+    while(mainPPU.frame_count < 2) { tick(); }
+
+    ok &= mainIdle.skips == 0 && mainIdle.safe == 0;
+
+    printf("Idle loop reading a device: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// The loop of test_idle_skip run as two instances on one thread, a few instructions at a
+// time like an env worker. The second one starts 4 cycles later, so the instances wait in
+// the same loop for the same event but pass its head at other cycles.
+int test_idle_instances() {
+    byte prg[] = {0xa9, 0x00, 0x0d, 0x02, 0x20, 0x10, 0xf9, 0xe6, 0x10, 0x4c, 0x09, 0x06};
+    Snapshot *snaps[2] = {create_snapshot(), create_snapshot()};
+    CPU cpu[2][2];
+    int ok = 1;
+
+    for(int skip=0; skip<2; skip++) {
+        for(int i=0; i<2; i++) {
+            reset_machine(prg, sizeof(prg));
+            mainCPU.cycles += i * 4;
+            save_state(snaps[i]);
+        }
+
+        init_idle();
+        idle_enable(skip);
+
+        int running = 2;
+        while(running > 0) {
+            running = 0;
+
+            for(int i=0; i<2; i++) {
+                load_state(snaps[i]);
+                for(int n=0; n<5 && mainPPU.frame_count < 3; n++) { tick(); }
+                running += mainPPU.frame_count < 3;
+                cpu[skip][i] = mainCPU;
+                save_state(snaps[i]);
+            }
+        }
+    }
+    idle_enable(1);
+
+    for(int i=0; i<2; i++) {
+        ok &= cpu[0][i].cycles == cpu[1][i].cycles && cpu[0][i].PC == cpu[1][i].PC;
+        ok &= cpu[0][i].A == cpu[1][i].A && cpu[0][i].status == cpu[1][i].status;
+    }
+
+    printf("Idle loop skip between instances: %s\n", ok ? "OK" : "FAILED");
+    free_snapshot(snaps[0]);
+    free_snapshot(snaps[1]);
+    return ok;
+}
+
+
+// Frames handed over right before closing are still written
+int test_capture_close() {
+    char path[] = "/tmp/test_capture.y4m";
+    byte pixels[CAPTURE_HEIGHT * CAPTURE_WIDTH];
+    int ok = 1;
+
+    for(int run=0; run<4; run++) {
+        Capture *cap = capture_open(path, CAPTURE_Y4M, 0);
+
+        for(int i=0; i<CAPTURE_BUFFERS * 2; i++) {
+            memset(pixels, i, sizeof(pixels));
+            capture_frame(cap, i, pixels);
+        }
+        unsigned long captured = cap->captured;
+        capture_close(cap);
+
+        FILE *file = fopen(path, "rb");
+        char header[128];
+        ok &= file != NULL && fgets(header, sizeof(header), file) != NULL;
+        fseek(file, 0, SEEK_END);
+        ok &= captured == CAPTURE_BUFFERS * 2;
+        ok &= ftell(file) == strlen(header) + captured * (6 + 3 * sizeof(pixels));
+        fclose(file);
+    }
+    unlink(path);
+
+    printf("Capture close: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// Two captures written at once, every plane of each file has the color of its own frames
+int test_capture_two() {
+    char *paths[2] = {"/tmp/test_capture_a.y4m", "/tmp/test_capture_b.y4m"};
+    static byte pixels[CAPTURE_HEIGHT * CAPTURE_WIDTH], plane[CAPTURE_HEIGHT * CAPTURE_WIDTH];
+    Capture *caps[2];
+    byte yuv[2][3];
+    int ok = 1;
+
+    for(int c=0; c<2; c++) {
+        caps[c] = capture_open(paths[c], CAPTURE_Y4M, 0);
+        for(int p=0; p<3; p++) { yuv[c][p] = caps[c]->yuv[p][0x11 + c * 0x10]; }
+    }
+
+    for(int i=0; i<CAPTURE_BUFFERS * 8; i++) {
+        for(int c=0; c<2; c++) {
+            memset(pixels, 0x11 + c * 0x10, sizeof(pixels));
+            capture_frame(caps[c], i, pixels);
+        }
+    }
+
+    for(int c=0; c<2; c++) {
+        capture_close(caps[c]);
+
+        FILE *file = fopen(paths[c], "rb");
+        char line[128];
+        ok &= file != NULL && fgets(line, sizeof(line), file) != NULL;
+
+        for(int i=0; ok && i<CAPTURE_BUFFERS * 8; i++) {
+            ok &= fgets(line, sizeof(line), file) != NULL && strcmp(line, "FRAME\n") == 0;
+            for(int p=0; p<3; p++) {
+                ok &= fread(plane, 1, sizeof(plane), file) == sizeof(plane);
+                for(int k=0; k<sizeof(plane); k++) { ok &= plane[k] == yuv[c][p]; }
+            }
+        }
+
+        if(file != NULL) { fclose(file); }
+        unlink(paths[c]);
+    }
+
+    printf("Two captures at once: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// DEX / BNE $0600 / JMP $0600 decoded one instruction at a time from memory, then the
+// DEX is overwritten with INX
+int test_lazy_tree() {
+    byte prg[] = {0xca, 0xd0, 0xfd, 0x4c, 0x00, 0x06};
+    ExecMap *map = create_exec_map();
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+
+    ExecNode *root = lazy_exec_node(map, 0x0600);
+    lazy_link_node(map, root);
+    ok &= map->count == 2 && root->yes != NULL && root->yes->index == 0x0601 && root->no == NULL;
+
+    ExecNode *branch = root->yes;
+    lazy_link_node(map, branch);
+    ok &= map->count == 3 && branch->no == root && branch->yes->opcode == 0x4c;
+
+    lazy_link_node(map, branch->yes);
+    ok &= branch->yes->yes == root && branch->yes->no == NULL;
+
+    mem_write(0x0600, 0xe8);
+    ok &= lazy_exec_node(map, 0x0600) == root && root->opcode == 0xe8 && map->count == 3;
+
+    printf("Lazy execution tree: %s (%d instructions decoded)\n", ok ? "OK" : "FAILED", map->count);
+    free_exec_map(map);
+    return ok;
+}
+
+
+// LDX #3 / JSR $0610 / DEX / BNE $0602 / JMP ($0020), three bytes of data, then the
+// routine LDA #1 / RTS and an RTI for both interrupt vectors
+int test_cfg() {
+    byte prg[] = {0xa2, 0x03, 0x20, 0x10, 0x06, 0xca, 0xd0, 0xfa, 0x6c, 0x20, 0x00, 0xff, 0xff, 0xff,
+        0x00, 0x00, 0xa9, 0x01, 0x60, 0x40};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    mem_write(0xfffa, 0x13); mem_write(0xfffb, 0x06);
+    mem_write(0xfffc, 0x00); mem_write(0xfffd, 0x06);
+    mem_write(0xfffe, 0x13); mem_write(0xffff, 0x06);
+
+    Cfg *cfg = build_cfg();
+    CfgBlock *loop = cfg_block_at(cfg, 0x0605);
+
+    ok &= cfg->block_count == 6 && cfg->routine_count == 3;
+    ok &= cfg->call_count == 1 && cfg->routines[cfg->calls[0].caller].entry == 0x0600;
+    ok &= cfg->routines[cfg->calls[0].callee].entry == 0x0610;
+    ok &= cfg->indirect_count == 1 && cfg->indirect[0] == 0x0608;
+    ok &= loop != NULL && loop->exit == CFG_BRANCH && loop->taken == cfg_block_at(cfg, 0x0602);
+    ok &= cfg_block_at(cfg, 0x0602)->next == loop;
+    ok &= cfg->map->at[0x060b] == NULL; // data is not decoded
+
+    printf("Control-flow graph: %s (%d blocks, %d routines)\n", ok ? "OK" : "FAILED", cfg->block_count, cfg->routine_count);
+    free_cfg(cfg);
+    return ok;
+}
+
+
+// LDX #3 / JSR $0300 / DEX / BNE $8002 / RTI in the PRG data, the routine at $0300 is in RAM.
+// The cache keeps the PRG code only, so other code copied to $0300 is decoded when it runs.
+int test_cfg_cache() {
+    byte prg[] = {0xa2, 0x03, 0x20, 0x00, 0x03, 0xca, 0xd0, 0xfa, 0x40};
+    byte routine[] = {0xa9, 0x01, 0x60};
+    char path[] = "/tmp/test_cfg.cache";
+    int ok = 1;
+
+    reset_machine(routine, 0);
+    for(int i=0; i<sizeof(prg); i++) { mem_write(0x8000 + i, prg[i]); }
+    for(int i=0; i<sizeof(routine); i++) { mem_write(0x0300 + i, routine[i]); }
+    for(addr16 addr=0xfffa; addr>=0xfffa; addr+=2) { mem_write(addr, 0x08); mem_write(addr + 1, 0x80); }
+    mem_write(0xfffc, 0x00);
+
+    Cfg *cfg = build_cfg();
+    ok &= cfg->block_count == 5 && cfg->map->at[0x0300] != NULL;
+    ok &= save_cfg_cache(cfg, path);
+    free_cfg(cfg);
+
+    Cfg *cached = load_cfg_cache(path);
+    ok &= cached != NULL;
+    if(cached != NULL) {
+        CfgBlock *call = cfg_block_at(cached, 0x8002);
+
+        ok &= cached->block_count == 4 && cached->map->count == 5 && cached->map->at[0x0300] == NULL;
+        ok &= call != NULL && call->taken == NULL && call->next == cfg_block_at(cached, 0x8005);
+        ok &= cached->call_count == 1 && cfg_block_at(cached, 0x8005)->taken == call;
+
+        mem_write(0x0300, 0xa0); // LDY #1
+        mainCPU.PC = 0x8000;
+        cfg_refine_start(cached);
+        for(int i=0; i<3; i++) { tick(); }
+        cfg_refine_stop();
+
+        ok &= mainCPU.Y == 1 && cached->map->at[0x0300] != NULL && cached->map->at[0x0300]->opcode == 0xa0;
+        free_cfg(cached);
+    }
+
+    // The graph is not used once the PRG data changes
+    mem_write(0x8000, 0xea);
+    ok &= load_cfg_cache(path) == NULL;
+    unlink(path);
+
+    printf("Control-flow graph cache: %s\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+
+// LDY #2 / LDX #3 / DEX / BNE / DEY / BNE / BRK, the DEX loop is inside the DEY loop
+int test_cfg_loops() {
+    byte prg[] = {0xa0, 0x02, 0xa2, 0x03, 0xca, 0xd0, 0xfd, 0x88, 0xd0, 0xf8, 0x00};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    for(addr16 addr=0xfffa; addr>=0xfffa; addr+=2) { mem_write(addr, 0x00); mem_write(addr + 1, 0x06); }
+
+    Cfg *cfg = build_cfg();
+    CfgBlock *outer = cfg_block_at(cfg, 0x0602), *inner = cfg_block_at(cfg, 0x0604);
+    CfgBlock *latch = cfg_block_at(cfg, 0x0607), *hot[2];
+
+    ok &= cfg->block_count == 5 && cfg->loop_count == 2 && cfg->max_depth == 2;
+    ok &= outer->header && inner->header && !latch->header;
+    ok &= cfg_block_at(cfg, 0x0600)->depth == 0 && outer->depth == 1 && inner->depth == 2;
+    ok &= latch->depth == 1 && cfg_block_at(cfg, 0x060a)->depth == 0;
+    ok &= inner->idom == outer && latch->idom == inner && cfg_dominates(outer, latch) && !cfg_dominates(latch, outer);
+    ok &= cfg_hot_blocks(cfg, hot, 2) == 2 && hot[0] == inner && hot[1] == outer;
+
+    printf("Control-flow graph loops: %s (%d loops)\n", ok ? "OK" : "FAILED", cfg->loop_count);
+    free_cfg(cfg);
+    return ok;
+}
+
+
+// JMP ($0020) lands on INC $20 / INC $20 / JMP $0600 after a data byte, so the next pass
+// lands on the second INC in the middle of the block found by the first one
+int test_cfg_refine() {
+    byte prg[] = {0x6c, 0x20, 0x00, 0xff, 0xe6, 0x20, 0xe6, 0x20, 0x4c, 0x00, 0x06};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    for(addr16 addr=0xfffa; addr>=0xfffa; addr+=2) { mem_write(addr, 0x00); mem_write(addr + 1, 0x06); }
+    mem_write(0x20, 0x04);
+    mem_write(0x21, 0x06);
+
+    Cfg *cfg = build_cfg();
+    ok &= cfg->block_count == 1 && cfg->indirect_count == 1;
+
+    cfg_refine_start(cfg);
+    for(int i=0; i<7; i++) { tick(); }
+    cfg_refine_stop();
+
+    CfgBlock *first = cfg_block_at(cfg, 0x0604), *second = cfg_block_at(cfg, 0x0606);
+
+    ok &= cfg->block_count == 3 && cfg->found_blocks == 1 && cfg->split_blocks == 1;
+    ok &= first != NULL && second != NULL && first->next == second && second->exit == CFG_JUMP;
+    ok &= first->instructions == 1 && second->instructions == 2;
+    ok &= cfg->target_count == 2 && cfg->targets[1].target == 0x0606;
+    ok &= cfg->map->at[0x0603] == NULL;
+
+    printf("Control-flow graph refinement: %s (%d instructions decoded at run time)\n", ok ? "OK" : "FAILED", cfg->refined_instructions);
+    free_cfg(cfg);
+    return ok;
+}
+
+// INX; CPX #$03; BNE runs as one fused dispatch, the graph still sees all three instructions
+int test_cfg_fusion() {
+    byte prg[] = {0xe8, 0xe0, 0x03, 0xd0, 0xfb, 0x4c, 0x00, 0x06};
+    int ok = 1;
+
+    reset_machine(prg, sizeof(prg));
+    init_fusion();
+    fusion_enable(1);
+
+    Cfg *cfg = build_cfg();
+    cfg_refine_start(cfg);
+    tick();
+    ok &= mainCPU.X == 1;
+    ok &= cfg->last_pc == 0x0603 && cfg->last_opcode == 0xd0;
+    cfg_refine_stop();
+
+    printf("Control-flow graph with fusion: %s\n", ok ? "OK" : "FAILED");
+    free_cfg(cfg);
+    return ok;
+}
+
+
+/* Random programs made of the opcodes with a vector handler, run by lockstep_run and by
+   lockstep_run_lane for every lane on its own. Branches and jumps only go forward and the
+   program ends with JMP $0600, stores stay below the program.
+*/
+int test_lockstep() {
+    const int lanes = 16, programs = 50, length = 48, instructions = 3000;
+    byte vectorized[256];
+    int count = 0;
+    int ok = 1;
+    unsigned long vector_lanes = 0;
+
+    for(int opcode=0; opcode<256; opcode++) {
+        if(lockstep_vectorized(opcode)) { vectorized[count++] = opcode; }
+    }
+
+    srand(38);
+    for(int p=0; p<programs; p++) {
+        byte prg[length * 3 + 3];
+        int addr[length + 1];
+        byte ops[length];
+        int len = 0;
+
+        for(int i=0; i<length; i++) {
+            ops[i] = vectorized[rand() % count];
+            addr[i] = len;
+            len += instruction_len(ops[i]);
+        }
+        addr[length] = len;
+
+        for(int i=0; i<length; i++) {
+            byte opcode = ops[i];
+            int target = i + 1 + rand() % (length - i); // up to the closing JMP
+            int operand = (rand() & 0xff) | (0x02 + rand() % 3) << 8; // $0200 - $04ff, plus X or Y stays below $0600
+
+            prg[addr[i]] = opcode;
+            if(opcode == 0x4c) { operand = 0x0600 + addr[target]; }
+            else if(instruction_len(opcode) == 2 && (opcode & 0x1f) == 0x10) {
+                int offset = addr[target] - (addr[i] + 2);
+                operand = offset > 127 ? 0 : offset;
+            }
+            if(instruction_len(opcode) > 1) { prg[addr[i] + 1] = operand & 0xff; }
+            if(instruction_len(opcode) > 2) { prg[addr[i] + 2] = operand >> 8; }
+        }
+        prg[len] = 0x4c;
+        prg[len + 1] = 0x00;
+        prg[len + 2] = 0x06;
+
+        Lockstep *together = lockstep_create(lanes, KERNEL_BEST);
+        Lockstep *alone = lockstep_create(lanes, KERNEL_SCALAR);
+        lockstep_reset(together, 0x0600);
+        lockstep_reset(alone, 0x0600);
+
+        for(int lane=0; lane<lanes; lane++) {
+            for(int a=0; a<0x0600; a++) { lockstep_memory(together, lane)[a] = lockstep_memory(alone, lane)[a] = rand(); }
+            memcpy(lockstep_memory(together, lane) + 0x0600, prg, len + 3);
+            memcpy(lockstep_memory(alone, lane) + 0x0600, prg, len + 3);
+
+            together->A[lane] = alone->A[lane] = rand() & 0xff;
+            together->X[lane] = alone->X[lane] = rand() & 0xff;
+            together->Y[lane] = alone->Y[lane] = rand() & 0xff;
+            together->status[lane] = alone->status[lane] = rand() & 0xff;
+        }
+
+        lockstep_run(together, instructions);
+        for(int lane=0; lane<lanes; lane++) { lockstep_run_lane(alone, lane, instructions); }
+
+        for(int lane=0; lane<lanes; lane++) {
+            ok &= together->A[lane] == alone->A[lane] && together->X[lane] == alone->X[lane];
+            ok &= together->Y[lane] == alone->Y[lane] && together->SP[lane] == alone->SP[lane];
+            ok &= together->PC[lane] == alone->PC[lane] && together->status[lane] == alone->status[lane];
+            ok &= together->cycles[lane] == alone->cycles[lane] && together->retired[lane] == alone->retired[lane];
+            ok &= memcmp(lockstep_memory(together, lane), lockstep_memory(alone, lane), LOCKSTEP_MEM_SIZE) == 0;
+        }
+
+        vector_lanes += together->vector_lanes;
+        lockstep_free(together);
+        lockstep_free(alone);
+    }
+
+    printf("Lockstep lanes: %s (%d opcodes, %lu lane instructions vectorized)\n", ok ? "OK" : "FAILED", count, vector_lanes);
+    return ok;
+}
+
+
+/* Rendering on and a pulse channel playing, run ahead by 0 to RUN_AHEAD_MAX frames.
+   Nothing inside run_frame_ahead may allocate or free, and running ahead must not change
+   the real frames.
+*/
+int test_run_ahead() {
+    byte prg[] = {
+        0xa9, 0x1e, 0x8d, 0x01, 0x20, // LDA #$1e, STA $2001
+        0xa9, 0x01, 0x8d, 0x15, 0x40, // LDA #$01, STA $4015
+        0xa9, 0xbf, 0x8d, 0x00, 0x40, // LDA #$bf, STA $4000
+        0xa9, 0xfd, 0x8d, 0x02, 0x40, // LDA #$fd, STA $4002
+        0xa9, 0x00, 0x8d, 0x03, 0x40, // LDA #$00, STA $4003
+        0xe6, 0x10, 0x4c, 0x19, 0x06, // INC $10, JMP $0619
+    };
+    static byte display[SCREEN_HEIGHT][SCREEN_WIDTH];
+    short samples[2048];
+    unsigned long cycles = 0;
+    byte counter = 0;
+    int ok = 1;
+    unsigned long calls = 0;
+
+    for(int ahead=0; ahead<=RUN_AHEAD_MAX; ahead = ahead ? ahead * 2 : 1) {
+        reset_machine(prg, sizeof(prg));
+        init_APU(mainCPU.cycles);
+        apu_enable_output(APU_SAMPLE_RATE);
+
+        Snapshot *snap = create_snapshot();
+        RunAheadStats stats = {0};
+
+        for(int i=0; i<10; i++) {
+            counting_heap = 1;
+            run_frame_ahead(snap, ahead, &display[0][0], &stats);
+            counting_heap = 0;
+            apu_read_samples(mainCPU.cycles, samples, 2048);
+        }
+        calls += heap_calls;
+        heap_calls = 0;
+
+        if(ahead == 0) { cycles = mainCPU.cycles; counter = mem_read(0x10); }
+        ok &= mainCPU.cycles == cycles && mem_read(0x10) == counter;
+        free_snapshot(snap);
+    }
+
+    ok &= calls == 0;
+
+    printf("Run-ahead: %s (%lu heap calls)\n", ok ? "OK" : "FAILED", calls);
+    return ok;
+}
+
+
+/* tests/smc_loop.bin increments the operand of an LDA # in its own loop body, the
+   recompiled block holding it only runs again once the byte wrapped back to $00.
+   Two frames recompiled must end in the same state as two frames on tick().
+*/
+int test_aot_smc() {
+    byte prg[32];
+    FILE *file = fopen("./tests/smc_loop.bin", "rb");
+    int len = file != NULL ? fread(prg, 1, sizeof(prg), file) : 0;
+    hash64 state[2];
+    int ok = len > 0;
+
+    if(file != NULL) { fclose(file); }
+
+    idle_enable(0);
+    for(int run=0; run<2; run++) {
+        reset_machine(prg, len);
+        init_aot();
+
+        for(int i=0; i<2; i++) {
+            if(run == 1) { aot_run_frame(aot_smc_loop); }
+            else { run_frame(); }
+        }
+        state[run] = hash_state();
+    }
+    idle_enable(1);
+
+    ok &= state[0] == state[1];
+    ok &= mainAot.code_changed > 0 && mainAot.blocks > mainAot.code_changed;
+
+    printf("Recompiled self-modifying code: %s (%lu blocks run, %lu overwritten)\n", ok ? "OK" : "FAILED", mainAot.blocks, mainAot.code_changed);
+    return ok;
+}
+
+
+// Sprite 0 (lines 50 - 57, x 100 - 107) over one opaque background tile at x 104 - 111,
+// y 56 - 63, and nine sprites on lines 120 - 127
+void reset_sprite_scene() {
+    static byte chr[CHR_SIZE];
+    byte prg[] = {0x4c, 0x00, 0x06};
+
+    reset_machine(prg, sizeof(prg));
+    memset(chr + 16, 0xff, 8); // tile 1 is opaque
+    ppu_load_chr(chr, sizeof(chr));
+    ppu_write(0x2000 + 7 * 32 + 13, 1);
+
+    memset(mainPPU.oam, 0xff, sizeof(mainPPU.oam));
+    byte sprite0[] = {49, 1, 0, 100};
+    memcpy(mainPPU.oam, sprite0, 4);
+    for(int i=1; i<10; i++) {
+        byte sprite[] = {119, 1, 0, 200};
+        memcpy(mainPPU.oam + i * 4, sprite, 4);
+    }
+
+    ppu_write_register(0x2001, 0x1e);
+}
+
+
+/* The predicted SPRITE0 and OVERFLOW cycles against the scanline renderer: $2002 shows the
+   flag from the predicted cycle on, and the renderer sets it when it renders the same line
+   (the overflow is evaluated at the end of the line before the sprites).
+*/
+int test_sprite_prediction() {
+    int flags[2] = {STATUS_SPRITE0, STATUS_OVERFLOW};
+    int events[2] = {EVENT_SPRITE0, EVENT_OVERFLOW};
+    int predicted[2], rendered[2] = {-1, -1};
+    int ok = 1;
+
+    for(int f=0; f<2; f++) {
+        reset_sprite_scene();
+        ppu_sync_status(mainCPU.cycles);
+
+        unsigned long cycle = mainScheduler.events[events[f]].cycle;
+        ok &= cycle != NO_EVENT;
+        predicted[f] = cycle * 3 / DOTS_PER_LINE;
+
+        mainCPU.cycles = cycle - 1;
+        ok &= !(readCPU(0x2002) & (1 << flags[f]));
+        mainCPU.cycles = cycle;
+        ok &= (readCPU(0x2002) & (1 << flags[f])) != 0;
+    }
+
+    // Only the renderer sets the flags here
+    reset_sprite_scene();
+    ppu_predict(mainCPU.cycles);
+    cancel_event(EVENT_SPRITE0);
+    cancel_event(EVENT_OVERFLOW);
+
+    for(int line=0; line<SCREEN_HEIGHT; line++) {
+        ppu_catch_up(((line + 1) * DOTS_PER_LINE + 2) / 3);
+        for(int f=0; f<2; f++) {
+            if(rendered[f] < 0 && (mainPPU.status & (1 << flags[f]))) { rendered[f] = line; }
+        }
+    }
+
+    ok &= predicted[0] == 56 && rendered[0] == 56;
+    ok &= predicted[1] == 119 && rendered[1] == 120;
+
+    printf("Sprite 0 and overflow prediction: %s (sprite 0 on line %d, overflow on line %d)\n", ok ? "OK" : "FAILED", predicted[0], predicted[1]);
+    return ok;
+}
+
+
+/* Every compose kernel the CPU has, forced with ppu_select_kernels, on the same random
+   scanlines and frame as the scalar one. Some lines only hit sprite 0 at x = 255, which
+   does not count. The frame is converted from ppu_target when it is set.
+*/
+int test_compose_kernels() {
+    static unsigned int rgba[KERNEL_BEST][SCREEN_WIDTH * SCREEN_HEIGHT];
+    byte bg[SCREEN_WIDTH], spr[SCREEN_WIDTH], behind[SCREEN_WIDTH], zero[SCREEN_WIDTH];
+    byte out[KERNEL_BEST][SCREEN_WIDTH];
+    int hit[KERNEL_BEST];
+    int kernels = 0;
+    int ok = 1;
+
+    srand(27);
+    for(int i=0; i<SCREEN_WIDTH * SCREEN_HEIGHT; i++) { mainPPU.frame[0][i] = rand(); }
+    for(int i=0; i<32; i++) { mainPPU.palette[i] = rand(); }
+
+    for(int line=0; line<256; line++) {
+        for(int x=0; x<SCREEN_WIDTH; x++) {
+            bg[x] = rand() & 0x0f;
+            spr[x] = rand() % 3 ? 0 : 0x10 | (rand() & 0x0f);
+            behind[x] = rand() & 1;
+            zero[x] = rand() % 16 == 0;
+        }
+        if(line % 4 == 0) {
+            memset(zero, 0, sizeof(zero));
+            zero[255] = spr[255] = 0x11;
+            bg[255] = 0x01;
+        }
+
+        kernels = 0;
+        for(int level=KERNEL_SCALAR; level<KERNEL_BEST; level++) {
+            if(ppu_select_kernels(level) != level) { break; }
+            hit[level] = ppu_compose_line(bg, spr, behind, zero, out[level]);
+            kernels += 1;
+
+            ok &= hit[level] == hit[0] && memcmp(out[level], out[0], SCREEN_WIDTH) == 0;
+        }
+    }
+
+    // The AVX2 kernels also gather RGBA for the whole frame
+    for(int level=KERNEL_SCALAR; level<kernels; level++) {
+        ppu_select_kernels(level);
+        ppu_frame_to_rgba(rgba[level]);
+        ok &= memcmp(rgba[level], rgba[0], sizeof(rgba[0])) == 0;
+    }
+    ppu_select_kernels(KERNEL_BEST);
+
+    // A frame rendered into ppu_target is the one converted
+    static byte target[SCREEN_WIDTH * SCREEN_HEIGHT];
+    for(int i=0; i<sizeof(target); i++) { target[i] = i * 7; }
+    ppu_target = target;
+    ppu_frame_to_rgba(rgba[0]);
+    ppu_target = NULL;
+    for(int i=0; i<sizeof(target); i++) { ok &= rgba[0][i] == ppu_color_rgba(target[i]); }
+
+    printf("Compose kernels: %s (%d kernels compared)\n", ok ? "OK" : "FAILED", kernels);
+    return ok;
+}
+
+
+/* Pulse 1 at period $0fd (CPU_CLOCK_RATE / (16 * 254), about 440 Hz) and 50% duty for one
+   second: one sample per 1 / APU_SAMPLE_RATE of CPU time and two zero crossings per period.
+   The first frames are left out of the crossings while the bass filter settles.
+*/
+int test_apu_pulse() {
+    static short samples[APU_SAMPLE_RATE];
+    byte regs[][2] = {{0x15, 0x01}, {0x00, 0xbf}, {0x02, 0xfd}, {0x03, 0x00}};
+    const int frames = 60, settle = 5;
+    unsigned long cycles = 0;
+    long count = 0, settled = 0;
+    int ok = 1;
+
+    clear_events();
+    init_APU(0);
+    apu_enable_output(APU_SAMPLE_RATE);
+    for(int i=0; i<4; i++) { apu_write_register(APU_REG_BEGIN + regs[i][0], regs[i][1]); }
+
+    for(int i=0; i<frames; i++) {
+        cycles += 29781; // CPU cycles per NTSC frame
+        run_events(cycles);
+        count += apu_read_samples(cycles, samples + count, APU_SAMPLE_RATE - count);
+        if(i + 1 == settle) { settled = count; }
+    }
+
+    int crossings = 0;
+    for(long i=settled + 1; i<count; i++) {
+        crossings += (samples[i - 1] < 0) != (samples[i] < 0);
+    }
+
+    double expected_count = (double)cycles * APU_SAMPLE_RATE / CPU_CLOCK_RATE;
+    double seconds = (double)(count - settled) / APU_SAMPLE_RATE;
+    double expected_crossings = 2 * seconds * CPU_CLOCK_RATE / (16.0 * 254);
+
+    ok &= count > expected_count - 2 && count < expected_count + 2;
+    ok &= crossings > expected_crossings * 0.99 - 2 && crossings < expected_crossings * 1.01 + 2;
+
+    printf("APU pulse: %s (%ld samples, %d zero crossings, expected %.0f and %.0f)\n", ok ? "OK" : "FAILED",
+            count, crossings, expected_count, expected_crossings);
+    return ok;
+}
 
 
 int main() {
     ExecNode *nd = build_tree("./tests/test1.bin");
     print_tree(nd);
-    printf("Addressing mode: %s\n", nd->addressing_mode_name);
-    return 1;
+    printf("Addressing mode: %s\n", exec_node_mode_name(nd));
+
+    int ok = test_oam_dma();
+    ok &= test_controller();
+    ok &= test_dirty_pages();
+    ok &= test_idle_skip();
+    ok &= test_idle_instances();
+    ok &= test_idle_device_read();
+    ok &= test_capture_close();
+    ok &= test_capture_two();
+    ok &= test_lazy_tree();
+    ok &= test_cfg();
+    ok &= test_cfg_cache();
+    ok &= test_cfg_loops();
+    ok &= test_cfg_refine();
+    ok &= test_cfg_fusion();
+    ok &= test_lockstep();
+    ok &= test_run_ahead();
+    ok &= test_aot_smc();
+    ok &= test_sprite_prediction();
+    ok &= test_compose_kernels();
+    ok &= test_apu_pulse();
+
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,9 @@
+copy:
+  LDX #$40
+next:
+  LDA $01ff,X
+  STA $02ff,X
+  DEX
+  BNE next
+  INC $10
+  JMP copy
@@ -0,0 +1,12 @@
+start:
+  LDX #$08
+loop:
+  INC patch+1
+patch:
+  LDA #$00
+  CLC
+  ADC $10
+  STA $10
+  DEX
+  BNE loop
+  JMP start